@@ -0,0 +1,753 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Copyright (C) 2020 Jozsef Horvath <info@ministro.hu>
+ *
+ * Throughput and latency benchmark for ttySSi links.
+ *
+ * Every write is a record: sync(2), sequence(4), timestamp(8), pattern.
+ * The receiver resynchronizes on the sync bytes and checks the pattern,
+ * so lost, split or merged packets do not break the measurement.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <libgen.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_SYNC0		0x55
+#define BENCH_SYNC1		0xAA
+#define BENCH_HDR_SIZE		14
+#define BENCH_REC_MAX		4096
+#define BENCH_LIST_MAX		32
+
+enum bench_mode {
+	BENCH_MODE_THROUGHPUT,
+	BENCH_MODE_RTT,
+	BENCH_MODE_ECHO,
+};
+
+struct bench_opts {
+	enum bench_mode mode;
+	const char *tx_dev;
+	const char *rx_dev;
+	unsigned int count;
+	unsigned int timeout_ms;
+	unsigned int interval_us;
+	unsigned int sizes[BENCH_LIST_MAX];
+	unsigned int nsizes;
+	int package_sizes[BENCH_LIST_MAX];
+	unsigned int npackage_sizes;
+	int json;
+};
+
+struct bench_stream {
+	uint8_t buf[2 * BENCH_REC_MAX];
+	size_t len;
+	size_t rec_size;
+	unsigned long long corrupt_bytes;
+};
+
+struct bench_result {
+	const char *mode;
+	int package_size;
+	unsigned int write_size;
+	unsigned int sent;
+	unsigned int received;
+	unsigned int duplicated;
+	unsigned long long corrupt_bytes;
+	unsigned long long bytes;
+	uint64_t elapsed_ns;
+	uint64_t *samples;
+	unsigned int nsamples;
+};
+
+static volatile sig_atomic_t bench_stop;
+
+static void bench_signal(int sig)
+{
+	(void)sig;
+	bench_stop = 1;
+}
+
+static uint64_t bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int bench_open(const char *path)
+{
+	struct termios tio;
+	int fd;
+
+	fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if (fd < 0) {
+		fprintf(stderr, "%s: open error (%s)\n", path, strerror(errno));
+		return -1;
+	}
+
+	if (tcgetattr(fd, &tio) == 0) {
+		cfmakeraw(&tio);
+		tio.c_cc[VMIN] = 0;
+		tio.c_cc[VTIME] = 0;
+		tcsetattr(fd, TCSANOW, &tio);
+	}
+	tcflush(fd, TCIOFLUSH);
+
+	return fd;
+}
+
+static int bench_sysfs_path(const char *dev, const char *attr, char *path,
+			    size_t size)
+{
+	char name[PATH_MAX];
+
+	snprintf(name, sizeof(name), "%s", dev);
+
+	return snprintf(path, size, "/sys/class/tty/%s/device/%s",
+			basename(name), attr) >= (int)size ? -1 : 0;
+}
+
+static int bench_get_package_size(const char *dev)
+{
+	char path[PATH_MAX];
+	FILE *f;
+	int val = -1;
+
+	if (bench_sysfs_path(dev, "package_size", path, sizeof(path)))
+		return -1;
+
+	f = fopen(path, "r");
+	if (!f)
+		return -1;
+
+	if (fscanf(f, "%d", &val) != 1)
+		val = -1;
+	fclose(f);
+
+	return val;
+}
+
+static int bench_set_package_size(const char *dev, int val)
+{
+	char path[PATH_MAX];
+	FILE *f;
+	int ret;
+
+	if (bench_sysfs_path(dev, "package_size", path, sizeof(path)))
+		return -1;
+
+	f = fopen(path, "w");
+	if (!f) {
+		fprintf(stderr, "%s: open error (%s)\n", path, strerror(errno));
+		return -1;
+	}
+
+	ret = fprintf(f, "%d\n", val) < 0 ? -1 : 0;
+	if (fclose(f))
+		ret = -1;
+	if (ret)
+		fprintf(stderr, "%s: write error (%s)\n", path, strerror(errno));
+
+	return ret;
+}
+
+static void bench_record(uint8_t *rec, size_t size, uint32_t seq, uint64_t ts)
+{
+	size_t i;
+
+	rec[0] = BENCH_SYNC0;
+	rec[1] = BENCH_SYNC1;
+	memcpy(&rec[2], &seq, sizeof(seq));
+	memcpy(&rec[6], &ts, sizeof(ts));
+	for (i = BENCH_HDR_SIZE; i < size; i++)
+		rec[i] = (uint8_t)(seq + i);
+}
+
+static int bench_record_valid(const uint8_t *rec, size_t size, uint32_t *seq,
+			      uint64_t *ts)
+{
+	size_t i;
+
+	if (rec[0] != BENCH_SYNC0 || rec[1] != BENCH_SYNC1)
+		return 0;
+
+	memcpy(seq, &rec[2], sizeof(*seq));
+	memcpy(ts, &rec[6], sizeof(*ts));
+	for (i = BENCH_HDR_SIZE; i < size; i++) {
+		if (rec[i] != (uint8_t)(*seq + i))
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * Writes the whole buffer, waiting for the port if it is full.
+ */
+static int bench_write(int fd, const uint8_t *data, size_t size,
+		       unsigned int timeout_ms)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+	ssize_t ret;
+
+	while (size && !bench_stop) {
+		ret = write(fd, data, size);
+		if (ret > 0) {
+			data += ret;
+			size -= ret;
+			continue;
+		}
+
+		if (ret < 0 && errno != EAGAIN && errno != EINTR) {
+			fprintf(stderr, "write error (%s)\n", strerror(errno));
+			return -1;
+		}
+
+		ret = poll(&pfd, 1, timeout_ms);
+		if (ret == 0) {
+			fprintf(stderr, "write timeout\n");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Reads the available bytes into the stream.
+ * Returns the number of bytes read, 0 if none, -1 on error.
+ */
+static ssize_t bench_stream_read(struct bench_stream *stream, int fd)
+{
+	ssize_t ret;
+
+	ret = read(fd, &stream->buf[stream->len],
+		   sizeof(stream->buf) - stream->len);
+	if (ret < 0)
+		return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+
+	stream->len += ret;
+
+	return ret;
+}
+
+/*
+ * Takes the next valid record from the stream.
+ * Bytes not belonging to a valid record are dropped and counted.
+ */
+static int bench_stream_next(struct bench_stream *stream, uint32_t *seq,
+			     uint64_t *ts)
+{
+	size_t pos = 0;
+	int found = 0;
+
+	while (stream->len - pos >= stream->rec_size) {
+		if (bench_record_valid(&stream->buf[pos], stream->rec_size,
+				       seq, ts)) {
+			pos += stream->rec_size;
+			found = 1;
+			break;
+		}
+		pos++;
+		stream->corrupt_bytes++;
+	}
+
+	memmove(stream->buf, &stream->buf[pos], stream->len - pos);
+	stream->len -= pos;
+
+	return found;
+}
+
+static int bench_cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double bench_percentile_us(const struct bench_result *r,
+				  unsigned int pct)
+{
+	unsigned int i;
+
+	if (!r->nsamples)
+		return 0;
+
+	i = (unsigned long long)r->nsamples * pct / 100;
+	if (i >= r->nsamples)
+		i = r->nsamples - 1;
+
+	return r->samples[i] / 1000.0;
+}
+
+/*
+ * Mean difference of consecutive samples, in arrival order.
+ */
+static double bench_jitter_us(const struct bench_result *r)
+{
+	uint64_t sum = 0;
+	unsigned int i;
+
+	if (r->nsamples < 2)
+		return 0;
+
+	for (i = 1; i < r->nsamples; i++)
+		sum += r->samples[i] > r->samples[i - 1] ?
+		       r->samples[i] - r->samples[i - 1] :
+		       r->samples[i - 1] - r->samples[i];
+
+	return (double)sum / (r->nsamples - 1) / 1000.0;
+}
+
+static void bench_report(const struct bench_opts *opts, struct bench_result *r)
+{
+	double loss = r->sent ? 100.0 * (r->sent - r->received) / r->sent : 0;
+	double bps = r->elapsed_ns ? r->bytes * 8 * 1e9 / r->elapsed_ns : 0;
+	double jitter = bench_jitter_us(r);
+	static int header;
+
+	qsort(r->samples, r->nsamples, sizeof(*r->samples), bench_cmp_u64);
+
+	if (opts->json) {
+		printf("{\"mode\":\"%s\",\"package_size\":%d,\"write_size\":%u,"
+		       "\"sent\":%u,\"received\":%u,\"duplicated\":%u,"
+		       "\"corrupt_bytes\":%llu,\"loss_pct\":%.3f,"
+		       "\"throughput_bps\":%.0f,\"p50_us\":%.1f,"
+		       "\"p90_us\":%.1f,\"p99_us\":%.1f,\"max_us\":%.1f,"
+		       "\"jitter_us\":%.1f}\n",
+		       r->mode, r->package_size, r->write_size, r->sent,
+		       r->received, r->duplicated, r->corrupt_bytes, loss, bps,
+		       bench_percentile_us(r, 50), bench_percentile_us(r, 90),
+		       bench_percentile_us(r, 99), bench_percentile_us(r, 100),
+		       jitter);
+	} else {
+		if (!header++)
+			printf("mode,package_size,write_size,sent,received,duplicated,corrupt_bytes,loss_pct,throughput_bps,p50_us,p90_us,p99_us,max_us,jitter_us\n");
+		printf("%s,%d,%u,%u,%u,%u,%llu,%.3f,%.0f,%.1f,%.1f,%.1f,%.1f,%.1f\n",
+		       r->mode, r->package_size, r->write_size, r->sent,
+		       r->received, r->duplicated, r->corrupt_bytes, loss, bps,
+		       bench_percentile_us(r, 50), bench_percentile_us(r, 90),
+		       bench_percentile_us(r, 99), bench_percentile_us(r, 100),
+		       jitter);
+	}
+	fflush(stdout);
+}
+
+/*
+ * One-way: records are written on tx_dev as fast as the link accepts
+ * them and read back on rx_dev. Both ports share the clock, the
+ * samples are one-way latencies.
+ */
+static int bench_throughput(const struct bench_opts *opts, int tx_fd,
+			    int rx_fd, struct bench_result *r)
+{
+	struct bench_stream *stream;
+	struct pollfd pfd[2];
+	uint8_t rec[BENCH_REC_MAX];
+	uint8_t *seen;
+	uint64_t start = bench_now();
+	uint64_t last = start;
+	uint64_t next_tx = start;
+	uint64_t now;
+	uint64_t ts;
+	uint32_t seq;
+	int ret = 0;
+
+	stream = calloc(1, sizeof(*stream));
+	seen = calloc(opts->count, 1);
+	if (!stream || !seen) {
+		ret = -1;
+		goto out;
+	}
+	stream->rec_size = r->write_size;
+
+	while (!bench_stop) {
+		now = bench_now();
+		if (r->sent < opts->count && now >= next_tx) {
+			bench_record(rec, r->write_size, r->sent, now);
+			if (bench_write(tx_fd, rec, r->write_size,
+					opts->timeout_ms)) {
+				ret = -1;
+				break;
+			}
+			r->sent++;
+			next_tx = now + opts->interval_us * 1000ULL;
+			if (r->sent == opts->count)
+				last = bench_now();
+		}
+
+		pfd[0].fd = rx_fd;
+		pfd[0].events = POLLIN;
+		pfd[1].fd = tx_fd;
+		pfd[1].events = r->sent < opts->count ? POLLOUT : 0;
+		poll(pfd, 2, r->sent < opts->count ? 1 : 10);
+
+		if (bench_stream_read(stream, rx_fd) < 0) {
+			fprintf(stderr, "read error (%s)\n", strerror(errno));
+			ret = -1;
+			break;
+		}
+
+		while (bench_stream_next(stream, &seq, &ts)) {
+			now = bench_now();
+			last = now;
+			if (seq >= opts->count)
+				continue;
+
+			if (seen[seq]) {
+				r->duplicated++;
+				continue;
+			}
+			seen[seq] = 1;
+			r->received++;
+			r->bytes += r->write_size;
+			r->samples[r->nsamples++] = now - ts;
+			r->elapsed_ns = now - start;
+		}
+
+		if (r->sent == opts->count &&
+		    (r->received == opts->count ||
+		     bench_now() - last >= opts->timeout_ms * 1000000ULL))
+			break;
+	}
+	r->corrupt_bytes = stream->corrupt_bytes;
+out:
+	free(seen);
+	free(stream);
+
+	return ret;
+}
+
+/*
+ * Ping-pong: a record is sent after the echo of the previous one,
+ * or after timeout. With rx_dev the echo is done here,
+ * otherwise by a remote "si4455_bench -m echo".
+ */
+static int bench_rtt(const struct bench_opts *opts, int tx_fd, int echo_fd,
+		     struct bench_result *r)
+{
+	struct bench_stream *stream;
+	struct pollfd pfd[2];
+	uint8_t rec[BENCH_REC_MAX];
+	uint8_t echo[BENCH_REC_MAX];
+	uint64_t start = bench_now();
+	uint64_t sent_at;
+	uint64_t now;
+	uint64_t ts;
+	uint32_t seq;
+	ssize_t len;
+	int done;
+	int ret = 0;
+
+	stream = calloc(1, sizeof(*stream));
+	if (!stream)
+		return -1;
+	stream->rec_size = r->write_size;
+
+	while (!bench_stop && r->sent < opts->count) {
+		sent_at = bench_now();
+		bench_record(rec, r->write_size, r->sent, sent_at);
+		if (bench_write(tx_fd, rec, r->write_size, opts->timeout_ms)) {
+			ret = -1;
+			break;
+		}
+		r->sent++;
+
+		done = 0;
+		while (!bench_stop && !done &&
+		       bench_now() - sent_at < opts->timeout_ms * 1000000ULL) {
+			pfd[0].fd = tx_fd;
+			pfd[0].events = POLLIN;
+			pfd[1].fd = echo_fd;
+			pfd[1].events = POLLIN;
+			poll(pfd, echo_fd >= 0 ? 2 : 1, 10);
+
+			if (echo_fd >= 0) {
+				len = read(echo_fd, echo, sizeof(echo));
+				if (len > 0 &&
+				    bench_write(echo_fd, echo, len,
+						opts->timeout_ms)) {
+					ret = -1;
+					goto out;
+				}
+			}
+
+			if (bench_stream_read(stream, tx_fd) < 0) {
+				fprintf(stderr, "read error (%s)\n",
+					strerror(errno));
+				ret = -1;
+				goto out;
+			}
+
+			while (bench_stream_next(stream, &seq, &ts)) {
+				if (seq != r->sent - 1) {
+					/* Late echo of a timed out record */
+					r->duplicated++;
+					continue;
+				}
+				now = bench_now();
+				r->received++;
+				r->bytes += r->write_size;
+				r->samples[r->nsamples++] = now - ts;
+				r->elapsed_ns = now - start;
+				done = 1;
+			}
+		}
+
+		if (opts->interval_us)
+			usleep(opts->interval_us);
+	}
+out:
+	r->corrupt_bytes = stream->corrupt_bytes;
+	free(stream);
+
+	return ret;
+}
+
+static int bench_echo(int fd)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	uint8_t buf[BENCH_REC_MAX];
+	ssize_t len;
+
+	while (!bench_stop) {
+		poll(&pfd, 1, 100);
+		len = read(fd, buf, sizeof(buf));
+		if (len < 0 && errno != EAGAIN && errno != EINTR) {
+			fprintf(stderr, "read error (%s)\n", strerror(errno));
+			return -1;
+		}
+		if (len > 0 && bench_write(fd, buf, len, 1000))
+			return -1;
+	}
+
+	return 0;
+}
+
+static int bench_parse_list(const char *arg, int *list, unsigned int *count,
+			    int min, int max)
+{
+	char *tokens = strdup(arg);
+	char *cur = tokens;
+	char *tok;
+	char *end;
+	long val;
+	int ret = 0;
+
+	if (!tokens)
+		return -1;
+
+	*count = 0;
+	while ((tok = strsep(&cur, ",")) != NULL) {
+		if (*tok == '\0')
+			continue;
+
+		val = strtol(tok, &end, 10);
+		if (*end != '\0' || val < min || val > max ||
+		    *count == BENCH_LIST_MAX) {
+			ret = -1;
+			break;
+		}
+		list[(*count)++] = val;
+	}
+	free(tokens);
+
+	return ret || !*count ? -1 : 0;
+}
+
+static void bench_usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [options] -t <tty> [-r <tty>]\n"
+		"  -m, --mode <mode>          throughput(default), rtt or echo\n"
+		"  -t, --tx <tty>             transmitting port, e.g. /dev/ttySSi0\n"
+		"  -r, --rx <tty>             receiving(throughput) or echoing(rtt) port\n"
+		"  -n, --count <n>            records per measurement (default 100)\n"
+		"  -s, --sizes <list>         write sizes, e.g. 16,32,64 (default 32, min %d)\n"
+		"  -k, --package-sizes <list> package_size values set via sysfs before the measurements\n"
+		"  -i, --interval <us>        gap between records (default 0)\n"
+		"  -w, --timeout <ms>         receive timeout (default 2000)\n"
+		"  -j, --json                 JSON lines output instead of CSV\n",
+		name, BENCH_HDR_SIZE);
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option long_opts[] = {
+		{ "mode", required_argument, NULL, 'm' },
+		{ "tx", required_argument, NULL, 't' },
+		{ "rx", required_argument, NULL, 'r' },
+		{ "count", required_argument, NULL, 'n' },
+		{ "sizes", required_argument, NULL, 's' },
+		{ "package-sizes", required_argument, NULL, 'k' },
+		{ "interval", required_argument, NULL, 'i' },
+		{ "timeout", required_argument, NULL, 'w' },
+		{ "json", no_argument, NULL, 'j' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+	struct bench_opts opts = {
+		.mode = BENCH_MODE_THROUGHPUT,
+		.count = 100,
+		.timeout_ms = 2000,
+		.sizes = { 32 },
+		.nsizes = 1,
+	};
+	struct bench_result r;
+	int sizes[BENCH_LIST_MAX];
+	int tx_fd = -1;
+	int rx_fd = -1;
+	unsigned int k;
+	unsigned int i;
+	int ret = 1;
+	int c;
+
+	while ((c = getopt_long(argc, argv, "m:t:r:n:s:k:i:w:jh", long_opts,
+				NULL)) != -1) {
+		switch (c) {
+		case 'm':
+			if (!strcmp(optarg, "throughput"))
+				opts.mode = BENCH_MODE_THROUGHPUT;
+			else if (!strcmp(optarg, "rtt"))
+				opts.mode = BENCH_MODE_RTT;
+			else if (!strcmp(optarg, "echo"))
+				opts.mode = BENCH_MODE_ECHO;
+			else
+				goto usage;
+			break;
+		case 't':
+			opts.tx_dev = optarg;
+			break;
+		case 'r':
+			opts.rx_dev = optarg;
+			break;
+		case 'n':
+			opts.count = strtoul(optarg, NULL, 10);
+			if (!opts.count)
+				goto usage;
+			break;
+		case 's':
+			if (bench_parse_list(optarg, sizes, &opts.nsizes,
+					     BENCH_HDR_SIZE, BENCH_REC_MAX))
+				goto usage;
+			for (i = 0; i < opts.nsizes; i++)
+				opts.sizes[i] = sizes[i];
+			break;
+		case 'k':
+			if (bench_parse_list(optarg, opts.package_sizes,
+					     &opts.npackage_sizes, 0, 64))
+				goto usage;
+			break;
+		case 'i':
+			opts.interval_us = strtoul(optarg, NULL, 10);
+			break;
+		case 'w':
+			opts.timeout_ms = strtoul(optarg, NULL, 10);
+			break;
+		case 'j':
+			opts.json = 1;
+			break;
+		default:
+			goto usage;
+		}
+	}
+
+	if (!opts.tx_dev ||
+	    (opts.mode == BENCH_MODE_THROUGHPUT && !opts.rx_dev))
+		goto usage;
+
+	signal(SIGINT, bench_signal);
+	signal(SIGTERM, bench_signal);
+
+	tx_fd = bench_open(opts.tx_dev);
+	if (tx_fd < 0)
+		goto out;
+
+	if (opts.mode == BENCH_MODE_ECHO) {
+		ret = bench_echo(tx_fd) ? 1 : 0;
+		goto out;
+	}
+
+	if (opts.rx_dev) {
+		rx_fd = bench_open(opts.rx_dev);
+		if (rx_fd < 0)
+			goto out;
+	}
+
+	/* Without a sweep the current package_size is measured */
+	if (!opts.npackage_sizes) {
+		opts.package_sizes[0] = bench_get_package_size(opts.tx_dev);
+		opts.npackage_sizes = 1;
+	}
+
+	memset(&r, 0, sizeof(r));
+	r.samples = calloc(opts.count, sizeof(*r.samples));
+	if (!r.samples)
+		goto out;
+
+	ret = 0;
+	for (k = 0; k < opts.npackage_sizes && !ret && !bench_stop; k++) {
+		if (opts.package_sizes[k] >= 0 &&
+		    opts.package_sizes[k] != bench_get_package_size(opts.tx_dev)) {
+			if (bench_set_package_size(opts.tx_dev,
+						   opts.package_sizes[k]) ||
+			    (opts.rx_dev &&
+			     bench_set_package_size(opts.rx_dev,
+						    opts.package_sizes[k]))) {
+				ret = 1;
+				break;
+			}
+		}
+
+		for (i = 0; i < opts.nsizes && !ret && !bench_stop; i++) {
+			uint64_t *samples = r.samples;
+
+			memset(&r, 0, sizeof(r));
+			memset(samples, 0, opts.count * sizeof(*samples));
+			r.samples = samples;
+			r.package_size = opts.package_sizes[k];
+			r.write_size = opts.sizes[i];
+
+			tcflush(tx_fd, TCIOFLUSH);
+			if (rx_fd >= 0)
+				tcflush(rx_fd, TCIOFLUSH);
+
+			if (opts.mode == BENCH_MODE_THROUGHPUT) {
+				r.mode = "throughput";
+				ret = bench_throughput(&opts, tx_fd, rx_fd, &r);
+			} else {
+				r.mode = "rtt";
+				ret = bench_rtt(&opts, tx_fd, rx_fd, &r);
+			}
+			if (!ret)
+				bench_report(&opts, &r);
+		}
+	}
+	free(r.samples);
+	ret = ret ? 1 : 0;
+out:
+	if (rx_fd >= 0)
+		close(rx_fd);
+	if (tx_fd >= 0)
+		close(tx_fd);
+
+	return ret;
+usage:
+	bench_usage(argv[0]);
+
+	return 1;
+}
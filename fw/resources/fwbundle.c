@@ -0,0 +1,131 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Copyright (C) 2020 Jozsef Horvath <info@ministro.hu>
+ *
+ * Packs EZConfig images into a profile bundle of the si4455 driver.
+ *
+ * usage: fwbundle name:package_size:image [name:package_size:image...] > bundle
+ *
+ * Layout(little endian):
+ * header: magic "SIBN", version, profile count
+ * profile table: name[16], package size, offset and length of the image
+ * images
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BUNDLE_MAGIC		"SIBN"
+#define BUNDLE_VERSION		1
+#define PROFILE_MAX		8
+#define PROFILE_NAME_SIZE	16
+#define HDR_SIZE		12
+#define ENTRY_SIZE		(PROFILE_NAME_SIZE + 12)
+
+struct profile {
+	char name[PROFILE_NAME_SIZE];
+	uint32_t package_size;
+	uint8_t *data;
+	uint32_t length;
+};
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static int load(const char *arg, struct profile *profile)
+{
+	char *spec = strdup(arg);
+	char *size;
+	char *path;
+	FILE *f;
+	long length;
+	int ret = -1;
+
+	size = spec ? strchr(spec, ':') : NULL;
+	path = size ? strchr(size + 1, ':') : NULL;
+	if (!path) {
+		fprintf(stderr, "invalid profile: %s\n", arg);
+		goto out;
+	}
+	*size++ = '\0';
+	*path++ = '\0';
+	if (!*spec || strlen(spec) >= PROFILE_NAME_SIZE) {
+		fprintf(stderr, "invalid profile name: %s\n", spec);
+		goto out;
+	}
+	strncpy(profile->name, spec, PROFILE_NAME_SIZE);
+	profile->package_size = strtoul(size, NULL, 10);
+	if (profile->package_size > 64) {
+		fprintf(stderr, "invalid package size: %s\n", size);
+		goto out;
+	}
+
+	f = fopen(path, "rb");
+	if (!f) {
+		perror(path);
+		goto out;
+	}
+	fseek(f, 0, SEEK_END);
+	length = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	profile->data = malloc(length > 0 ? length : 1);
+	if (length > 0 && profile->data &&
+	    fread(profile->data, 1, length, f) == (size_t)length) {
+		profile->length = length;
+		ret = 0;
+	} else {
+		fprintf(stderr, "%s: read error\n", path);
+	}
+	fclose(f);
+out:
+	free(spec);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	struct profile profiles[PROFILE_MAX];
+	uint8_t table[HDR_SIZE + PROFILE_MAX * ENTRY_SIZE];
+	uint8_t *entry;
+	uint32_t offset;
+	int count = argc - 1;
+	int i;
+
+	if (count < 1 || count > PROFILE_MAX) {
+		fprintf(stderr, "usage: %s name:package_size:image ... (maximum %d profiles)\n",
+			argv[0], PROFILE_MAX);
+		return 1;
+	}
+
+	memset(profiles, 0, sizeof(profiles));
+	memset(table, 0, sizeof(table));
+	for (i = 0; i < count; i++) {
+		if (load(argv[i + 1], &profiles[i]))
+			return 1;
+	}
+
+	memcpy(table, BUNDLE_MAGIC, 4);
+	put_le32(&table[4], BUNDLE_VERSION);
+	put_le32(&table[8], count);
+	offset = HDR_SIZE + count * ENTRY_SIZE;
+	for (i = 0; i < count; i++) {
+		entry = &table[HDR_SIZE + i * ENTRY_SIZE];
+		memcpy(entry, profiles[i].name, PROFILE_NAME_SIZE);
+		put_le32(&entry[PROFILE_NAME_SIZE], profiles[i].package_size);
+		put_le32(&entry[PROFILE_NAME_SIZE + 4], offset);
+		put_le32(&entry[PROFILE_NAME_SIZE + 8], profiles[i].length);
+		offset += profiles[i].length;
+	}
+
+	fwrite(table, 1, HDR_SIZE + count * ENTRY_SIZE, stdout);
+	for (i = 0; i < count; i++)
+		fwrite(profiles[i].data, 1, profiles[i].length, stdout);
+
+	return 0;
+}
@@ -12,6 +12,7 @@
 #include <linux/of.h>
 #include <linux/of_device.h>
 #include <linux/of_gpio.h>
+#include <linux/property.h>
 #include <linux/regmap.h>
 #include <linux/serial_core.h>
 #include <linux/serial.h>
@@ -22,12 +23,108 @@
 #include <linux/string.h>
 #include <linux/firmware.h>
 #include <linux/timer.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/random.h>
 #include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/sort.h>
+#include <linux/lzo.h>
+#include <linux/rslib.h>
+#include <linux/crc16.h>
+#include <linux/average.h>
+#include <asm/unaligned.h>
+
+#define CREATE_TRACE_POINTS
+#include "si4455_trace.h"
 
 #define SI4455_NAME						"Si4455"
 #define SI4455_DEV_NAME						"ttySSi"
-#define SI4455_UART_NRMAX					16
+#define SI4455_UART_NRMAX					64
 #define SI4455_FIFO_SIZE					64
+#define SI4455_CHANNEL_LIST_MAX					32
+#define SI4455_HOP_DWELL_MIN_US					1000
+#define SI4455_HOP_LOCK_DWELLS					2
+#define SI4455_SCAN_DWELL_MIN_US				1000
+#define SI4455_SCAN_LOCK_DWELLS					4
+#define SI4455_SURVEY_SAMPLES_MAX				64
+#define SI4455_SURVEY_INTERVAL_MIN_US				200
+#define SI4455_SURVEY_MARGIN					12
+#define SI4455_PROPERTY_COUNT_MAX				12
+#define SI4455_PROPERTY_OVERRIDES_MAX				32
+#define SI4455_PROP_GROUP_INT_CTL				0x01
+#define SI4455_PROP_INT_CTL_ENABLE				0x00
+#define SI4455_PROP_INT_CTL_MODEM_ENABLE			0x02
+#define SI4455_PROP_INT_CTL_ENABLE_MODEM_BIT			0x02
+#define SI4455_PROP_GROUP_PA					0x22
+#define SI4455_PROP_PA_PWR_LVL					0x01
+#define SI4455_PA_PWR_LVL_MAX					0x7f
+#define SI4455_BUNDLE_MAGIC					"SIBN"
+#define SI4455_BUNDLE_VERSION					1
+#define SI4455_PROFILE_MAX					8
+#define SI4455_PROFILE_NAME_SIZE				16
+#define SI4455_CSMA_SETTLE_US					500
+#define SI4455_CSMA_MIN_BE					1
+#define SI4455_CSMA_MAX_BE					5
+#define SI4455_LINK_HDR_SIZE					4
+#define SI4455_LINK_ADDR_SIZE					2
+#define SI4455_LINK_QUEUE_LEN					32
+#define SI4455_LINK_FLAG_ACK					0x01
+#define SI4455_LINK_FLAG_SEQ					0x02
+#define SI4455_LINK_FLAG_SYNC					0x04
+#define SI4455_LINK_FLAG_FIRST					0x08
+#define SI4455_LINK_FLAG_LAST					0x10
+#define SI4455_LINK_FLAG_COMP					0x20
+#define SI4455_LINK_FLAG_CTRL					0x40
+#define SI4455_LINK_FLAG_ADDR					0x80
+#define SI4455_LINK_CTRL_BEACON					0x01
+#define SI4455_LINK_CTRL_POLL					0x02
+#define SI4455_LINK_CTRL_RSSI					0x03
+#define SI4455_LINK_CTRL_RATE					0x04
+#define SI4455_LINK_CTRL_HOP					0x05
+#define SI4455_ADDR_BROADCAST					0xff
+#define SI4455_REMOTE_MAX					32
+#define SI4455_BOND_MAX						4
+#define SI4455_BOND_HOLDOFF_MS					1000
+#define SI4455_TDMA_SLOT_MIN_US					1000
+#define SI4455_TDMA_SYNC_MIN_MS					100
+#define SI4455_TDMA_SYNC_CYCLES					4
+#define SI4455_LINK_MTU_MAX					1024
+#define SI4455_LINK_REASM_TIMEOUT_MS				1000
+#define SI4455_FEC_ROOTS_MAX					16
+#define SI4455_FEC_DEPTH_MAX					4
+#define SI4455_FEC_SYMSIZE					8
+#define SI4455_FEC_GFPOLY					0x11d
+#define SI4455_FEC_CHECK_SIZE					2
+#define SI4455_ARQ_WINDOW_MAX					8
+#define SI4455_ARQ_RETRIES					5
+#define SI4455_ARQ_TURNAROUND_US				2000
+#define SI4455_ARQ_RTO_INIT_US					100000
+#define SI4455_ARQ_RTO_MIN_US					2000
+#define SI4455_ARQ_RTO_MAX_US					2000000
+#define SI4455_HIST_BUCKETS					24
+#define SI4455_STATS_VERSION					1
+#define SI4455_RSSI_HYSTERESIS					4
+#define SI4455_TPC_REPORT_MS					250
+#define SI4455_TPC_REPORT_VALID					4
+#define SI4455_TPC_HYSTERESIS					6
+#define SI4455_TPC_STEP						4
+#define SI4455_ADR_WINDOW_MS					1000
+#define SI4455_ADR_FALLBACK_WINDOWS				3
+#define SI4455_EVENT_CTS_RECOVERY				0
+#define SI4455_EVENT_TX_TIMEOUT					1
+#define SI4455_EVENT_CRC_ERROR					2
+#define SI4455_EVENT_CHIP_ERROR					3
+#define SI4455_EVENT_RSSI_LOW					4
+#define SI4455_EVENT_RSSI_HIGH					5
+#define SI4455_EVENT_COUNT					6
+#define SI4455_PER_OFF						0
+#define SI4455_PER_TX						1
+#define SI4455_PER_RX						2
+#define SI4455_PER_MAGIC					0x5045
+#define SI4455_PER_HDR_SIZE					6
+#define SI4455_PER_COUNT_MAX					65535
 
 #define SI4455_CMD_ID_EZCONFIG_CHECK				0x19
 #define SI4455_CMD_ID_PART_INFO					0x01
@@ -66,9 +163,17 @@
 #define SI4455_CMD_GET_INT_STATUS_CMD_ERROR_BIT			0x08
 #define SI4455_CMD_GET_INT_STATUS_ST_CHANGED_BIT		0x10
 #define SI4455_CMD_GET_INT_STATUS_FIFO_UO_BIT			0x20
+#define SI4455_CMD_GET_INT_STATUS_SYNC_DETECT_BIT		0x01
+#define SI4455_CMD_GET_INT_STATUS_PREAMBLE_DETECT_BIT		0x02
+#define SI4455_CMD_GET_INT_STATUS_INVALID_PREAMBLE_BIT		0x04
+#define SI4455_CMD_GET_INT_STATUS_INVALID_SYNC_BIT		0x20
 #define SI4455_CMD_ID_GET_MODEM_STATUS				0x22
 #define SI4455_CMD_ARG_COUNT_GET_MODEM_STATUS			2
 #define SI4455_CMD_REPLY_COUNT_GET_MODEM_STATUS			8
+#define SI4455_CMD_ID_SET_PROPERTY				0x11
+#define SI4455_CMD_ARG_COUNT_SET_PROPERTY			4
+#define SI4455_CMD_ID_GET_PROPERTY				0x12
+#define SI4455_CMD_ARG_COUNT_GET_PROPERTY			4
 
 struct si4455_part_info {
 	u8 chip_rev;
@@ -106,18 +211,451 @@ struct si4455_fifo_info {
 	u8 tx_fifo_space;
 };
 
+/*
+ * Link layer header, present in every radio packet if the link layer is enabled.
+ * flags: SI4455_LINK_FLAG_*
+ * seq: sequence number of the frame
+ * ack: next expected sequence number from the peer, valid with SI4455_LINK_FLAG_ACK
+ * len: payload length
+ * dst, src: destination and source node address, valid with SI4455_LINK_FLAG_ADDR
+ */
+struct si4455_link_hdr {
+	u8 flags;
+	u8 seq;
+	u8 ack;
+	u8 len;
+	u8 dst;
+	u8 src;
+};
+
+struct si4455_link_frame {
+	ktime_t sent;
+	u8 flags;
+	u8 seq;
+	u8 tx_count;
+	u8 len;
+	u8 data[SI4455_FIFO_SIZE];
+};
+
+/*
+ * tpc_*: RSSI of the frames received from the peer since the last report,
+ * and the last report of the peer on the frames received from us
+ */
+struct si4455_link_peer {
+	unsigned long tpc_report_next;
+	unsigned long tpc_report_time;
+	u32 tpc_rssi_sum;
+	u32 tpc_rssi_count;
+	u16 tpc_crc_permille;
+	u8 tpc_rssi;
+	u8 tx_seq;
+	u8 rx_seq;
+	bool rx_synced;
+	bool tx_sync;
+	bool ack_pending;
+	bool tpc_peer;
+	bool tpc_reported;
+};
+
+/*
+ * Frame received ahead of a missing one, delivered when the gap is filled.
+ */
+struct si4455_link_rxframe {
+	struct si4455_link_hdr hdr;
+	u8 data[SI4455_FIFO_SIZE];
+	bool valid;
+};
+
+struct si4455_port;
+
+struct si4455_tdma_node_stats {
+	u32 poll_count;
+	u32 reply_count;
+	u32 latency_us;
+	u32 latency_max_us;
+};
+
+/*
+ * Link layer endpoint, the main port talks to the broadcast address,
+ * every remote port to its own remote node.
+ */
+struct si4455_link {
+	struct si4455_port *s;
+	struct uart_port *port;
+	struct hrtimer arq_timer;
+	struct hrtimer ack_timer;
+	struct si4455_link_frame queue[SI4455_LINK_QUEUE_LEN];
+	struct si4455_link_peer peer;
+	struct si4455_tdma_node_stats tdma_stats;
+	struct si4455_link_rxframe reorder[SI4455_ARQ_WINDOW_MAX];
+	u8 reasm_buf[SI4455_LINK_MTU_MAX];
+	unsigned long reasm_start;
+	u32 head;
+	u32 next;
+	u32 tail;
+	u32 reasm_length;
+	u8 reasm_seq;
+	u8 reasm_flags;
+	u8 addr;
+	bool tx_stopped;
+	bool rx_stopped;
+	bool ack_due;
+	bool arq_expired;
+	bool reasm_active;
+};
+
+struct si4455_remote {
+	struct uart_port port;
+	struct si4455_link link;
+};
+
+struct si4455_addr_stats {
+	u32 foreign_count;
+	u32 unaddressed_count;
+	u32 unknown_count;
+};
+
+struct si4455_tdma_stats {
+	u32 cycle_count;
+	u32 slot_count;
+	u32 slot_used_count;
+	u32 beacon_count;
+	u32 grant_count;
+};
+
+struct si4455_bond_stats {
+	u32 tx_frame_count;
+	u32 rx_frame_count;
+	u32 fault_count;
+};
+
+struct si4455_arq_stats {
+	u32 frame_count;
+	u32 retransmit_count;
+	u32 drop_count;
+	u32 duplicate_count;
+	u32 out_of_order_count;
+	u32 reordered_count;
+	u32 ack_count;
+	u32 rtt_min_us;
+	u32 rtt_max_us;
+	u32 srtt_us;
+	u32 rttvar_us;
+	u32 rto_us;
+};
+
+struct si4455_frag_stats {
+	u32 message_tx_count;
+	u32 message_rx_count;
+	u32 drop_count;
+	u32 timeout_count;
+};
+
+struct si4455_comp_stats {
+	u64 in_bytes;
+	u64 out_bytes;
+	u64 compress_ns;
+	u64 decompress_ns;
+	u32 compressed_count;
+	u32 decompressed_count;
+	u32 error_count;
+};
+
+struct si4455_fec_stats {
+	u32 corrected_count;
+	u32 symbol_count;
+	u32 uncorrectable_count;
+	u32 crc_recovered_count;
+	u32 check_error_count;
+};
+
+/*
+ * log2 histogram, bucket 0 counts zero values,
+ * bucket n counts the values in [2^(n-1), 2^n).
+ */
+struct si4455_hist {
+	u32 bucket[SI4455_HIST_BUCKETS];
+	u32 count;
+	u32 max;
+	u64 sum;
+};
+
+struct si4455_hists {
+	struct si4455_hist cts_wait_us;
+	struct si4455_hist spi_xfer_us;
+	struct si4455_hist irq_push_us;
+	struct si4455_hist tx_latency_us;
+	struct si4455_hist irq_packets;
+};
+
+/*
+ * SPI transactions and bytes spent on the packets of one direction.
+ * A packet exceeding budget(transactions, 0: disabled) is counted
+ * in over_budget.
+ */
+struct si4455_spi_cost {
+	u32 packets;
+	u64 xfers;
+	u64 bytes;
+	u32 last_xfers;
+	u32 last_bytes;
+	u32 max_xfers;
+	u32 max_bytes;
+	u32 budget;
+	u32 over_budget;
+};
+
+/*
+ * Packet error rate test results. Packets with a valid CRC are good,
+ * or bit error packets if their pattern differs; count comes from
+ * the received packets.
+ */
+struct si4455_per_stats {
+	u32 sent;
+	u32 count;
+	u32 received;
+	u32 good;
+	u32 crc_error;
+	u32 bit_error;
+	u32 bit_errors;
+	u32 duplicate;
+	u32 other;
+	u32 last_seq;
+	u8 rssi_min;
+	u8 rssi_max;
+	u64 rssi_sum;
+};
+
+struct si4455_tpc_stats {
+	u32 report_tx_count;
+	u32 report_rx_count;
+	u32 step_up_count;
+	u32 step_down_count;
+	u32 peer_rssi;
+	u32 peer_crc_permille;
+};
+
+struct si4455_adr_stats {
+	u32 rate_tx_count;
+	u32 rate_rx_count;
+	u32 up_count;
+	u32 down_count;
+	u32 fallback_count;
+};
+
+/*
+ * Channel survey result: noise floor(10th percentile), median and
+ * maximum RSSI, and the ratio of the samples over the busy threshold.
+ */
+struct si4455_survey_result {
+	u8 channel;
+	u8 noise_floor;
+	u8 median;
+	u8 max;
+	u16 occupancy_permille;
+};
+
+/*
+ * Property set at runtime, applied again after every (re)configuration
+ */
+struct si4455_property {
+	u8 group;
+	u8 number;
+	u8 value;
+};
+
+struct si4455_property_group {
+	u8 group;
+	u8 count;
+};
+
+/*
+ * Firmware bundle: header, profile table and the EZConfig command streams
+ * of the profiles, little endian, built by fw/Makefile(bundle rule).
+ */
+struct si4455_bundle_hdr {
+	u8 magic[4];
+	__le32 version;
+	__le32 count;
+} __packed;
+
+struct si4455_bundle_entry {
+	char name[SI4455_PROFILE_NAME_SIZE];
+	__le32 package_size;
+	__le32 offset;
+	__le32 length;
+} __packed;
+
+struct si4455_profile {
+	char name[SI4455_PROFILE_NAME_SIZE];
+	const u8 *data;
+	u32 length;
+	u32 package_size;
+};
+
+struct si4455_profile_stats {
+	u32 switch_count;
+	u32 replay_count;
+	u32 full_count;
+	u32 command_count;
+	u32 last_switch_us;
+};
+
+/*
+ * Link statistics snapshot, returned at once by the stats sysfs entry.
+ * New fields are appended only, with a new version.
+ */
+struct si4455_link_stats {
+	u32 version;
+	u32 size;
+	u64 timestamp_ns;
+	u32 tx_packet_count;
+	u32 rx_packet_count;
+	u32 crc_error_count;
+	u32 chip_error_count;
+	u32 fifo_error_count;
+	u32 rx_drop_count;
+	u32 cts_error_count;
+	u32 tx_error_count;
+	u64 tx_bytes;
+	u64 rx_bytes;
+	u32 tx_bytes_per_sec;
+	u32 rx_bytes_per_sec;
+	u32 rssi_count;
+	u8 rssi_last;
+	u8 rssi_min;
+	u8 rssi_max;
+	u8 rssi_avg;
+	u16 rssi_ewma_x16;
+	s16 afc_last;
+	s16 afc_min;
+	s16 afc_max;
+	s16 afc_avg;
+	u16 reserved;
+} __packed;
+
+/*
+ * Bytes per second over the last full second.
+ */
+struct si4455_rate {
+	ktime_t start;
+	u64 bytes;
+	u32 rate;
+};
+
+DECLARE_EWMA(si4455_rssi, 4, 8)
+
 struct si4455_port {
 	struct uart_port port;
 	struct dentry *dbgfs_dir;
 	struct work_struct tx_work;
 	struct work_struct tx_wd_work;
 	struct work_struct cts_wd_work;
+	struct work_struct hop_work;
+	struct work_struct scan_work;
+	struct work_struct arq_work;
+	struct work_struct tdma_work;
+	struct work_struct survey_work;
+	struct work_struct adr_work;
 	struct timer_list tx_wd_timer;
 	struct timer_list cts_wd_timer;
+	struct hrtimer hop_timer;
+	struct hrtimer scan_timer;
+	struct hrtimer csma_timer;
+	struct hrtimer tdma_timer;
+	struct hrtimer per_timer;
+	struct hrtimer survey_timer;
+	struct hrtimer adr_timer;
 	struct mutex mutex; /* For syncing access to device */
+	struct mutex remotes_lock; /* For syncing remote port changes */
 	struct gpio_desc *shdn_gpio;
 	struct si4455_part_info part_info;
 	struct si4455_modem_status modem_status;
+	struct si4455_link link;
+	struct si4455_link *link_tx;
+	struct si4455_remote *remotes[SI4455_REMOTE_MAX];
+	struct si4455_addr_stats addr_stats;
+	struct si4455_link *tdma_grant;
+	struct si4455_port *bond_master;
+	struct si4455_port *bond_members[SI4455_BOND_MAX];
+	struct si4455_port *duplex_rx;
+	struct si4455_bond_stats bond_stats;
+	unsigned long bond_holdoff_end;
+	u32 bond_count;
+	u32 bond_errors;
+	struct si4455_tdma_stats tdma_stats;
+	ktime_t tdma_window_start;
+	ktime_t ist_time;
+	ktime_t rx_sync_time;
+	unsigned long tdma_sync_end;
+	struct si4455_arq_stats arq_stats;
+	struct si4455_frag_stats frag_stats;
+	struct si4455_comp_stats comp_stats;
+	struct si4455_fec_stats fec_stats;
+	struct si4455_hists hists;
+	u64 spi_xfers;
+	u64 spi_bytes;
+	u32 spi_window_xfers;
+	u32 spi_window_bytes;
+	u32 spi_tx_xfers;
+	u32 spi_tx_bytes;
+	struct si4455_spi_cost spi_tx_cost;
+	struct si4455_spi_cost spi_rx_cost;
+	struct si4455_link_stats stats;
+	struct ewma_si4455_rssi stats_rssi_ewma;
+	struct si4455_rate stats_tx_rate;
+	struct si4455_rate stats_rx_rate;
+	u64 stats_rssi_sum;
+	s64 stats_afc_sum;
+	u32 event_count[SI4455_EVENT_COUNT];
+	u32 rssi_threshold;
+	bool rssi_low;
+	u32 per_mode;
+	u32 per_count;
+	u32 per_interval_us;
+	bool per_connected;
+	u32 tpc_target_rssi;
+	u32 tpc_level_min;
+	u32 tpc_level_max;
+	u32 tpc_crc_permille;
+	u32 tpc_crc_base;
+	u32 tpc_rx_base;
+	u8 tpc_level;
+	u8 tpc_saved_level;
+	bool tpc_restore;
+	struct si4455_tpc_stats tpc_stats;
+	struct si4455_profile profiles[SI4455_PROFILE_MAX];
+	u32 profile_count;
+	u32 profile;
+	u32 profile_next;
+	bool profile_pending;
+	struct si4455_profile_stats profile_stats;
+	u32 adr;
+	u32 adr_rssi_low;
+	u32 adr_rssi_high;
+	u32 adr_crc_permille;
+	u32 adr_retry_permille;
+	u32 adr_rssi_sum;
+	u32 adr_rssi_count;
+	u32 adr_crc_base;
+	u32 adr_rx_base;
+	u32 adr_frame_base;
+	u32 adr_retransmit_base;
+	u32 adr_idle;
+	u32 adr_request;
+	u32 adr_fallback;
+	bool adr_request_pending;
+	bool adr_hold;
+	bool adr_verify;
+	struct si4455_adr_stats adr_stats;
+	struct si4455_per_stats per_stats;
+	struct rs_control *fec_rs;
+	void *comp_wrkmem;
+	u8 link_msg[SI4455_LINK_MTU_MAX];
+	u8 link_zmsg[lzo1x_worst_compress(SI4455_LINK_MTU_MAX)];
+	u8 link_unzmsg[SI4455_LINK_MTU_MAX];
+	ktime_t tx_start;
+	ktime_t tx_request;
 	u32 tx_channel;
 	u32 rx_channel;
 	u32 package_size;
@@ -127,6 +665,68 @@ struct si4455_port {
 	int power_count;
 	u32 tx_wd_timeout;
 	u32 tx_pending_size;
+	u32 tx_length;
+	u8 hop_table[SI4455_CHANNEL_LIST_MAX];
+	u32 hop_table_len;
+	u32 hop_index;
+	u32 hop_dwell_us;
+	u32 hop_count;
+	u32 hop_sync_count;
+	u32 hop_deferred_count;
+	u32 hop_lock_dwells;
+	u32 hop_skip;
+	ktime_t hop_next_time;
+	u8 scan_table[SI4455_CHANNEL_LIST_MAX];
+	u32 scan_visits[SI4455_CHANNEL_LIST_MAX];
+	u32 scan_hits[SI4455_CHANNEL_LIST_MAX];
+	u32 scan_table_len;
+	u32 scan_index;
+	u32 scan_dwell_us;
+	u32 scan_lock_dwells;
+	u8 scan_int_ctl[3];
+	u8 survey_table[SI4455_CHANNEL_LIST_MAX];
+	u32 survey_table_len;
+	u32 survey_samples;
+	u32 survey_interval_us;
+	u32 survey_busy_permille;
+	bool survey_active;
+	bool survey_connected;
+	u32 survey_index;
+	u32 survey_sample;
+	u8 survey_rssi[SI4455_CHANNEL_LIST_MAX][SI4455_SURVEY_SAMPLES_MAX];
+	struct si4455_survey_result survey_results[SI4455_CHANNEL_LIST_MAX];
+	u32 survey_results_len;
+	u32 survey_threshold;
+	struct si4455_property props[SI4455_PROPERTY_OVERRIDES_MAX];
+	u32 props_len;
+	bool props_pending;
+	u8 props_get_group;
+	u8 props_get_number;
+	u8 props_get_count;
+	u32 rx_active_channel;
+	u32 rx_last_channel;
+	u32 csma_threshold;
+	u32 csma_slot_us;
+	u32 csma_max_backoffs;
+	u32 csma_backoffs;
+	u32 csma_attempt_count;
+	u32 csma_busy_count;
+	u32 csma_forced_count;
+	u32 link_tx_index;
+	u32 link_rr;
+	u32 remote_count;
+	u32 arq_window;
+	u32 arq_retries;
+	u32 arq_ack_delay_us;
+	u32 tx_airtime_us;
+	u32 mtu;
+	u32 reasm_timeout_ms;
+	u8 address;
+	u8 tdma_gateway;
+	u32 tdma_slot_us;
+	u32 tdma_slot;
+	u32 fec_roots;
+	u32 fec_depth;
 	char ez_fw_name[255];
 	bool connected;
 	bool suspended;
@@ -134,8 +734,19 @@ struct si4455_port {
 	bool cts_error;
 	bool tx_pending;
 	bool rx_pending;
-	bool tx_stopped;
 	bool rx_stopped;
+	bool scan_locked;
+	bool hop_locked;
+	bool hop_master;
+	bool hop_sync_due;
+	bool scan_irq;
+	bool csma_deferred;
+	bool link_tx_frame;
+	bool tdma_xmit_due;
+	bool tdma_tx;
+	bool tdma_beacon_sent;
+	bool tdma_replied;
+	bool bond_rx_only;
 };
 
 static struct uart_driver si4455_uart = {
@@ -147,14 +758,109 @@ static struct uart_driver si4455_uart = {
 
 static DEFINE_MUTEX(si4455_ports_lock);			/* race on probe */
 static DECLARE_BITMAP(si4455_port_lines, SI4455_UART_NRMAX);
+static DEFINE_MUTEX(si4455_bond_lock);			/* race on bonding */
+static struct si4455_port *si4455_radios[SI4455_UART_NRMAX];
+
+/*
+ * Claims a free port line, remote ports are added outside of probe.
+ */
+static int si4455_line_get(void)
+{
+	int line;
+
+	for (line = 0; line < SI4455_UART_NRMAX; line++)
+		if (!test_and_set_bit(line, si4455_port_lines))
+			break;
+
+	return line;
+}
+
+static void si4455_hist_add(struct si4455_hist *hist, u64 value)
+{
+	u32 index = min_t(u32, fls64(value), SI4455_HIST_BUCKETS - 1);
+
+	hist->bucket[index]++;
+	hist->count++;
+	hist->sum += value;
+	if (value > hist->max)
+		hist->max = min_t(u64, value, UINT_MAX);
+}
+
+static void si4455_rate_add(struct si4455_rate *rate, u32 bytes, ktime_t now)
+{
+	s64 elapsed = ktime_us_delta(now, rate->start);
+
+	if (elapsed >= USEC_PER_SEC) {
+		rate->rate = div64_u64(rate->bytes * USEC_PER_SEC, elapsed);
+		rate->start = now;
+		rate->bytes = 0;
+	}
+	rate->bytes += bytes;
+}
+
+static u32 si4455_rate_get(struct si4455_rate *rate, ktime_t now)
+{
+	s64 elapsed = ktime_us_delta(now, rate->start);
+
+	if (elapsed >= USEC_PER_SEC)
+		return div64_u64(rate->bytes * USEC_PER_SEC, elapsed);
+
+	return rate->rate;
+}
+
+static void si4455_spi_xfer_add(struct uart_port *port, ktime_t start,
+				u32 bytes)
+{
+	struct si4455_port *s = dev_get_drvdata(port->dev);
+
+	si4455_hist_add(&s->hists.spi_xfer_us,
+			ktime_us_delta(ktime_get(), start));
+	s->spi_xfers++;
+	s->spi_bytes += bytes;
+	s->spi_window_xfers++;
+	s->spi_window_bytes += bytes;
+}
+
+/*
+ * Starts counting the SPI transactions of a packet.
+ */
+static void si4455_spi_window_start(struct si4455_port *s)
+{
+	s->spi_window_xfers = 0;
+	s->spi_window_bytes = 0;
+}
+
+static void si4455_spi_cost_add(struct si4455_port *s,
+				struct si4455_spi_cost *cost,
+				u32 xfers, u32 bytes)
+{
+	cost->packets++;
+	cost->xfers += xfers;
+	cost->bytes += bytes;
+	cost->last_xfers = xfers;
+	cost->last_bytes = bytes;
+	if (xfers > cost->max_xfers)
+		cost->max_xfers = xfers;
+	if (bytes > cost->max_bytes)
+		cost->max_bytes = bytes;
+	if (cost->budget && xfers > cost->budget) {
+		cost->over_budget++;
+		dev_warn_ratelimited(s->port.dev,
+				     "%s: %u SPI transactions, budget %u\n",
+				     __func__, xfers, cost->budget);
+	}
+}
 
 static int si4455_get_response(struct uart_port *port, int length, u8 *data)
 {
+	struct si4455_port *s = dev_get_drvdata(port->dev);
 	int ret;
 	u8 data_out[] = { SI4455_CMD_ID_READ_CMD_BUFF };
 	u8 *data_in;
 	struct spi_transfer xfer[2];
 	int timeout = 100;
+	ktime_t start;
+	ktime_t xfer_start;
 
 	if (length > 0 && !data)
 		return -EINVAL;
@@ -169,10 +875,14 @@ static int si4455_get_response(struct uart_port *port, int length, u8 *data)
 	xfer[1].rx_buf = data_in;
 	xfer[1].len = 1 + length;
 
+	start = ktime_get();
 	while (--timeout > 0) {
 		data_out[0] = SI4455_CMD_ID_READ_CMD_BUFF;
+		xfer_start = ktime_get();
 		ret = spi_sync_transfer(to_spi_device(port->dev), xfer,
 					ARRAY_SIZE(xfer));
+		si4455_spi_xfer_add(port, xfer_start,
+				    xfer[0].len + xfer[1].len);
 		if (ret) {
 			dev_err(port->dev, "%s: spi_sync_transfer error (%i)\n", __func__, ret);
 			break;
@@ -190,6 +900,10 @@ static int si4455_get_response(struct uart_port *port, int length, u8 *data)
 		dev_err(port->dev, "%s: timeout\n", __func__);
 		ret = -EIO;
 	}
+	trace_si4455_cts(port->dev, length, 100 - timeout,
+			 ktime_us_delta(ktime_get(), start), ret);
+	si4455_hist_add(&s->hists.cts_wait_us,
+			ktime_us_delta(ktime_get(), start));
 	kfree(data_in);
 	return ret;
 }
@@ -210,6 +924,7 @@ static int si4455_poll_cts(struct uart_port *port)
 static int si4455_send_command(struct uart_port *port, int length, u8 *data)
 {
 	int ret;
+	ktime_t start;
 
 	ret = si4455_poll_cts(port);
 	if (ret) {
@@ -218,7 +933,11 @@ static int si4455_send_command(struct uart_port *port, int length, u8 *data)
 		return ret;
 	}
 
+	start = ktime_get();
 	ret = spi_write(to_spi_device(port->dev), data, length);
+	trace_si4455_cmd(port->dev, data[0], length,
+			 ktime_to_ns(ktime_sub(ktime_get(), start)), ret);
+	si4455_spi_xfer_add(port, start, length);
 	if (ret) {
 		dev_err(port->dev,
 			"%s: spi_write error (%i)\n", __func__, ret);
@@ -258,15 +977,21 @@ static int si4455_read_data(struct uart_port *port, u8 command, bool poll,
 		}
 	};
 
+	ktime_t start;
+
 	if (poll) {
 		ret = si4455_poll_cts(port);
 		if (ret)
 			return ret;
 	}
 
+	start = ktime_get();
 	ret = spi_sync_transfer(to_spi_device(port->dev),
 				xfer,
 				ARRAY_SIZE(xfer));
+	trace_si4455_cmd(port->dev, command, length,
+			 ktime_to_ns(ktime_sub(ktime_get(), start)), ret);
+	si4455_spi_xfer_add(port, start, 1 + length);
 	if (ret) {
 		dev_err(port->dev,
 			"%s: spi_sync_transfer error (%i)\n", __func__, ret);
@@ -280,6 +1005,7 @@ static int si4455_write_data(struct uart_port *port, u8 command, bool poll,
 {
 	int ret = 0;
 	u8 *data_out;
+	ktime_t start;
 
 	if (poll) {
 		ret = si4455_poll_cts(port);
@@ -293,7 +1019,11 @@ static int si4455_write_data(struct uart_port *port, u8 command, bool poll,
 
 	data_out[0] = command;
 	memcpy(&data_out[1], data, length);
+	start = ktime_get();
 	ret = spi_write(to_spi_device(port->dev), data_out, 1 + length);
+	trace_si4455_cmd(port->dev, command, length,
+			 ktime_to_ns(ktime_sub(ktime_get(), start)), ret);
+	si4455_spi_xfer_add(port, start, 1 + length);
 	if (ret) {
 		dev_err(port->dev,
 			"%s: spi_write error (%i)\n", __func__, ret);
@@ -471,6 +1201,7 @@ static int si4455_rx(struct uart_port *port, u32 channel, u8 condition,
 	data_out[5] = next_state1;
 	data_out[6] = next_state2;
 	data_out[7] = next_state3;
+	trace_si4455_rx_start(port->dev, channel, length);
 
 	return si4455_send_command(port, SI4455_CMD_ARG_COUNT_START_RX,
 				   data_out);
@@ -493,6 +1224,7 @@ static int si4455_tx(struct uart_port *port, u8 channel, u8 condition,
 	data_out[4] = (u8)(length);
 	if (s->part_info.rom_id == 6)
 		data_out[5] = 0x44;
+	trace_si4455_tx_start(port->dev, channel, length);
 
 	return si4455_send_command(port, out_length, data_out);
 }
@@ -503,6 +1235,7 @@ static int si4455_change_state(struct uart_port *port, u8 next_state1)
 
 	data_out[0] = SI4455_CMD_ID_CHANGE_STATE;
 	data_out[1] = (u8)next_state1;
+	trace_si4455_state(port->dev, next_state1);
 
 	return si4455_send_command(port, SI4455_CMD_ARG_COUNT_CHANGE_STATE,
 				   data_out);
@@ -599,6 +1332,7 @@ static int si4455_begin_rx(struct uart_port *port, u32 channel, u32 length)
 			__func__, ret);
 		return ret;
 	}
+	s->rx_active_channel = channel;
 
 	return 0;
 }
@@ -710,571 +1444,6373 @@ static int si4455_configure(struct uart_port *port, const u8 *configuration_data
 	return ret;
 }
 
-static int si4455_re_configure(struct uart_port *port, const struct firmware *configuration)
+/*
+ * Property groups the Si4455 API allows changing over the EZConfig image,
+ * the modem and the packet handler settings belong to the image.
+ */
+static const struct si4455_property_group si4455_property_groups[] = {
+	{ 0x00, 9 },	/* GLOBAL */
+	{ 0x01, 4 },	/* INT_CTL */
+	{ 0x02, 4 },	/* FRR_CTL */
+	{ 0x10, 9 },	/* PREAMBLE */
+	{ 0x11, 5 },	/* SYNC */
+	{ 0x22, 4 },	/* PA */
+};
+
+static bool si4455_property_valid(u8 group, u8 number, u32 count)
 {
-	int ret = 0;
-	struct si4455_port *s = dev_get_drvdata(port->dev);
+	u32 i;
 
-	s->configured = 0;
-	if (s->power_count == 0)
-		si4455_s_power(port->dev, true);
+	if (count == 0 || count > SI4455_PROPERTY_COUNT_MAX)
+		return false;
 
-	ret = si4455_configure(port, configuration->data);
-	if (ret == 0) {
-		s->configured = true;
-		s->cts_error = false;
+	for (i = 0; i < ARRAY_SIZE(si4455_property_groups); i++) {
+		if (si4455_property_groups[i].group == group)
+			return number + count <= si4455_property_groups[i].count;
 	}
-	return ret;
+
+	return false;
 }
 
-static int si4455_start_tx_xmit(struct uart_port *port)
+static int si4455_set_property(struct uart_port *port, u8 group, u8 number,
+			       u32 count, const u8 *values)
 {
-	int ret;
-	struct si4455_port *s = dev_get_drvdata(port->dev);
-	struct circ_buf *xmit = &port->state->xmit;
-	u32 tx_pending;
-	u32 tx_to_end;
-	u8 *data;
-	u8 *payload;
-	u32 max_length;
+	u8 data_out[SI4455_CMD_ARG_COUNT_SET_PROPERTY + SI4455_PROPERTY_COUNT_MAX];
 
-	if (s->tx_stopped)
-		return 0;
+	if (count == 0 || count > SI4455_PROPERTY_COUNT_MAX)
+		return -EINVAL;
 
-	tx_pending = uart_circ_chars_pending(xmit);
-	if (tx_pending == 0 || tx_pending < s->package_size)
-		return 0;
+	data_out[0] = SI4455_CMD_ID_SET_PROPERTY;
+	data_out[1] = group;
+	data_out[2] = count;
+	data_out[3] = number;
+	memcpy(&data_out[SI4455_CMD_ARG_COUNT_SET_PROPERTY], values, count);
 
-	max_length = (s->package_size == 0) ? SI4455_FIFO_SIZE - 3 : s->package_size;
-	tx_pending = (tx_pending > max_length) ? max_length : tx_pending;
-	if (s->package_size == 0)
-		data = kzalloc(tx_pending + 1, GFP_KERNEL);
-	else
-		data = kzalloc(tx_pending, GFP_KERNEL);
-	if (!data)
-		return -ENOMEM;
+	return si4455_send_command(port,
+				   SI4455_CMD_ARG_COUNT_SET_PROPERTY + count,
+				   data_out);
+}
 
-	if (s->package_size == 0) {
-		data[0] = tx_pending;
-		payload = &data[1];
-	} else {
-		payload = data;
+static int si4455_get_property(struct uart_port *port, u8 group, u8 number,
+			       u32 count, u8 *values)
+{
+	u8 data_out[SI4455_CMD_ARG_COUNT_GET_PROPERTY];
+
+	if (count == 0 || count > SI4455_PROPERTY_COUNT_MAX)
+		return -EINVAL;
+
+	data_out[0] = SI4455_CMD_ID_GET_PROPERTY;
+	data_out[1] = group;
+	data_out[2] = count;
+	data_out[3] = number;
+
+	return si4455_send_command_get_response(port, sizeof(data_out),
+						data_out, count, values);
+}
+
+/*
+ * Remembers the values, a property set again replaces its value
+ */
+static int si4455_props_store(struct si4455_port *s, u8 group, u8 number,
+			      u32 count, const u8 *values)
+{
+	u32 added = 0;
+	u32 i;
+	u32 j;
+
+	for (i = 0; i < count; i++) {
+		for (j = 0; j < s->props_len; j++) {
+			if (s->props[j].group == group &&
+			    s->props[j].number == number + i)
+				break;
+		}
+		if (j == s->props_len)
+			added++;
 	}
+	if (s->props_len + added > SI4455_PROPERTY_OVERRIDES_MAX)
+		return -ENOSPC;
 
-	tx_to_end = CIRC_CNT_TO_END(xmit->head, xmit->tail, UART_XMIT_SIZE);
-	if (tx_to_end < tx_pending) {
-		memcpy(payload, xmit->buf + xmit->tail, tx_to_end);
-		memcpy(&payload[tx_to_end], xmit->buf, tx_pending - tx_to_end);
-	} else {
-		memcpy(payload, xmit->buf + xmit->tail, tx_pending);
+	for (i = 0; i < count; i++) {
+		for (j = 0; j < s->props_len; j++) {
+			if (s->props[j].group == group &&
+			    s->props[j].number == number + i)
+				break;
+		}
+		if (j == s->props_len) {
+			s->props[j].group = group;
+			s->props[j].number = number + i;
+			s->props_len++;
+		}
+		s->props[j].value = values[i];
 	}
 
-	if (s->package_size == 0)
-		ret = si4455_begin_tx(port, s->tx_channel, tx_pending + 1, data);
-	else
-		ret = si4455_begin_tx(port, s->tx_channel, tx_pending, data);
-	if (!ret) {
-		s->tx_pending = true;
-		s->tx_pending_size = tx_pending;
-		uart_handle_cts_change(&s->port, 0);
-		mod_timer(&s->tx_wd_timer, jiffies + msecs_to_jiffies(s->tx_wd_timeout));
+	return 0;
+}
+
+static bool si4455_tpc_enabled(struct si4455_port *s)
+{
+	return s->tpc_target_rssi > 0;
+}
+
+static int si4455_props_apply(struct si4455_port *s)
+{
+	struct si4455_property *prop;
+	int ret;
+	u32 i;
+
+	for (i = 0; i < s->props_len; i++) {
+		prop = &s->props[i];
+		ret = si4455_set_property(&s->port, prop->group, prop->number,
+					  1, &prop->value);
+		if (ret) {
+			dev_err(s->port.dev, "%s: property 0x%02x%02x error (%i)\n",
+				__func__, prop->group, prop->number, ret);
+			return ret;
+		}
 	}
 
-	kfree(data);
+	/* The PA level of the power control overrides the image and the properties */
+	if (si4455_tpc_enabled(s) || s->tpc_restore) {
+		ret = si4455_set_property(&s->port, SI4455_PROP_GROUP_PA,
+					  SI4455_PROP_PA_PWR_LVL, 1,
+					  &s->tpc_level);
+		if (ret)
+			return ret;
 
-	return ret;
+		s->tpc_restore = false;
+	}
+	s->props_pending = false;
+
+	return 0;
 }
 
-static int si4455_cancel_tx(struct uart_port *port)
+/*
+ * The image enables the packet handler interrupts only, the scan and the
+ * hopping need the preamble and sync detection to stay on the channel
+ * of a packet. The interrupt settings of the image are restored when
+ * both stop.
+ * Must be called with s->mutex held.
+ */
+static int si4455_scan_irq(struct si4455_port *s, bool enable)
 {
-	int ret = 0;
-	struct si4455_port *s = dev_get_drvdata(port->dev);
+	u8 int_ctl[3];
+	int ret;
 
-	if (s->tx_pending) {
-		si4455_end_tx(port);
-		s->tx_pending = false;
-		s->tx_pending_size = 0;
-		uart_handle_cts_change(&s->port, TIOCM_CTS);
-		ret = si4455_change_state(port, SI4455_CMD_CHANGE_STATE_STATE_SLEEP);
+	if (enable == s->scan_irq)
+		return 0;
+
+	if (enable) {
+		ret = si4455_get_property(&s->port, SI4455_PROP_GROUP_INT_CTL,
+					  SI4455_PROP_INT_CTL_ENABLE,
+					  sizeof(s->scan_int_ctl),
+					  s->scan_int_ctl);
+		if (ret)
+			return ret;
+
+		memcpy(int_ctl, s->scan_int_ctl, sizeof(int_ctl));
+		int_ctl[SI4455_PROP_INT_CTL_ENABLE] |=
+			SI4455_PROP_INT_CTL_ENABLE_MODEM_BIT;
+		int_ctl[SI4455_PROP_INT_CTL_MODEM_ENABLE] |=
+			SI4455_CMD_GET_INT_STATUS_SYNC_DETECT_BIT |
+			SI4455_CMD_GET_INT_STATUS_PREAMBLE_DETECT_BIT;
+	} else {
+		memcpy(int_ctl, s->scan_int_ctl, sizeof(int_ctl));
 	}
-	return ret;
+
+	ret = si4455_set_property(&s->port, SI4455_PROP_GROUP_INT_CTL,
+				  SI4455_PROP_INT_CTL_ENABLE, sizeof(int_ctl),
+				  int_ctl);
+	if (ret)
+		return ret;
+
+	s->scan_irq = enable;
+
+	return 0;
 }
 
-static int si4455_do_work(struct uart_port *port)
+/*
+ * Configures the active profile
+ */
+static int si4455_re_configure(struct uart_port *port)
 {
 	int ret = 0;
 	struct si4455_port *s = dev_get_drvdata(port->dev);
-	struct circ_buf *xmit = &port->state->xmit;
 
-	mutex_lock(&s->mutex);
-	if (!s->suspended && s->connected && s->configured && s->power_count > 0) {
-		if (!(uart_circ_empty(xmit) || uart_tx_stopped(port) || s->tx_pending))
-			ret = si4455_start_tx_xmit(port);
+	s->configured = 0;
+	/* The image sets the interrupts again */
+	s->scan_irq = false;
+	if (s->power_count == 0)
+		si4455_s_power(port->dev, true);
 
-		if (!ret && !s->tx_pending)
-			ret = si4455_begin_rx(port, s->rx_channel, s->package_size);
+	ret = si4455_configure(port, s->profiles[s->profile].data);
+	if (ret == 0)
+		ret = si4455_props_apply(s);
+	if (ret == 0) {
+		s->configured = true;
+		s->cts_error = false;
 	}
-	mutex_unlock(&s->mutex);
 	return ret;
 }
 
-static void si4455_handle_rx_pend(struct si4455_port *s, struct si4455_fifo_info *fifo_info)
+/*
+ * The command stream has to end within the image
+ */
+static int si4455_profile_check(const u8 *data, u32 length)
 {
-	struct uart_port *port = &s->port;
-	u8 *data;
-	int sret = 0;
-	int i = 0;
-	u32 length;
+	u32 pos = 0;
 
-	length = (s->package_size == 0) ? fifo_info->rx_fifo_count : s->package_size;
+	while (pos < length && data[pos])
+		pos += 1 + data[pos];
 
-	data = kzalloc(length, GFP_KERNEL);
-	if (!data)
-		return;
+	return pos < length ? 0 : -EINVAL;
+}
 
-	sret = si4455_end_rx(port, length, data);
-	if (sret) {
-		dev_err(port->dev, "%s: si4455_end_rx error (%i)\n",
-			__func__, sret);
+/*
+ * Keeps the profiles of the firmware in memory, a single EZConfig image
+ * is the default profile with the package size of the device tree.
+ */
+static int si4455_fw_load(struct si4455_port *s, const struct firmware *fw)
+{
+	const struct si4455_bundle_hdr *hdr;
+	const struct si4455_bundle_entry *entry;
+	struct si4455_profile *profile;
+	u8 *data;
+	u32 count;
+	u32 offset;
+	u32 length;
+	u32 i;
+
+	data = devm_kmemdup(s->port.dev, fw->data, fw->size, GFP_KERNEL);
+	if (!data)
+		return -ENOMEM;
+
+	hdr = (const struct si4455_bundle_hdr *)data;
+	if (fw->size < sizeof(*hdr) ||
+	    memcmp(hdr->magic, SI4455_BUNDLE_MAGIC, sizeof(hdr->magic))) {
+		profile = &s->profiles[0];
+		strscpy(profile->name, "default", sizeof(profile->name));
+		profile->data = data;
+		profile->length = fw->size;
+		profile->package_size = s->package_size;
+		s->profile_count = 1;
+		return si4455_profile_check(profile->data, profile->length);
+	}
+
+	count = le32_to_cpu(hdr->count);
+	if (le32_to_cpu(hdr->version) != SI4455_BUNDLE_VERSION ||
+	    count == 0 || count > SI4455_PROFILE_MAX ||
+	    fw->size < sizeof(*hdr) + count * sizeof(*entry))
+		return -EINVAL;
+
+	entry = (const struct si4455_bundle_entry *)&hdr[1];
+	for (i = 0; i < count; i++, entry++) {
+		profile = &s->profiles[i];
+		offset = le32_to_cpu(entry->offset);
+		length = le32_to_cpu(entry->length);
+		if (offset > fw->size || length > fw->size - offset ||
+		    le32_to_cpu(entry->package_size) > SI4455_FIFO_SIZE ||
+		    si4455_profile_check(&data[offset], length))
+			return -EINVAL;
+
+		strscpy(profile->name, entry->name, sizeof(profile->name));
+		profile->data = &data[offset];
+		profile->length = length;
+		profile->package_size = le32_to_cpu(entry->package_size);
+	}
+	s->profile_count = count;
+	s->package_size = s->profiles[0].package_size;
+
+	return 0;
+}
+
+static bool si4455_profile_is_prop(const u8 *cmd)
+{
+	return cmd[0] >= SI4455_CMD_ARG_COUNT_SET_PROPERTY &&
+	       cmd[1] == SI4455_CMD_ID_SET_PROPERTY;
+}
+
+/*
+ * Looks for a command of the same length with the same first length bytes
+ */
+static bool si4455_profile_find(const u8 *data, const u8 *cmd, u32 length)
+{
+	for (; *data; data += 1 + *data) {
+		if (data[0] == cmd[0] && !memcmp(&data[1], &cmd[1], length))
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * The profiles differ in property values only: the same commands apart
+ * from SET_PROPERTY, and the properties set by the active profile
+ * are set by the next one too.
+ */
+static bool si4455_profile_props_only(const u8 *cur, const u8 *next)
+{
+	const u8 *a = cur;
+	const u8 *b = next;
+
+	for (;;) {
+		while (*a && si4455_profile_is_prop(a))
+			a += 1 + *a;
+		while (*b && si4455_profile_is_prop(b))
+			b += 1 + *b;
+		if (!*a || !*b)
+			break;
+
+		if (a[0] != b[0] || memcmp(&a[1], &b[1], a[0]))
+			return false;
+
+		a += 1 + *a;
+		b += 1 + *b;
+	}
+	if (*a || *b)
+		return false;
+
+	for (a = cur; *a; a += 1 + *a) {
+		if (si4455_profile_is_prop(a) &&
+		    !si4455_profile_find(next, a,
+					 SI4455_CMD_ARG_COUNT_SET_PROPERTY))
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * Sends the SET_PROPERTY commands of the next profile
+ * missing from the active one
+ */
+static int si4455_profile_replay(struct si4455_port *s, const u8 *cur,
+				 const u8 *next)
+{
+	u8 radio_cmd[16];
+	int ret;
+
+	for (; *next; next += 1 + *next) {
+		if (!si4455_profile_is_prop(next) ||
+		    si4455_profile_find(cur, next, next[0]))
+			continue;
+
+		if (next[0] > sizeof(radio_cmd))
+			return -EINVAL;
+
+		memcpy(radio_cmd, &next[1], next[0]);
+		ret = si4455_send_command(&s->port, next[0], radio_cmd);
+		if (ret)
+			return ret;
+
+		s->profile_stats.command_count++;
+	}
+
+	return 0;
+}
+
+static u32 si4455_packet_max(struct si4455_port *s)
+{
+	return (s->package_size == 0) ? SI4455_FIFO_SIZE - 3 : s->package_size;
+}
+
+static u32 si4455_fec_overhead(struct si4455_port *s)
+{
+	return s->fec_rs ?
+	       s->fec_roots * s->fec_depth + SI4455_FEC_CHECK_SIZE : 0;
+}
+
+/*
+ * A packet of the package size has to hold the FEC parity
+ * and at least one byte of payload.
+ */
+static int si4455_package_size_check(struct si4455_port *s, u32 package_size)
+{
+	u32 packet_max = (package_size == 0) ? SI4455_FIFO_SIZE - 3 : package_size;
+
+	return packet_max > si4455_fec_overhead(s) ? 0 : -EINVAL;
+}
+
+/*
+ * Starts a new data rate evaluation window.
+ * Must be called with s->mutex held.
+ */
+static void si4455_adr_reset(struct si4455_port *s)
+{
+	s->adr_rssi_sum = 0;
+	s->adr_rssi_count = 0;
+	s->adr_crc_base = s->stats.crc_error_count;
+	s->adr_rx_base = s->stats.rx_packet_count;
+	s->adr_frame_base = s->arq_stats.frame_count;
+	s->adr_retransmit_base = s->arq_stats.retransmit_count;
+}
+
+/*
+ * Switches to the profile between packets, replaying the changed
+ * properties only if possible, otherwise the whole profile.
+ * Must be called with s->mutex held.
+ */
+static int si4455_profile_switch(struct si4455_port *s, u32 index)
+{
+	const u8 *cur = s->profiles[s->profile].data;
+	const u8 *next = s->profiles[index].data;
+	ktime_t start = ktime_get();
+	int ret;
+
+	s->profile_pending = false;
+	if (index == s->profile)
+		return 0;
+
+	ret = si4455_package_size_check(s, s->profiles[index].package_size);
+	if (ret)
+		return ret;
+
+	/* The interrupts of the new profile are set up again by si4455_do_work */
+	ret = si4455_scan_irq(s, false);
+	if (ret)
+		return ret;
+
+	ret = si4455_change_state(&s->port,
+				  SI4455_CMD_CHANGE_STATE_STATE_SLEEP);
+	if (ret)
+		return ret;
+
+	/* The CTS recovery configures the new profile if the switch fails */
+	s->profile = index;
+	s->package_size = s->profiles[index].package_size;
+	if (si4455_profile_props_only(cur, next)) {
+		ret = si4455_profile_replay(s, cur, next);
+		if (!ret)
+			ret = si4455_props_apply(s);
+		s->profile_stats.replay_count++;
 	} else {
-		if (!s->rx_stopped) {
-			for (i = 0; i < length; i++) {
-				uart_insert_char(port, 0, 0, data[i], TTY_NORMAL);
-				port->icount.rx++;
-			}
-			tty_flip_buffer_push(&port->state->port);
+		si4455_s_power(s->port.dev, false);
+		ret = si4455_re_configure(&s->port);
+		s->profile_stats.full_count++;
+	}
+	s->profile_stats.switch_count++;
+	s->profile_stats.last_switch_us = ktime_us_delta(ktime_get(), start);
+	/* The statistics of the new profile are evaluated from a full window */
+	si4455_adr_reset(s);
+	s->adr_idle = 0;
+	s->adr_hold = true;
+
+	return ret;
+}
+
+static bool si4455_hop_active(struct si4455_port *s)
+{
+	return s->hop_table_len > 0 && s->hop_dwell_us > 0;
+}
+
+static u32 si4455_get_tx_channel(struct si4455_port *s)
+{
+	if (si4455_hop_active(s))
+		return s->hop_table[s->hop_index];
+
+	return s->tx_channel;
+}
+
+static bool si4455_scan_active(struct si4455_port *s)
+{
+	return s->scan_table_len > 0 && s->scan_dwell_us > 0;
+}
+
+static bool si4455_modem_irq_needed(struct si4455_port *s)
+{
+	return si4455_scan_active(s) || si4455_hop_active(s);
+}
+
+static u32 si4455_get_rx_channel(struct si4455_port *s)
+{
+	if (s->survey_active)
+		return s->survey_table[s->survey_index];
+
+	if (si4455_scan_active(s))
+		return s->scan_table[s->scan_index];
+
+	if (si4455_hop_active(s))
+		return s->hop_table[s->hop_index];
+
+	return s->rx_channel;
+}
+
+/*
+ * Clear channel assessment before START_TX.
+ * Returns 1 when the channel may be used, 0 when the transmission
+ * has been deferred by a random backoff, negative value on error.
+ */
+static int si4455_csma_access(struct si4455_port *s, u32 channel)
+{
+	struct uart_port *port = &s->port;
+	struct si4455_modem_status modem_status = { 0 };
+	u32 backoff_exp;
+	u32 backoff_us;
+	int ret;
+
+	ret = si4455_rx(port, channel, 0x00, s->package_size,
+			SI4455_CMD_START_RX_RXTIMEOUT_STATE_RX,
+			SI4455_CMD_START_RX_RXVALID_STATE_RX,
+			SI4455_CMD_START_RX_RXINVALID_STATE_RX);
+	if (ret) {
+		dev_err(port->dev, "%s: si4455_rx error (%i)\n",
+			__func__, ret);
+		return ret;
+	}
+	s->rx_active_channel = channel;
+	usleep_range(SI4455_CSMA_SETTLE_US, SI4455_CSMA_SETTLE_US + 100);
+
+	ret = si4455_get_modem_status(port, 0, &modem_status);
+	if (ret) {
+		dev_err(port->dev, "%s: si4455_get_modem_status error (%i)\n",
+			__func__, ret);
+		return ret;
+	}
+
+	s->csma_attempt_count++;
+	if (modem_status.curr_rssi < s->csma_threshold) {
+		s->csma_backoffs = 0;
+		return 1;
+	}
+
+	s->csma_busy_count++;
+	if (s->csma_backoffs >= s->csma_max_backoffs) {
+		/*
+		 * Serial data can not be dropped, transmit anyway
+		 */
+		s->csma_forced_count++;
+		s->csma_backoffs = 0;
+		return 1;
+	}
+
+	backoff_exp = min_t(u32, SI4455_CSMA_MIN_BE + s->csma_backoffs,
+			    SI4455_CSMA_MAX_BE);
+	backoff_us = (1 + prandom_u32_max(1 << backoff_exp)) * s->csma_slot_us;
+	s->csma_backoffs++;
+	s->csma_deferred = true;
+	hrtimer_start(&s->csma_timer, us_to_ktime(backoff_us),
+		      HRTIMER_MODE_REL);
+
+	return 0;
+}
+
+static u32 si4455_payload_max(struct si4455_port *s)
+{
+	u32 overhead = si4455_fec_overhead(s);
+
+	if (si4455_packet_max(s) <= overhead)
+		return 0;
+
+	return si4455_packet_max(s) - overhead;
+}
+
+/*
+ * Appends the CRC-16 of the payload and the Reed-Solomon parity of
+ * the packet. The packet is interleaved into fec_depth codewords byte
+ * by byte, so a burst error is spread over the codewords.
+ */
+static void si4455_fec_encode(struct si4455_port *s, u8 *data, u32 length)
+{
+	u8 codeword[SI4455_FIFO_SIZE];
+	u16 par[SI4455_FEC_ROOTS_MAX];
+	u32 depth = s->fec_depth;
+	u32 i, k, n;
+
+	put_unaligned_le16(crc16(0, data, length), &data[length]);
+	length += SI4455_FEC_CHECK_SIZE;
+	for (k = 0; k < depth; k++) {
+		for (i = k, n = 0; i < length; i += depth)
+			codeword[n++] = data[i];
+
+		memset(par, 0, sizeof(par));
+		if (n)
+			encode_rs8(s->fec_rs, codeword, n, par, 0);
+
+		for (i = 0; i < s->fec_roots; i++)
+			data[length + i * depth + k] = par[i];
+	}
+}
+
+/*
+ * Corrects the packet in place, strips the parity and the CRC-16.
+ * Returns the number of corrected symbols or negative value
+ * if the packet is uncorrectable. -EBADMSG means the CRC-16 of the
+ * payload does not match, e.g. the decoder miscorrected the packet.
+ */
+static int si4455_fec_decode(struct si4455_port *s, u8 *data, u32 *length)
+{
+	u8 codeword[SI4455_FIFO_SIZE];
+	u16 par[SI4455_FEC_ROOTS_MAX];
+	u32 overhead = si4455_fec_overhead(s);
+	u32 depth = s->fec_depth;
+	u32 data_length;
+	u32 i, k, n;
+	int corrected = 0;
+	int ret;
+
+	if (*length <= overhead)
+		return -EINVAL;
+
+	data_length = *length - overhead + SI4455_FEC_CHECK_SIZE;
+	for (k = 0; k < depth; k++) {
+		for (i = k, n = 0; i < data_length; i += depth)
+			codeword[n++] = data[i];
+
+		if (!n)
+			continue;
+
+		for (i = 0; i < s->fec_roots; i++)
+			par[i] = data[data_length + i * depth + k];
+
+		ret = decode_rs8(s->fec_rs, codeword, par, n,
+				 NULL, 0, NULL, 0, NULL);
+		if (ret < 0)
+			return ret;
+
+		if (ret > 0) {
+			for (i = k, n = 0; i < data_length; i += depth)
+				data[i] = codeword[n++];
+			corrected += ret;
 		}
 	}
-	kfree(data);
+	data_length -= SI4455_FEC_CHECK_SIZE;
+	if (crc16(0, data, data_length) !=
+	    get_unaligned_le16(&data[data_length]))
+		return -EBADMSG;
+
+	*length = data_length;
+
+	return corrected;
 }
 
-static void si4455_handle_tx_pend(struct si4455_port *s)
+static void si4455_xmit_copy(struct circ_buf *xmit, u8 *data, u32 length)
+{
+	u32 tx_to_end;
+
+	tx_to_end = CIRC_CNT_TO_END(xmit->head, xmit->tail, UART_XMIT_SIZE);
+	if (tx_to_end < length) {
+		memcpy(data, xmit->buf + xmit->tail, tx_to_end);
+		memcpy(&data[tx_to_end], xmit->buf, length - tx_to_end);
+	} else {
+		memcpy(data, xmit->buf + xmit->tail, length);
+	}
+}
+
+/*
+ * Starts the transmission of one radio packet.
+ * In variable package size mode the length field is prepended,
+ * in fixed package size mode the payload is padded to package_size.
+ * The forward error correction parity follows the (padded) payload.
+ * Returns 1 when the transmission started, 0 when it has been
+ * deferred by listen before talk, negative value on error.
+ */
+static int si4455_xmit_packet(struct si4455_port *s, const u8 *payload,
+			      u32 length)
 {
 	struct uart_port *port = &s->port;
-	struct circ_buf *xmit = &port->state->xmit;
-	u32 sent;
+	u32 channel = si4455_get_tx_channel(s);
+	u32 packet_length;
+	u32 data_length;
+	u8 *packet;
+	u8 *data;
+	int ret;
+
+	if (length > si4455_payload_max(s))
+		return -EINVAL;
+
+	si4455_spi_window_start(s);
+	if (s->csma_threshold) {
+		ret = si4455_csma_access(s, channel);
+		if (ret <= 0)
+			return ret;
+	}
+
+	packet_length = (s->package_size == 0) ? length : si4455_payload_max(s);
+	packet_length += si4455_fec_overhead(s);
+	data_length = (s->package_size == 0) ? packet_length + 1 : s->package_size;
+	data = kzalloc(data_length, GFP_KERNEL);
+	if (!data)
+		return -ENOMEM;
+
+	if (s->package_size == 0) {
+		data[0] = packet_length;
+		packet = &data[1];
+	} else {
+		packet = data;
+	}
+	memcpy(packet, payload, length);
+	if (s->fec_rs)
+		si4455_fec_encode(s, packet,
+				  packet_length - si4455_fec_overhead(s));
+
+	ret = si4455_begin_tx(port, channel, data_length, data);
+	if (!ret) {
+		s->tx_pending = true;
+		s->tx_start = ktime_get();
+		s->tx_length = data_length;
+		s->spi_tx_xfers = s->spi_window_xfers;
+		s->spi_tx_bytes = s->spi_window_bytes;
+		uart_handle_cts_change(&s->port, 0);
+		mod_timer(&s->tx_wd_timer, jiffies + msecs_to_jiffies(s->tx_wd_timeout));
+	}
+
+	kfree(data);
+
+	return ret ? ret : 1;
+}
+
+static bool si4455_link_enabled(struct si4455_port *s)
+{
+	return s->arq_window > 0 || s->mtu > 0;
+}
+
+static u32 si4455_link_hdr_size(struct si4455_port *s)
+{
+	return SI4455_LINK_HDR_SIZE + (s->address ? SI4455_LINK_ADDR_SIZE : 0);
+}
+
+static int si4455_link_hdr_pack(const struct si4455_link_hdr *hdr, u8 *data)
+{
+	data[0] = hdr->flags;
+	data[1] = hdr->seq;
+	data[2] = hdr->ack;
+	data[3] = hdr->len;
+	if (!(hdr->flags & SI4455_LINK_FLAG_ADDR))
+		return SI4455_LINK_HDR_SIZE;
+
+	data[4] = hdr->dst;
+	data[5] = hdr->src;
+
+	return SI4455_LINK_HDR_SIZE + SI4455_LINK_ADDR_SIZE;
+}
+
+static int si4455_link_hdr_unpack(struct si4455_link_hdr *hdr,
+				  const u8 *data, u32 length)
+{
+	u32 size = SI4455_LINK_HDR_SIZE;
+
+	if (length < size)
+		return -EINVAL;
+
+	hdr->flags = data[0];
+	hdr->seq = data[1];
+	hdr->ack = data[2];
+	hdr->len = data[3];
+	if (hdr->flags & SI4455_LINK_FLAG_ADDR) {
+		size += SI4455_LINK_ADDR_SIZE;
+		if (length < size)
+			return -EINVAL;
+
+		hdr->dst = data[4];
+		hdr->src = data[5];
+	}
+	if (hdr->len > length - size)
+		return -EINVAL;
+
+	return size;
+}
+
+/*
+ * Returns the link of the main port (index 0) or of a remote port.
+ * Must be called with s->mutex held.
+ */
+static struct si4455_link *si4455_link_get(struct si4455_port *s, u32 index)
+{
+	return index ? &s->remotes[index - 1]->link : &s->link;
+}
+
+static struct si4455_link *si4455_link_find(struct si4455_port *s, u8 addr)
+{
+	u32 i;
+
+	for (i = 0; i < s->remote_count; i++)
+		if (s->remotes[i]->link.addr == addr)
+			return &s->remotes[i]->link;
+
+	return NULL;
+}
+
+static void si4455_link_clear(struct si4455_link *link)
+{
+	hrtimer_cancel(&link->arq_timer);
+	hrtimer_cancel(&link->ack_timer);
+	link->head = 0;
+	link->next = 0;
+	link->tail = 0;
+	link->ack_due = false;
+	link->arq_expired = false;
+	link->reasm_active = false;
+	memset(&link->peer, 0, sizeof(link->peer));
+	memset(link->reorder, 0, sizeof(link->reorder));
+	/*
+	 * Random initial sequence number keeps the peer from taking
+	 * the first frames after restart as duplicates
+	 */
+	link->peer.tx_seq = prandom_u32_max(256);
+	link->peer.tx_sync = true;
+}
+
+/*
+ * Must be called with s->mutex held.
+ */
+static void si4455_link_reset(struct si4455_port *s)
+{
+	u32 i;
+
+	for (i = 0; i <= s->remote_count; i++)
+		si4455_link_clear(si4455_link_get(s, i));
+	s->link_tx_frame = false;
+	s->link_tx = NULL;
+}
+
+/*
+ * Must be called with s->mutex held.
+ */
+static void si4455_link_stop(struct si4455_port *s)
+{
+	struct si4455_link *link;
+	u32 i;
+
+	for (i = 0; i <= s->remote_count; i++) {
+		link = si4455_link_get(s, i);
+		hrtimer_cancel(&link->arq_timer);
+		hrtimer_cancel(&link->ack_timer);
+	}
+}
+
+/*
+ * Splits the message into frames, the first and last fragments
+ * are flagged if framing is enabled.
+ */
+static void si4455_link_queue_message(struct si4455_link *link, const u8 *data,
+				      u32 length, u8 flags)
+{
+	struct si4455_port *s = link->s;
+	struct si4455_link_frame *frame;
+	u32 max_length = si4455_payload_max(s) - si4455_link_hdr_size(s);
+
+	/*
+	 * Broadcast frames are not acknowledged
+	 */
+	if (s->arq_window && !(s->address && link->addr == SI4455_ADDR_BROADCAST))
+		flags |= SI4455_LINK_FLAG_SEQ;
+
+	if (s->mtu)
+		flags |= SI4455_LINK_FLAG_FIRST;
+
+	while (length) {
+		frame = &link->queue[link->head % SI4455_LINK_QUEUE_LEN];
+		frame->len = min(length, max_length);
+		memcpy(frame->data, data, frame->len);
+		data += frame->len;
+		length -= frame->len;
+		frame->flags = flags;
+		if (s->mtu && length == 0)
+			frame->flags |= SI4455_LINK_FLAG_LAST;
+		frame->seq = link->peer.tx_seq++;
+		frame->tx_count = 0;
+		link->head++;
+		flags &= ~SI4455_LINK_FLAG_FIRST;
+	}
+	s->frag_stats.message_tx_count++;
+}
+
+/*
+ * Queues the message in compressed form if it became shorter.
+ */
+static void si4455_link_queue_compressed(struct si4455_link *link, u32 length)
+{
+	struct si4455_port *s = link->s;
+	size_t zlength = sizeof(s->link_zmsg);
+	ktime_t start = ktime_get();
+	int ret;
+
+	ret = lzo1x_1_compress(s->link_msg, length, s->link_zmsg, &zlength,
+			       s->comp_wrkmem);
+	s->comp_stats.compress_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+	s->comp_stats.in_bytes += length;
+	if (ret == LZO_E_OK && zlength < length) {
+		s->comp_stats.out_bytes += zlength;
+		s->comp_stats.compressed_count++;
+		si4455_link_queue_message(link, s->link_zmsg, zlength,
+					  SI4455_LINK_FLAG_COMP);
+	} else {
+		s->comp_stats.out_bytes += length;
+		si4455_link_queue_message(link, s->link_msg, length, 0);
+	}
+}
+
+static void si4455_link_fill(struct si4455_link *link)
+{
+	struct si4455_port *s = link->s;
+	struct uart_port *port = link->port;
+	struct circ_buf *xmit = &port->state->xmit;
+	u32 max_length = si4455_payload_max(s) - si4455_link_hdr_size(s);
+	u32 pending;
+	u32 length;
+	u32 free;
+
+	/*
+	 * The port is closed, uart_shutdown() frees its transmit buffer
+	 */
+	if (!tty_port_initialized(&port->state->port))
+		return;
+
+	if (link->tx_stopped || uart_tx_stopped(port))
+		return;
+
+	for (;;) {
+		pending = uart_circ_chars_pending(xmit);
+		free = SI4455_LINK_QUEUE_LEN - (link->head - link->tail);
+		if (pending == 0 || free == 0)
+			break;
+
+		/*
+		 * The data written since the previous packet forms one message,
+		 * a message is queued only if all of its fragments fit.
+		 */
+		if (s->mtu)
+			length = min3(pending, s->mtu,
+				      SI4455_LINK_QUEUE_LEN * max_length);
+		else
+			length = min(pending, max_length);
+		if (DIV_ROUND_UP(length, max_length) > free)
+			break;
+
+		si4455_xmit_copy(xmit, s->link_msg, length);
+		xmit->tail = (xmit->tail + length) & (UART_XMIT_SIZE - 1);
+		port->icount.tx += length;
+		if (s->comp_wrkmem && s->mtu)
+			si4455_link_queue_compressed(link, length);
+		else
+			si4455_link_queue_message(link, s->link_msg, length, 0);
+	}
+
+	if (uart_circ_chars_pending(xmit) < WAKEUP_CHARS)
+		uart_write_wakeup(port);
+}
+
+static u32 si4455_arq_rto(struct si4455_port *s)
+{
+	struct si4455_arq_stats *stats = &s->arq_stats;
+	u32 airtime = s->tx_airtime_us;
+	u32 rto;
+
+	if (stats->srtt_us)
+		rto = stats->srtt_us + 4 * stats->rttvar_us;
+	else if (airtime)
+		rto = 3 * airtime + SI4455_ARQ_TURNAROUND_US;
+	else
+		rto = SI4455_ARQ_RTO_INIT_US;
+
+	/*
+	 * At least the airtime of the frame and of the acknowledgment
+	 */
+	rto = max(rto, 2 * airtime + SI4455_ARQ_TURNAROUND_US);
+	rto += s->arq_ack_delay_us;
+
+	return clamp_t(u32, rto, SI4455_ARQ_RTO_MIN_US, SI4455_ARQ_RTO_MAX_US);
+}
+
+static void si4455_arq_arm(struct si4455_link *link)
+{
+	struct si4455_link_frame *frame;
+	u32 rto = si4455_arq_rto(link->s);
+
+	frame = &link->queue[link->tail % SI4455_LINK_QUEUE_LEN];
+	if (frame->tx_count > 1)
+		rto = min_t(u32, rto << min(frame->tx_count - 1, 4),
+			    SI4455_ARQ_RTO_MAX_US);
+
+	link->s->arq_stats.rto_us = rto;
+	hrtimer_start(&link->arq_timer, us_to_ktime(rto), HRTIMER_MODE_REL);
+}
+
+static void si4455_arq_rtt_sample(struct si4455_port *s, u32 rtt)
+{
+	struct si4455_arq_stats *stats = &s->arq_stats;
+	u32 delta;
+
+	if (!stats->srtt_us) {
+		stats->srtt_us = rtt;
+		stats->rttvar_us = rtt / 2;
+		stats->rtt_min_us = rtt;
+		stats->rtt_max_us = rtt;
+		return;
+	}
+
+	delta = (rtt > stats->srtt_us) ? rtt - stats->srtt_us
+		: stats->srtt_us - rtt;
+	stats->rttvar_us = (3 * stats->rttvar_us + delta) / 4;
+	stats->srtt_us = (7 * stats->srtt_us + rtt) / 8;
+	stats->rtt_min_us = min(stats->rtt_min_us, rtt);
+	stats->rtt_max_us = max(stats->rtt_max_us, rtt);
+}
+
+static void si4455_link_ack(struct si4455_link *link, u8 ack)
+{
+	struct si4455_link_frame *frame;
+	ktime_t now = ktime_get();
+	bool acked = false;
+
+	while (link->tail != link->head) {
+		frame = &link->queue[link->tail % SI4455_LINK_QUEUE_LEN];
+		if (frame->tx_count == 0 || (s8)(ack - frame->seq) <= 0)
+			break;
+
+		/*
+		 * Karn's algorithm, retransmitted frames are not sampled
+		 */
+		if (frame->tx_count == 1)
+			si4455_arq_rtt_sample(link->s,
+					      ktime_us_delta(now, frame->sent));
+		link->tail++;
+		acked = true;
+	}
+
+	if (!acked)
+		return;
+
+	if ((s32)(link->next - link->tail) < 0)
+		link->next = link->tail;
+
+	hrtimer_try_to_cancel(&link->arq_timer);
+	if (link->tail != link->next)
+		si4455_arq_arm(link);
+}
+
+/*
+ * Sends the next frame or the pending acknowledgment of the link
+ * on the radio, which is the owner of the link or a bonded member.
+ * Returns -ENODATA if the link has nothing to send, otherwise
+ * the result of si4455_xmit_packet().
+ */
+static int si4455_link_xmit_frame(struct si4455_port *radio,
+				  struct si4455_link *link)
+{
+	struct si4455_port *s = link->s;
+	struct si4455_link_frame *frame = NULL;
+	struct si4455_link_hdr hdr = { 0 };
+	u8 data[SI4455_FIFO_SIZE];
+	u32 index = link->next;
+	int length;
+	int ret;
+
+	si4455_link_fill(link);
+
+	if (link->next != link->head
+	    && link->next - link->tail < max(s->arq_window, 1u)) {
+		frame = &link->queue[index % SI4455_LINK_QUEUE_LEN];
+		if (link->peer.tx_sync && index == link->tail) {
+			frame->flags |= SI4455_LINK_FLAG_SYNC;
+			link->peer.tx_sync = false;
+		}
+		hdr.flags = frame->flags;
+		hdr.seq = frame->seq;
+		hdr.len = frame->len;
+	} else if (!(link->peer.ack_pending && link->ack_due)) {
+		return -ENODATA;
+	}
+
+	if (link->peer.ack_pending) {
+		hdr.flags |= SI4455_LINK_FLAG_ACK;
+		hdr.ack = link->peer.rx_seq;
+	}
+
+	if (s->address) {
+		hdr.flags |= SI4455_LINK_FLAG_ADDR;
+		hdr.dst = link->addr;
+		hdr.src = s->address;
+	}
+
+	length = si4455_link_hdr_pack(&hdr, data);
+	if (frame) {
+		memcpy(&data[length], frame->data, frame->len);
+		length += frame->len;
+	}
+
+	ret = si4455_xmit_packet(radio, data, length);
+	if (ret <= 0)
+		return ret;
+
+	if (hdr.flags & SI4455_LINK_FLAG_ACK) {
+		link->peer.ack_pending = false;
+		link->ack_due = false;
+		hrtimer_try_to_cancel(&link->ack_timer);
+		if (!frame)
+			s->arq_stats.ack_count++;
+	}
+
+	radio->link_tx_frame = frame != NULL;
+	radio->link_tx = link;
+	radio->link_tx_index = index;
+	if (frame) {
+		/*
+		 * The frame is claimed at once, so bonded radios
+		 * send the following frames in parallel
+		 */
+		link->next++;
+		if (frame->tx_count++ == 0) {
+			frame->sent = ktime_get();
+			s->arq_stats.frame_count++;
+		} else {
+			s->arq_stats.retransmit_count++;
+		}
+	}
+
+	return ret;
+}
+
+/*
+ * Sends a control frame to the remote node of the link,
+ * the pending acknowledgment is piggybacked.
+ */
+static int si4455_link_xmit_ctrl(struct si4455_link *link, u8 type,
+				 const u8 *args, u32 args_length)
+{
+	struct si4455_port *s = link->s;
+	struct si4455_link_hdr hdr = { 0 };
+	u8 data[SI4455_FIFO_SIZE];
+	int length;
+	int ret;
+
+	hdr.flags = SI4455_LINK_FLAG_CTRL;
+	hdr.len = 1 + args_length;
+	if (link->peer.ack_pending) {
+		hdr.flags |= SI4455_LINK_FLAG_ACK;
+		hdr.ack = link->peer.rx_seq;
+	}
+
+	if (s->address) {
+		hdr.flags |= SI4455_LINK_FLAG_ADDR;
+		hdr.dst = link->addr;
+		hdr.src = s->address;
+	}
+
+	if (si4455_link_hdr_size(s) + hdr.len > si4455_payload_max(s))
+		return -EINVAL;
+
+	length = si4455_link_hdr_pack(&hdr, data);
+	data[length++] = type;
+	memcpy(&data[length], args, args_length);
+	length += args_length;
+
+	ret = si4455_xmit_packet(s, data, length);
+	if (ret <= 0)
+		return ret;
+
+	if (hdr.flags & SI4455_LINK_FLAG_ACK) {
+		link->peer.ack_pending = false;
+		link->ack_due = false;
+		hrtimer_try_to_cancel(&link->ack_timer);
+	}
+	s->link_tx_frame = false;
+
+	return ret;
+}
+
+/*
+ * Sets the PA level, applied after the packet if a transmission is in progress
+ */
+static int si4455_tpc_set_level(struct si4455_port *s, u8 level)
+{
+	s->tpc_level = level;
+	if (s->tx_pending) {
+		s->props_pending = true;
+		return 0;
+	}
+
+	return si4455_set_property(&s->port, SI4455_PROP_GROUP_PA,
+				   SI4455_PROP_PA_PWR_LVL, 1, &level);
+}
+
+/*
+ * The PA is shared by the links, the level follows the weakest peer
+ * having reported recently: up fast if a peer hears us below the target
+ * or loses packets, down slowly if every peer hears us above the target.
+ */
+static void si4455_tpc_update(struct si4455_port *s)
+{
+	struct si4455_link_peer *peer;
+	unsigned long valid = msecs_to_jiffies(SI4455_TPC_REPORT_VALID *
+					       SI4455_TPC_REPORT_MS);
+	u32 rssi = U8_MAX;
+	u32 crc_permille = 0;
+	bool reported = false;
+	u32 level = s->tpc_level;
+	int ret;
+	u32 i;
+
+	for (i = 0; i <= s->remote_count; i++) {
+		peer = &si4455_link_get(s, i)->peer;
+		if (!peer->tpc_reported ||
+		    time_after(jiffies, peer->tpc_report_time + valid))
+			continue;
+
+		rssi = min_t(u32, rssi, peer->tpc_rssi);
+		crc_permille = max_t(u32, crc_permille, peer->tpc_crc_permille);
+		reported = true;
+	}
+	if (!reported)
+		return;
+
+	if (crc_permille > s->tpc_crc_permille ||
+	    rssi + SI4455_TPC_HYSTERESIS < s->tpc_target_rssi)
+		level = min(level + 2 * SI4455_TPC_STEP, s->tpc_level_max);
+	else if (rssi > s->tpc_target_rssi + SI4455_TPC_HYSTERESIS)
+		level = max_t(int, level - SI4455_TPC_STEP, s->tpc_level_min);
+
+	if (level == s->tpc_level)
+		return;
+
+	if (level > s->tpc_level)
+		s->tpc_stats.step_up_count++;
+	else
+		s->tpc_stats.step_down_count++;
+
+	ret = si4455_tpc_set_level(s, level);
+	if (ret)
+		dev_err(s->port.dev, "%s: si4455_tpc_set_level error (%i)\n",
+			__func__, ret);
+}
+
+/*
+ * Reports are sent to peers doing power control, or by a node doing power
+ * control to have the peer report back. A broadcast report would be taken
+ * by every node, the addressed nodes report on the remote links only.
+ */
+static bool si4455_tpc_report_due(struct si4455_port *s,
+				  struct si4455_link *link)
+{
+	if (s->address && link == &s->link)
+		return false;
+
+	if (!(si4455_tpc_enabled(s) || link->peer.tpc_peer))
+		return false;
+
+	return link->peer.tpc_rssi_count &&
+	       time_after_eq(jiffies, link->peer.tpc_report_next);
+}
+
+/*
+ * Reports the mean RSSI of the frames received from the peer and the CRC
+ * error ratio of the radio since the last report
+ */
+static int si4455_tpc_report(struct si4455_port *s, struct si4455_link *link)
+{
+	struct si4455_link_peer *peer = &link->peer;
+	u32 crc = s->stats.crc_error_count - s->tpc_crc_base;
+	u32 rx = s->stats.rx_packet_count - s->tpc_rx_base;
+	u8 args[3];
+	int ret;
+
+	args[0] = peer->tpc_rssi_sum / peer->tpc_rssi_count;
+	put_unaligned_le16(crc + rx ? crc * 1000 / (crc + rx) : 0, &args[1]);
+
+	ret = si4455_link_xmit_ctrl(link, SI4455_LINK_CTRL_RSSI, args,
+				    sizeof(args));
+	if (ret <= 0)
+		return ret;
+
+	peer->tpc_rssi_sum = 0;
+	peer->tpc_rssi_count = 0;
+	peer->tpc_report_next = jiffies +
+				msecs_to_jiffies(SI4455_TPC_REPORT_MS);
+	s->tpc_crc_base = s->stats.crc_error_count;
+	s->tpc_rx_base = s->stats.rx_packet_count;
+	s->tpc_stats.report_tx_count++;
+
+	return ret;
+}
+
+/*
+ * The data rate is adapted on point to point links:
+ * the main link, or the single remote of an addressed node.
+ */
+static struct si4455_link *si4455_adr_link(struct si4455_port *s)
+{
+	if (s->remote_count > 1)
+		return NULL;
+
+	return si4455_link_get(s, s->remote_count);
+}
+
+/*
+ * Asks the peer to switch to the requested profile,
+ * the radio switches when the request is sent.
+ */
+static int si4455_adr_xmit(struct si4455_port *s)
+{
+	struct si4455_link *link = si4455_adr_link(s);
+	u8 args[2];
+	int ret;
+
+	if (!link) {
+		s->adr_request_pending = false;
+		return 0;
+	}
+
+	args[0] = s->adr_request;
+	args[1] = s->profile_count;
+	ret = si4455_link_xmit_ctrl(link, SI4455_LINK_CTRL_RATE, args,
+				    sizeof(args));
+	if (ret <= 0)
+		return ret;
+
+	s->adr_request_pending = false;
+	s->adr_fallback = s->profile;
+	s->adr_verify = true;
+	s->profile_next = s->adr_request;
+	s->profile_pending = true;
+	s->adr_stats.rate_tx_count++;
+
+	return ret;
+}
+
+/*
+ * Serves the links round robin, one packet per turn,
+ * so a busy remote does not starve the others.
+ */
+static int si4455_link_xmit(struct si4455_port *s)
+{
+	struct si4455_link *link;
+	u32 count = s->remote_count + 1;
+	u32 index;
+	u32 i;
+	int ret;
+
+	if (si4455_payload_max(s) <= si4455_link_hdr_size(s))
+		return -EINVAL;
+
+	for (index = 0; index < count; index++) {
+		link = si4455_link_get(s, index);
+		if (si4455_tpc_report_due(s, link)) {
+			ret = si4455_tpc_report(s, link);
+			return ret < 0 ? ret : 0;
+		}
+	}
+
+	if (s->adr_request_pending) {
+		ret = si4455_adr_xmit(s);
+		return ret < 0 ? ret : 0;
+	}
+
+	for (i = 1; i <= count; i++) {
+		index = (s->link_rr + i) % count;
+		ret = si4455_link_xmit_frame(s, si4455_link_get(s, index));
+		if (ret == -ENODATA)
+			continue;
+
+		if (ret > 0)
+			s->link_rr = index;
+
+		return ret < 0 ? ret : 0;
+	}
+
+	return 0;
+}
+
+/*
+ * Completes the frame the radio sent, sent is false if the transmission
+ * has been cancelled. Must be called with the mutex of the link owner held.
+ */
+static void si4455_link_tx_done(struct si4455_port *radio, bool sent)
+{
+	struct si4455_link *link = radio->link_tx;
+	u32 index = radio->link_tx_index;
+	struct si4455_link_frame *frame;
+
+	if (!radio->link_tx_frame)
+		return;
+
+	radio->link_tx_frame = false;
+	/*
+	 * The frame has been acknowledged or the link has been reset
+	 * while the frame was on air
+	 */
+	if ((s32)(index - link->tail) < 0 || (s32)(link->next - index) <= 0)
+		return;
+
+	frame = &link->queue[index % SI4455_LINK_QUEUE_LEN];
+	if (!(frame->flags & SI4455_LINK_FLAG_SEQ)) {
+		/*
+		 * Unacknowledged frames leave the queue once on air,
+		 * a cancelled one is sent again
+		 */
+		if (sent)
+			link->tail = index + 1;
+		else if (link->next == index + 1)
+			link->next = index;
+	} else if (!hrtimer_active(&link->arq_timer)) {
+		si4455_arq_arm(link);
+	}
+}
+
+static void si4455_link_tx_end(struct si4455_port *radio, bool sent)
+{
+	struct si4455_port *master = radio->bond_master;
+
+	if (master)
+		mutex_lock(&master->mutex);
+	si4455_link_tx_done(radio, sent);
+	if (master)
+		mutex_unlock(&master->mutex);
+}
+
+static bool si4455_tdma_gateway(struct si4455_port *s)
+{
+	return s->tdma_slot_us && s->address;
+}
+
+static bool si4455_tdma_follower(struct si4455_port *s)
+{
+	return !si4455_tdma_gateway(s) && s->tdma_gateway &&
+		time_before(jiffies, s->tdma_sync_end);
+}
+
+/*
+ * Opens the receive window of the slot, the next slot starts
+ * at its end or earlier if the polled node replies.
+ */
+static void si4455_tdma_window(struct si4455_port *s, ktime_t start)
+{
+	s->tdma_window_start = start;
+	hrtimer_start(&s->tdma_timer,
+		      ktime_add_us(start, s->tdma_slot_us), HRTIMER_MODE_ABS);
+}
+
+/*
+ * Must be called with s->mutex held.
+ */
+static void si4455_tdma_update(struct si4455_port *s)
+{
+	hrtimer_cancel(&s->tdma_timer);
+	s->tdma_slot = 0;
+	s->tdma_beacon_sent = false;
+	s->tdma_replied = false;
+	s->tdma_xmit_due = s->connected && si4455_tdma_gateway(s);
+	s->tdma_tx = false;
+	s->tdma_grant = NULL;
+}
+
+static int si4455_tdma_beacon(struct si4455_port *s)
+{
+	u8 args[5];
+
+	args[0] = s->remote_count;
+	put_unaligned_le32(s->tdma_slot_us, &args[1]);
+
+	return si4455_link_xmit_ctrl(&s->link, SI4455_LINK_CTRL_BEACON,
+				     args, sizeof(args));
+}
+
+/*
+ * Transmission of the gateway in the current slot.
+ * Slot 0 carries the beacon and one broadcast frame,
+ * every other slot polls one remote node with its next frame
+ * or a poll control frame.
+ */
+static int si4455_tdma_xmit(struct si4455_port *s)
+{
+	struct si4455_link *link;
+	int ret;
+
+	if (s->tdma_slot > s->remote_count)
+		s->tdma_slot = 0;
+
+	if (s->tdma_slot == 0) {
+		if (!s->tdma_beacon_sent) {
+			ret = si4455_tdma_beacon(s);
+			if (ret > 0)
+				s->tdma_beacon_sent = true;
+			if (ret >= 0)
+				return 0;
+		} else {
+			ret = si4455_link_xmit_frame(s, &s->link);
+		}
+	} else {
+		link = si4455_link_get(s, s->tdma_slot);
+		if (link->peer.ack_pending)
+			link->ack_due = true;
+		ret = si4455_link_xmit_frame(s, link);
+		if (ret == -ENODATA)
+			ret = si4455_link_xmit_ctrl(link, SI4455_LINK_CTRL_POLL,
+						    NULL, 0);
+		if (ret > 0)
+			link->tdma_stats.poll_count++;
+	}
+
+	if (ret == 0)
+		return 0;
+
+	s->tdma_xmit_due = false;
+	if (ret > 0) {
+		s->tdma_tx = true;
+		return 0;
+	}
+
+	si4455_tdma_window(s, ktime_get());
+
+	return ret == -ENODATA ? 0 : ret;
+}
+
+/*
+ * The follower replies with one frame to every frame of the gateway
+ * addressed to it.
+ */
+static int si4455_tdma_reply(struct si4455_port *s)
+{
+	struct si4455_link *link = s->tdma_grant;
+	int ret;
+
+	if (!link)
+		return 0;
+
+	if (link->peer.ack_pending)
+		link->ack_due = true;
+	ret = si4455_link_xmit_frame(s, link);
+	if (ret == 0)
+		return 0;
+
+	s->tdma_grant = NULL;
+
+	return (ret == -ENODATA || ret > 0) ? 0 : ret;
+}
+
+/*
+ * A radio reporting CTS or transmit errors is left out of the striping
+ * for a while, the other radios of the bond carry its share.
+ */
+static bool si4455_bond_healthy(struct si4455_port *radio)
+{
+	u32 errors = radio->cts_error_count + radio->tx_error_count;
+
+	if (errors != radio->bond_errors) {
+		radio->bond_errors = errors;
+		radio->bond_holdoff_end = jiffies +
+			msecs_to_jiffies(SI4455_BOND_HOLDOFF_MS);
+		radio->bond_stats.fault_count++;
+	}
+
+	return !time_before(jiffies, radio->bond_holdoff_end);
+}
+
+/*
+ * Sends the next frame of the bond master on the member radio.
+ * Striping needs the sequence numbers of the retransmission,
+ * without it the master radio sends alone.
+ */
+static int si4455_bond_xmit(struct si4455_port *radio)
+{
+	struct si4455_port *master = radio->bond_master;
+	int ret = 0;
+
+	mutex_lock(&master->mutex);
+	if (master->connected && master->arq_window &&
+	    si4455_bond_healthy(radio))
+		ret = si4455_link_xmit_frame(radio, &master->link);
+	mutex_unlock(&master->mutex);
+
+	if (ret > 0)
+		radio->bond_stats.tx_frame_count++;
+
+	return (ret == -ENODATA || ret > 0) ? 0 : ret;
+}
+
+/*
+ * Must be called with s->mutex held.
+ */
+static void si4455_bond_kick(struct si4455_port *s)
+{
+	u32 i;
+
+	for (i = 0; i < s->bond_count; i++)
+		schedule_work(&s->bond_members[i]->tx_work);
+}
+
+/*
+ * The hop master announces the channel index, the time spent on the
+ * channel and the skipped hop_table entries at the start of every dwell.
+ * Must be called with s->mutex held.
+ */
+static int si4455_hop_sync(struct si4455_port *s)
+{
+	s64 remaining = ktime_us_delta(s->hop_next_time, ktime_get());
+	u8 args[10];
+	int ret;
+
+	/* The dwell is over, hop_work moves to the next channel first */
+	if (remaining <= 0)
+		return 0;
+
+	args[0] = s->hop_table_len;
+	args[1] = s->hop_index;
+	put_unaligned_le32(s->hop_dwell_us - min_t(s64, remaining,
+						   s->hop_dwell_us),
+			   &args[2]);
+	put_unaligned_le32(s->hop_skip, &args[6]);
+	ret = si4455_link_xmit_ctrl(&s->link, SI4455_LINK_CTRL_HOP, args,
+				    sizeof(args));
+	if (ret <= 0)
+		return ret;
+
+	s->hop_sync_due = false;
+	s->hop_sync_count++;
+
+	return ret;
+}
+
+/*
+ * Takes over the channel, the phase and the skipped entries of the hop
+ * master, the frame was sent elapsed_us into the dwell and received
+ * since its sync word.
+ * Must be called with s->mutex held.
+ */
+static void si4455_hop_resync(struct si4455_port *s, u8 index,
+			      u32 elapsed_us, u32 skip)
+{
+	s64 airtime = ktime_us_delta(s->ist_time, s->rx_sync_time);
+
+	s->hop_skip = skip;
+	/* No sync detection of this frame, the interrupt time is used */
+	if (airtime < 0 || airtime >= s->hop_dwell_us)
+		airtime = 0;
+
+	elapsed_us += airtime;
+	if (elapsed_us >= s->hop_dwell_us)
+		return;
+
+	hrtimer_cancel(&s->hop_timer);
+	s->hop_index = index;
+	s->hop_next_time = ktime_add_us(s->ist_time,
+					s->hop_dwell_us - elapsed_us);
+	hrtimer_start(&s->hop_timer, s->hop_next_time, HRTIMER_MODE_ABS);
+	s->hop_sync_count++;
+}
+
+/*
+ * In time slotted mode the gateway transmits in its slots only and
+ * the followers only reply to the gateway.
+ */
+static int si4455_link_schedule(struct si4455_port *s)
+{
+	int ret;
+
+	if (s->bond_count) {
+		si4455_bond_kick(s);
+		if (!si4455_bond_healthy(s))
+			return 0;
+	}
+
+	if (s->hop_sync_due && si4455_hop_active(s)) {
+		ret = si4455_hop_sync(s);
+		if (ret)
+			return ret < 0 ? ret : 0;
+	}
+
+	if (si4455_tdma_gateway(s))
+		return s->tdma_xmit_due ? si4455_tdma_xmit(s) : 0;
+
+	if (si4455_tdma_follower(s))
+		return si4455_tdma_reply(s);
+
+	return si4455_link_xmit(s);
+}
+
+/*
+ * Test packet: magic, sequence number, packet count and a pattern
+ * depending on the sequence number.
+ */
+static void si4455_per_packet(u8 *data, u32 length, u16 seq, u16 count)
+{
+	u32 i;
+
+	put_unaligned_be16(SI4455_PER_MAGIC, &data[0]);
+	put_unaligned_be16(seq, &data[2]);
+	put_unaligned_be16(count, &data[4]);
+	for (i = SI4455_PER_HDR_SIZE; i < length; i++)
+		data[i] = (u8)(i * 0x1D + seq);
+}
+
+/*
+ * Sends the next test packet, paced by per_interval_us.
+ * Must be called with s->mutex held.
+ */
+static int si4455_per_xmit(struct si4455_port *s)
+{
+	struct si4455_per_stats *per = &s->per_stats;
+	u32 length = si4455_payload_max(s);
+	u8 data[SI4455_FIFO_SIZE];
+	int ret;
+
+	if (per->sent >= s->per_count || hrtimer_active(&s->per_timer))
+		return 0;
+
+	if (length < SI4455_PER_HDR_SIZE)
+		return -EINVAL;
+
+	si4455_per_packet(data, length, per->sent, s->per_count);
+	ret = si4455_xmit_packet(s, data, length);
+	if (ret <= 0)
+		return ret;
+
+	per->sent++;
+	per->count = s->per_count;
+	if (per->sent == s->per_count)
+		sysfs_notify(&s->port.dev->kobj, NULL, "per_stats");
+	else if (s->per_interval_us)
+		hrtimer_start(&s->per_timer, us_to_ktime(s->per_interval_us),
+			      HRTIMER_MODE_REL);
+
+	return 0;
+}
+
+/*
+ * Must be called with s->mutex held.
+ */
+static void si4455_per_rx(struct si4455_port *s, const u8 *data, u32 length,
+			  bool crc_error)
+{
+	struct si4455_per_stats *per = &s->per_stats;
+	u8 expected[SI4455_FIFO_SIZE];
+	u8 rssi = s->current_rssi;
+	u32 bits = 0;
+	u16 seq;
+	u32 i;
+
+	if (crc_error) {
+		per->crc_error++;
+		return;
+	}
+
+	/* FEC parity is not compared */
+	length = min(length, si4455_payload_max(s));
+	if (length < SI4455_PER_HDR_SIZE ||
+	    get_unaligned_be16(&data[0]) != SI4455_PER_MAGIC) {
+		per->other++;
+		return;
+	}
+
+	seq = get_unaligned_be16(&data[2]);
+	if (per->received && seq <= per->last_seq) {
+		per->duplicate++;
+		return;
+	}
+
+	per->count = get_unaligned_be16(&data[4]);
+	per->last_seq = seq;
+	if (!per->received || rssi < per->rssi_min)
+		per->rssi_min = rssi;
+	if (!per->received || rssi > per->rssi_max)
+		per->rssi_max = rssi;
+	per->rssi_sum += rssi;
+	per->received++;
+
+	si4455_per_packet(expected, length, seq, per->count);
+	for (i = SI4455_PER_HDR_SIZE; i < length; i++)
+		bits += hweight8(data[i] ^ expected[i]);
+	if (bits) {
+		per->bit_error++;
+		per->bit_errors += bits;
+	} else {
+		per->good++;
+	}
+}
+
+static enum hrtimer_restart si4455_per_event(struct hrtimer *t)
+{
+	struct si4455_port *s = container_of(t, struct si4455_port, per_timer);
+
+	schedule_work(&s->tx_work);
+
+	return HRTIMER_NORESTART;
+}
+
+static int si4455_start_tx_xmit(struct uart_port *port)
+{
+	int ret;
+	struct si4455_port *s = dev_get_drvdata(port->dev);
+	struct circ_buf *xmit = &port->state->xmit;
+	u32 tx_pending;
+	u8 data[SI4455_FIFO_SIZE];
+
+	if (s->link.tx_stopped)
+		return 0;
+
+	/* The FEC parity fills the packet */
+	if (si4455_payload_max(s) == 0)
+		return 0;
+
+	tx_pending = uart_circ_chars_pending(xmit);
+	if (tx_pending == 0 ||
+	    (s->package_size != 0 && tx_pending < si4455_payload_max(s)))
+		return 0;
+
+	tx_pending = min(tx_pending, si4455_payload_max(s));
+	si4455_xmit_copy(xmit, data, tx_pending);
+
+	ret = si4455_xmit_packet(s, data, tx_pending);
+	if (ret > 0)
+		s->tx_pending_size = tx_pending;
+
+	return ret < 0 ? ret : 0;
+}
+
+static int si4455_cancel_tx(struct uart_port *port)
+{
+	int ret = 0;
+	struct si4455_port *s = dev_get_drvdata(port->dev);
+
+	if (s->tx_pending) {
+		si4455_end_tx(port);
+		s->tx_pending = false;
+		s->tx_pending_size = 0;
+		si4455_link_tx_end(s, false);
+		if (s->tdma_tx) {
+			s->tdma_tx = false;
+			si4455_tdma_window(s, ktime_get());
+		}
+		uart_handle_cts_change(&s->port, TIOCM_CTS);
+		ret = si4455_change_state(port, SI4455_CMD_CHANGE_STATE_STATE_SLEEP);
+	}
+	return ret;
+}
+
+static int si4455_do_work(struct uart_port *port)
+{
+	int ret = 0;
+	struct si4455_port *s = dev_get_drvdata(port->dev);
+	struct circ_buf *xmit = &port->state->xmit;
+
+	mutex_lock(&s->mutex);
+	if (!s->suspended && s->connected && s->configured && s->power_count > 0) {
+		/* Profile or properties changed during a transmission */
+		if (s->profile_pending && !s->tx_pending) {
+			ret = si4455_profile_switch(s, s->profile_next);
+			if (ret) {
+				mutex_unlock(&s->mutex);
+				return ret;
+			}
+		}
+
+		if (s->props_pending && !s->tx_pending) {
+			ret = si4455_props_apply(s);
+			if (ret) {
+				mutex_unlock(&s->mutex);
+				return ret;
+			}
+		}
+
+		if (s->scan_irq != si4455_modem_irq_needed(s)) {
+			ret = si4455_scan_irq(s, !s->scan_irq);
+			if (ret) {
+				mutex_unlock(&s->mutex);
+				return ret;
+			}
+		}
+
+		if (s->survey_active) {
+			/* The radio listens on the surveyed channel */
+		} else if (s->per_mode != SI4455_PER_OFF) {
+			if (s->per_mode == SI4455_PER_TX &&
+			    !(s->tx_pending || s->csma_deferred))
+				ret = si4455_per_xmit(s);
+		} else if (s->bond_master) {
+			if (!(s->bond_rx_only || s->tx_pending || s->csma_deferred))
+				ret = si4455_bond_xmit(s);
+		} else if (si4455_link_enabled(s)) {
+			if (!(s->tx_pending || s->csma_deferred))
+				ret = si4455_link_schedule(s);
+		} else if (!(uart_circ_empty(xmit) || uart_tx_stopped(port) ||
+			     s->tx_pending || s->csma_deferred)) {
+			ret = si4455_start_tx_xmit(port);
+		}
+
+		/*
+		 * In full duplex mode the paired radio receives
+		 */
+		if (!ret && !s->tx_pending && !s->duplex_rx)
+			ret = si4455_begin_rx(port, si4455_get_rx_channel(s),
+					      s->package_size);
+	}
+	mutex_unlock(&s->mutex);
+	return ret;
+}
+
+static void si4455_rx_deliver(struct si4455_link *link, const u8 *data,
+			      u32 length)
+{
+	struct uart_port *port = link->port;
+	u32 i;
+
+	if (length == 0)
+		return;
+
+	if (link->s->rx_stopped || link->rx_stopped ||
+	    !tty_port_initialized(&port->state->port)) {
+		link->s->stats.rx_drop_count++;
+		return;
+	}
+
+	for (i = 0; i < length; i++) {
+		uart_insert_char(port, 0, 0, data[i], TTY_NORMAL);
+		port->icount.rx++;
+	}
+	tty_flip_buffer_push(&port->state->port);
+}
+
+static void si4455_link_deliver(struct si4455_link *link, u8 flags,
+				const u8 *data, u32 length)
+{
+	struct si4455_port *s = link->s;
+	size_t unzlength = sizeof(s->link_unzmsg);
+	ktime_t start;
+	int ret;
+
+	if (!(flags & SI4455_LINK_FLAG_COMP)) {
+		si4455_rx_deliver(link, data, length);
+		return;
+	}
+
+	start = ktime_get();
+	ret = lzo1x_decompress_safe(data, length, s->link_unzmsg, &unzlength);
+	s->comp_stats.decompress_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+	if (ret != LZO_E_OK) {
+		dev_dbg(s->port.dev, "%s: lzo1x_decompress_safe error (%i)\n",
+			__func__, ret);
+		s->comp_stats.error_count++;
+		return;
+	}
+
+	s->comp_stats.decompressed_count++;
+	si4455_rx_deliver(link, s->link_unzmsg, unzlength);
+}
+
+static void si4455_link_reasm_drop(struct si4455_link *link, bool timeout)
+{
+	if (timeout)
+		link->s->frag_stats.timeout_count++;
+	else
+		link->s->frag_stats.drop_count++;
+	link->reasm_active = false;
+}
+
+/*
+ * Joins the fragments and pushes the complete message to the tty at once.
+ */
+static void si4455_link_reasm(struct si4455_link *link,
+			      const struct si4455_link_hdr *hdr, const u8 *data)
+{
+	struct si4455_port *s = link->s;
+
+	if (!s->mtu) {
+		si4455_link_deliver(link, hdr->flags, data, hdr->len);
+		return;
+	}
+
+	if (link->reasm_active) {
+		if (time_after(jiffies, link->reasm_start +
+			       msecs_to_jiffies(s->reasm_timeout_ms)))
+			si4455_link_reasm_drop(link, true);
+		else if (hdr->seq != link->reasm_seq ||
+			 (hdr->flags & SI4455_LINK_FLAG_FIRST))
+			si4455_link_reasm_drop(link, false);
+	}
+
+	if (hdr->flags & SI4455_LINK_FLAG_FIRST) {
+		link->reasm_active = true;
+		link->reasm_length = 0;
+		link->reasm_start = jiffies;
+		link->reasm_flags = hdr->flags;
+	} else if (!link->reasm_active) {
+		s->frag_stats.drop_count++;
+		return;
+	}
+
+	if (link->reasm_length + hdr->len > SI4455_LINK_MTU_MAX) {
+		si4455_link_reasm_drop(link, false);
+		return;
+	}
+
+	memcpy(&link->reasm_buf[link->reasm_length], data, hdr->len);
+	link->reasm_length += hdr->len;
+	link->reasm_seq = hdr->seq + 1;
+	if (hdr->flags & SI4455_LINK_FLAG_LAST) {
+		si4455_link_deliver(link, link->reasm_flags, link->reasm_buf,
+				    link->reasm_length);
+		s->frag_stats.message_rx_count++;
+		link->reasm_active = false;
+	}
+}
+
+/*
+ * Selects the link of the received frame by its source address,
+ * frames of nodes without remote port go to the main port.
+ */
+static struct si4455_link *si4455_link_demux(struct si4455_port *s,
+					     const struct si4455_link_hdr *hdr)
+{
+	struct si4455_link *link;
+
+	if (!s->address)
+		return &s->link;
+
+	if (!(hdr->flags & SI4455_LINK_FLAG_ADDR)) {
+		s->addr_stats.unaddressed_count++;
+		return NULL;
+	}
+
+	if (hdr->dst != s->address && hdr->dst != SI4455_ADDR_BROADCAST) {
+		s->addr_stats.foreign_count++;
+		return NULL;
+	}
+
+	link = si4455_link_find(s, hdr->src);
+	if (link)
+		return link;
+
+	s->addr_stats.unknown_count++;
+
+	return &s->link;
+}
+
+static void si4455_link_ctrl(struct si4455_port *s, struct si4455_link *link,
+			     const struct si4455_link_hdr *hdr, const u8 *data)
+{
+	u32 cycle_us;
+
+	if (hdr->len == 0)
+		return;
+
+	switch (data[0]) {
+	case SI4455_LINK_CTRL_BEACON:
+		if (hdr->len < 6 || si4455_tdma_gateway(s))
+			break;
+
+		/*
+		 * Followers stay synchronized for a few cycles,
+		 * then the link falls back to free transmission
+		 */
+		cycle_us = (data[1] + 1) * get_unaligned_le32(&data[2]);
+		s->tdma_gateway = hdr->src;
+		s->tdma_sync_end = jiffies +
+			usecs_to_jiffies(SI4455_TDMA_SYNC_CYCLES * cycle_us) +
+			msecs_to_jiffies(SI4455_TDMA_SYNC_MIN_MS);
+		s->tdma_stats.beacon_count++;
+		break;
+	case SI4455_LINK_CTRL_POLL:
+		break;
+	case SI4455_LINK_CTRL_RSSI:
+		if (hdr->len < 4)
+			break;
+
+		link->peer.tpc_peer = true;
+		link->peer.tpc_reported = true;
+		link->peer.tpc_report_time = jiffies;
+		link->peer.tpc_rssi = data[1];
+		link->peer.tpc_crc_permille = get_unaligned_le16(&data[2]);
+		s->tpc_stats.report_rx_count++;
+		s->tpc_stats.peer_rssi = data[1];
+		s->tpc_stats.peer_crc_permille = link->peer.tpc_crc_permille;
+		if (si4455_tpc_enabled(s))
+			si4455_tpc_update(s);
+		break;
+	case SI4455_LINK_CTRL_RATE:
+		/* The peers have to run the same bundle with adr enabled */
+		if (!s->adr || hdr->len < 3 || data[1] >= s->profile_count ||
+		    data[2] != s->profile_count)
+			break;
+
+		s->profile_next = data[1];
+		s->profile_pending = true;
+		s->adr_request_pending = false;
+		s->adr_verify = false;
+		s->adr_stats.rate_rx_count++;
+		break;
+	case SI4455_LINK_CTRL_HOP:
+		/* The peers have to run the same hop_table and dwell time */
+		if (!si4455_hop_active(s) || s->hop_master || hdr->len < 11 ||
+		    data[1] != s->hop_table_len || data[2] >= s->hop_table_len)
+			break;
+
+		si4455_hop_resync(s, data[2], get_unaligned_le32(&data[3]),
+				  get_unaligned_le32(&data[7]));
+		break;
+	default:
+		dev_dbg(s->port.dev, "%s: unknown control frame (%u)\n",
+			__func__, data[0]);
+		break;
+	}
+}
+
+/*
+ * Time slot bookkeeping of a received frame,
+ * the gateway moves to the next slot when the polled node replied,
+ * the follower gets the right to reply when the gateway addressed it.
+ */
+static void si4455_tdma_rx(struct si4455_port *s, struct si4455_link *link,
+			   const struct si4455_link_hdr *hdr)
+{
+	struct si4455_tdma_node_stats *stats = &link->tdma_stats;
+	u32 latency;
+
+	if (si4455_tdma_gateway(s)) {
+		if (s->tdma_slot == 0 || s->tdma_slot > s->remote_count ||
+		    s->tdma_xmit_due || s->tdma_tx ||
+		    s->tdma_replied || link != si4455_link_get(s, s->tdma_slot))
+			return;
+
+		latency = ktime_us_delta(s->ist_time, s->tdma_window_start);
+		stats->reply_count++;
+		stats->latency_us = stats->latency_us ?
+			(7 * stats->latency_us + latency) / 8 : latency;
+		stats->latency_max_us = max(stats->latency_max_us, latency);
+		s->tdma_replied = true;
+		if (hrtimer_try_to_cancel(&s->tdma_timer) == 1)
+			schedule_work(&s->tdma_work);
+	} else if (si4455_tdma_follower(s) && hdr->src == s->tdma_gateway &&
+		   hdr->dst == s->address) {
+		s->tdma_grant = link;
+		s->tdma_stats.grant_count++;
+	}
+}
+
+/*
+ * Keeps a frame received ahead of the expected one, frames of bonded
+ * radios or retransmissions may arrive out of order.
+ */
+static void si4455_link_reorder_store(struct si4455_link *link,
+				      const struct si4455_link_hdr *hdr,
+				      const u8 *data)
+{
+	struct si4455_link_rxframe *rxframe;
+
+	rxframe = &link->reorder[hdr->seq % SI4455_ARQ_WINDOW_MAX];
+	if (rxframe->valid && rxframe->hdr.seq == hdr->seq)
+		return;
+
+	rxframe->hdr = *hdr;
+	memcpy(rxframe->data, data, hdr->len);
+	rxframe->valid = true;
+}
+
+static void si4455_link_reorder_drain(struct si4455_link *link)
+{
+	struct si4455_link_peer *peer = &link->peer;
+	struct si4455_link_rxframe *rxframe;
+
+	for (;;) {
+		rxframe = &link->reorder[peer->rx_seq % SI4455_ARQ_WINDOW_MAX];
+		if (!rxframe->valid || rxframe->hdr.seq != peer->rx_seq)
+			break;
+
+		rxframe->valid = false;
+		si4455_link_reasm(link, &rxframe->hdr, rxframe->data);
+		link->s->arq_stats.reordered_count++;
+		peer->rx_seq++;
+	}
+}
+
+static void si4455_link_rx(struct si4455_port *s, const u8 *data, u32 length)
+{
+	struct si4455_link_peer *peer;
+	struct si4455_link *link;
+	struct si4455_link_hdr hdr;
+	int offset;
+	s8 diff;
+
+	offset = si4455_link_hdr_unpack(&hdr, data, length);
+	if (offset < 0) {
+		dev_dbg(s->port.dev, "%s: invalid link header\n", __func__);
+		return;
+	}
+
+	link = si4455_link_demux(s, &hdr);
+	if (!link)
+		return;
+
+	peer = &link->peer;
+	/* The members of a bond receive, the RSSI is theirs */
+	if (!s->bond_count) {
+		peer->tpc_rssi_sum += s->current_rssi;
+		peer->tpc_rssi_count++;
+		s->adr_rssi_sum += s->current_rssi;
+		s->adr_rssi_count++;
+	}
+
+	if (hdr.flags & SI4455_LINK_FLAG_ACK)
+		si4455_link_ack(link, hdr.ack);
+
+	if (hdr.flags & SI4455_LINK_FLAG_CTRL)
+		si4455_link_ctrl(s, link, &hdr, &data[offset]);
+
+	if (s->address)
+		si4455_tdma_rx(s, link, &hdr);
+
+	if (hdr.flags & SI4455_LINK_FLAG_CTRL)
+		return;
+
+	if (!(hdr.flags & SI4455_LINK_FLAG_SEQ)) {
+		if (hdr.len)
+			si4455_link_reasm(link, &hdr, &data[offset]);
+		return;
+	}
+
+	diff = (s8)(hdr.seq - peer->rx_seq);
+	/*
+	 * A retransmitted sync frame just behind the expected sequence
+	 * number is a duplicate, otherwise the peer restarted or dropped frames
+	 */
+	if (!peer->rx_synced ||
+	    ((hdr.flags & SI4455_LINK_FLAG_SYNC) &&
+	     !(diff < 0 && diff >= -SI4455_ARQ_WINDOW_MAX))) {
+		peer->rx_seq = hdr.seq;
+		peer->rx_synced = true;
+		memset(link->reorder, 0, sizeof(link->reorder));
+		diff = 0;
+	}
+
+	if (diff == 0) {
+		si4455_link_reasm(link, &hdr, &data[offset]);
+		peer->rx_seq++;
+		si4455_link_reorder_drain(link);
+	} else if (diff < 0) {
+		s->arq_stats.duplicate_count++;
+	} else {
+		s->arq_stats.out_of_order_count++;
+		if (diff < SI4455_ARQ_WINDOW_MAX)
+			si4455_link_reorder_store(link, &hdr, &data[offset]);
+	}
+
+	peer->ack_pending = true;
+	if (s->arq_ack_delay_us)
+		hrtimer_start(&link->ack_timer, us_to_ktime(s->arq_ack_delay_us),
+			      HRTIMER_MODE_REL);
+	else
+		link->ack_due = true;
+}
+
+static void si4455_bond_rx(struct si4455_port *radio, const u8 *data,
+			   u32 length)
+{
+	struct si4455_port *master = radio->bond_master;
+
+	mutex_lock(&master->mutex);
+	if (master->connected) {
+		if (si4455_link_enabled(master))
+			si4455_link_rx(master, data, length);
+		else
+			si4455_rx_deliver(&master->link, data, length);
+		radio->bond_stats.rx_frame_count++;
+	}
+	mutex_unlock(&master->mutex);
+	schedule_work(&master->tx_work);
+}
+
+static void si4455_handle_rx_pend(struct si4455_port *s,
+				  struct si4455_fifo_info *fifo_info,
+				  bool crc_error)
+{
+	struct uart_port *port = &s->port;
+	u8 *data;
+	int sret = 0;
+	u32 length;
+
+	length = (s->package_size == 0) ? fifo_info->rx_fifo_count : s->package_size;
+	if (length == 0 || length > SI4455_FIFO_SIZE)
+		return;
+
+	data = kzalloc(length, GFP_KERNEL);
+	if (!data)
+		return;
+
+	sret = si4455_end_rx(port, length, data);
+	if (!sret) {
+		s->stats.rx_bytes += length;
+		si4455_rate_add(&s->stats_rx_rate, length, s->ist_time);
+	}
+	trace_si4455_rx_drain(port->dev, s->rx_active_channel, length,
+			      s->current_rssi, crc_error, sret);
+	/*
+	 * The test measures the radio link, before FEC
+	 */
+	if (!sret && s->per_mode == SI4455_PER_RX) {
+		si4455_per_rx(s, data, length, crc_error);
+		kfree(data);
+		return;
+	}
+
+	if (!sret && s->fec_rs) {
+		sret = si4455_fec_decode(s, data, &length);
+		if (sret == -EBADMSG) {
+			s->fec_stats.check_error_count++;
+			dev_dbg(port->dev, "%s: payload CRC mismatch\n", __func__);
+			kfree(data);
+			return;
+		} else if (sret < 0) {
+			s->fec_stats.uncorrectable_count++;
+			dev_dbg(port->dev, "%s: uncorrectable packet (%i)\n",
+				__func__, sret);
+			kfree(data);
+			return;
+		}
+		if (sret > 0) {
+			s->fec_stats.corrected_count++;
+			s->fec_stats.symbol_count += sret;
+		}
+		if (crc_error && sret > 0)
+			s->fec_stats.crc_recovered_count++;
+		sret = 0;
+	}
+
+	if (sret) {
+		dev_err(port->dev, "%s: si4455_end_rx error (%i)\n",
+			__func__, sret);
+	} else if (s->bond_master) {
+		si4455_bond_rx(s, data, length);
+	} else if (si4455_link_enabled(s)) {
+		si4455_link_rx(s, data, length);
+	} else {
+		si4455_rx_deliver(&s->link, data, length);
+	}
+	if (!sret)
+		si4455_hist_add(&s->hists.irq_push_us,
+				ktime_us_delta(ktime_get(), s->ist_time));
+	kfree(data);
+}
+
+static const char * const si4455_event_names[SI4455_EVENT_COUNT] = {
+	"cts_recovery",
+	"tx_timeout",
+	"crc_error",
+	"chip_error",
+	"rssi_low",
+	"rssi_high",
+};
+
+/*
+ * Counts the event and wakes up the pollers of the events sysfs entry.
+ */
+static void si4455_event(struct si4455_port *s, u32 event)
+{
+	s->event_count[event]++;
+	sysfs_notify(&s->port.dev->kobj, NULL, "events");
+}
+
+static void si4455_rssi_check(struct si4455_port *s, u8 rssi)
+{
+	if (!s->rssi_threshold)
+		return;
+
+	if (!s->rssi_low && rssi < s->rssi_threshold) {
+		s->rssi_low = true;
+		si4455_event(s, SI4455_EVENT_RSSI_LOW);
+	} else if (s->rssi_low &&
+		   rssi >= s->rssi_threshold + SI4455_RSSI_HYSTERESIS) {
+		s->rssi_low = false;
+		si4455_event(s, SI4455_EVENT_RSSI_HIGH);
+	}
+}
+
+static void si4455_stats_rx_sample(struct si4455_port *s)
+{
+	struct si4455_link_stats *stats = &s->stats;
+	u8 rssi = s->modem_status.curr_rssi;
+	s16 afc = get_unaligned_be16(&s->modem_status.afc_freq_offset);
+
+	if (!stats->rssi_count || rssi < stats->rssi_min)
+		stats->rssi_min = rssi;
+	if (!stats->rssi_count || rssi > stats->rssi_max)
+		stats->rssi_max = rssi;
+	if (!stats->rssi_count || afc < stats->afc_min)
+		stats->afc_min = afc;
+	if (!stats->rssi_count || afc > stats->afc_max)
+		stats->afc_max = afc;
+	stats->rssi_last = rssi;
+	stats->afc_last = afc;
+	stats->rssi_count++;
+	s->stats_rssi_sum += rssi;
+	s->stats_afc_sum += afc;
+	ewma_si4455_rssi_add(&s->stats_rssi_ewma, rssi);
+	si4455_rssi_check(s, rssi);
+}
+
+static void si4455_handle_tx_pend(struct si4455_port *s)
+{
+	struct uart_port *port = &s->port;
+	struct circ_buf *xmit = &port->state->xmit;
+	ktime_t tx_request;
+	u32 sent;
+
+	if (s->tx_pending) {
+		s->tx_airtime_us = ktime_us_delta(ktime_get(), s->tx_start);
+		trace_si4455_tx_done(port->dev, s->tx_length, s->tx_airtime_us);
+		s->stats.tx_packet_count++;
+		s->stats.tx_bytes += s->tx_length;
+		si4455_rate_add(&s->stats_tx_rate, s->tx_length, s->ist_time);
+		tx_request = READ_ONCE(s->tx_request);
+		if (tx_request) {
+			si4455_hist_add(&s->hists.tx_latency_us,
+					ktime_us_delta(s->ist_time, tx_request));
+			WRITE_ONCE(s->tx_request, 0);
+		}
+		if (s->tx_pending_size) {
+			sent = s->tx_pending_size;
+			port->icount.tx += sent;
+			xmit->tail = (xmit->tail + sent) & (UART_XMIT_SIZE - 1);
+		} else {
+			si4455_link_tx_end(s, true);
+		}
+		if (s->tdma_tx) {
+			s->tdma_tx = false;
+			si4455_tdma_window(s, s->ist_time);
+		}
+		si4455_end_tx(port);
+		s->tx_pending = 0;
+		s->tx_pending_size = 0;
+		uart_handle_cts_change(&s->port, TIOCM_CTS);
+	}
+}
+
+static irqreturn_t si4455_ist(int irq, void *dev_id)
+{
+	struct si4455_port *s = (struct si4455_port *)dev_id;
+	struct uart_port *port = &s->port;
+	int ret;
+	struct si4455_int_status int_status = { 0 };
+	struct si4455_fifo_info fifo_info = { 0 };
+	bool have_to_do = false;
+	u32 packets = 0;
+
+	if (s->suspended || !s->connected || !s->configured || s->power_count == 0)
+		return IRQ_NONE;
+
+	mutex_lock(&s->mutex);
+	s->ist_time = ktime_get();
+	si4455_spi_window_start(s);
+	ret = si4455_get_int_status(port, 0, 0, 0, &int_status);
+	if (ret) {
+		mutex_unlock(&s->mutex);
+		return IRQ_NONE;
+	}
+
+	trace_si4455_irq(port->dev, int_status.int_pend, int_status.ph_pend,
+			 int_status.modem_pend, int_status.chip_pend,
+			 int_status.ph_status, int_status.modem_status,
+			 int_status.chip_status);
+	dev_dbg(port->dev, "%s: int_pend: 0x%x\n", __func__, int_status.int_pend);
+	dev_dbg(port->dev, "%s: int_status: 0x%x\n", __func__, int_status.int_status);
+	dev_dbg(port->dev, "%s: ph_pend: 0x%x\n", __func__, int_status.ph_pend);
+	dev_dbg(port->dev, "%s: ph_status: 0x%x\n", __func__, int_status.ph_status);
+	dev_dbg(port->dev, "%s: modem_pend: 0x%x\n", __func__, int_status.modem_pend);
+	dev_dbg(port->dev, "%s: modem_status: 0x%x\n", __func__, int_status.modem_status);
+	dev_dbg(port->dev, "%s: chip_pend: 0x%x\n", __func__, int_status.chip_pend);
+	dev_dbg(port->dev, "%s: chip_status: 0x%x\n", __func__, int_status.chip_status);
+
+	if (s->scan_irq) {
+		/*
+		 * Stay on the scanned or hopped channel from preamble/sync
+		 * detection until the packet handling below or an invalid
+		 * preamble/sync.
+		 */
+		if (int_status.modem_pend
+		    & (SI4455_CMD_GET_INT_STATUS_SYNC_DETECT_BIT
+		       | SI4455_CMD_GET_INT_STATUS_PREAMBLE_DETECT_BIT)) {
+			s->scan_locked = si4455_scan_active(s);
+			s->hop_locked = si4455_hop_active(s);
+		}
+		if (int_status.modem_pend
+		    & SI4455_CMD_GET_INT_STATUS_SYNC_DETECT_BIT)
+			s->rx_sync_time = s->ist_time;
+		if (int_status.modem_pend
+		    & (SI4455_CMD_GET_INT_STATUS_INVALID_PREAMBLE_BIT
+		       | SI4455_CMD_GET_INT_STATUS_INVALID_SYNC_BIT)) {
+			s->scan_locked = false;
+			s->hop_locked = false;
+		}
+	}
+
+	if (int_status.chip_pend & SI4455_CMD_GET_INT_STATUS_FIFO_UO_BIT)
+		s->stats.fifo_error_count++;
+
+	if (int_status.chip_pend & SI4455_CMD_GET_CHIP_STATUS_ERROR_PEND_BIT) {
+		dev_err(port->dev, "%s: chip_pend:CMD_ERROR_PEND\n", __func__);
+		s->stats.chip_error_count++;
+		si4455_event(s, SI4455_EVENT_CHIP_ERROR);
+		si4455_change_state(port, SI4455_CMD_CHANGE_STATE_STATE_SLEEP);
+		si4455_fifo_info(&s->port, SI4455_CMD_FIFO_INFO_ARG_RX_BIT,
+				 &fifo_info);
+		/* The packet events are lost with the reset state */
+		int_status.ph_pend = 0;
+		have_to_do = true;
+	}
+
+	/*
+	 * A packet may be received before the PACKET_SENT interrupt
+	 * is serviced, both are handled then.
+	 */
+	if (int_status.ph_pend & SI4455_CMD_GET_INT_STATUS_PACKET_SENT_PEND_BIT) {
+		dev_dbg(port->dev, "%s: ph_pend:PACKET_SENT_PEND\n", __func__);
+		si4455_change_state(port, SI4455_CMD_CHANGE_STATE_STATE_SLEEP);
+		if (s->tx_pending)
+			si4455_spi_cost_add(s, &s->spi_tx_cost,
+					    s->spi_tx_xfers +
+					    s->spi_window_xfers,
+					    s->spi_tx_bytes +
+					    s->spi_window_bytes);
+		si4455_handle_tx_pend(s);
+		packets++;
+		have_to_do = true;
+	}
+
+	if (int_status.ph_pend & SI4455_CMD_GET_INT_STATUS_PACKET_RX_PEND_BIT) {
+		dev_dbg(port->dev, "%s: ph_pend:PACKET_RX_PEND\n", __func__);
+		si4455_get_modem_status(port, 0, &s->modem_status);
+		s->current_rssi = s->modem_status.curr_rssi;
+		s->rx_last_channel = s->rx_active_channel;
+		s->stats.rx_packet_count++;
+		si4455_stats_rx_sample(s);
+		if (si4455_scan_active(s)) {
+			s->scan_hits[s->scan_index]++;
+			s->scan_locked = false;
+		}
+		s->hop_locked = false;
+		si4455_change_state(port, SI4455_CMD_CHANGE_STATE_STATE_SLEEP);
+		si4455_fifo_info(port, 0, &fifo_info);
+		si4455_handle_rx_pend(s, &fifo_info, false);
+		si4455_spi_cost_add(s, &s->spi_rx_cost, s->spi_window_xfers,
+				    s->spi_window_bytes);
+		packets++;
+		have_to_do = true;
+	} else if (int_status.ph_pend & SI4455_CMD_GET_INT_STATUS_CRC_ERROR_BIT) {
+		dev_dbg(port->dev, "%s: ph_pend:CRC_ERROR_PEND\n", __func__);
+		s->stats.crc_error_count++;
+		si4455_event(s, SI4455_EVENT_CRC_ERROR);
+		s->scan_locked = false;
+		s->hop_locked = false;
+		/* With FEC the packet is read and counted below */
+		if (s->per_mode == SI4455_PER_RX && !s->fec_rs)
+			s->per_stats.crc_error++;
+		if (s->fec_rs) {
+			/*
+			 * The packet may still be correctable,
+			 * read it before the RX FIFO is reset.
+			 */
+			si4455_fifo_info(port, 0, &fifo_info);
+			si4455_handle_rx_pend(s, &fifo_info, true);
+		}
+		packets++;
+		si4455_change_state(port, SI4455_CMD_CHANGE_STATE_STATE_SLEEP);
+		si4455_fifo_info(&s->port, SI4455_CMD_FIFO_INFO_ARG_RX_BIT,
+				 &fifo_info);
+		have_to_do = true;
+	}
+	si4455_hist_add(&s->hists.irq_packets, packets);
+	mutex_unlock(&s->mutex);
+	if (have_to_do)
+		si4455_do_work(port);
+	return IRQ_HANDLED;
+}
+
+static void si4455_tx_wd_event(struct timer_list *t)
+{
+	struct si4455_port *s = from_timer(s, t, tx_wd_timer);
+
+	if (s->tx_pending)
+		schedule_work(&s->tx_wd_work);
+}
+
+static void si4455_tx_wd_proc(struct work_struct *ws)
+{
+	struct si4455_port *s = container_of(ws, struct si4455_port, tx_wd_work);
+	bool have_to_work = false;
+
+	mutex_lock(&s->mutex);
+	if (s->connected && s->tx_pending) {
+		si4455_cancel_tx(&s->port);
+		s->tx_error_count++;
+		trace_si4455_recovery(s->port.dev, "tx_timeout", 0);
+		si4455_event(s, SI4455_EVENT_TX_TIMEOUT);
+		have_to_work = true;
+		dev_err(s->port.dev,
+			"%s: curent transmit operation interrupted by wd timeout\n",
+			__func__);
+	}
+	mutex_unlock(&s->mutex);
+
+	if (have_to_work)
+		si4455_do_work(&s->port);
+}
+
+static void si4455_cts_wd_event(struct timer_list *t)
+{
+	struct si4455_port *s = from_timer(s, t, cts_wd_timer);
+
+	if (s->cts_error)
+		schedule_work(&s->cts_wd_work);
+	else
+		mod_timer(&s->cts_wd_timer, jiffies + msecs_to_jiffies(100));
+}
+
+static void si4455_cts_wd_proc(struct work_struct *ws)
+{
+	struct si4455_port *s = container_of(ws, struct si4455_port, cts_wd_work);
+	bool have_to_work = false;
+	int ret;
+
+	mutex_lock(&s->mutex);
+	if (s->cts_error) {
+		dev_err(s->port.dev, "%s: interface recovery\n", __func__);
+		si4455_s_power(s->port.dev, false);
+		ret = si4455_re_configure(&s->port);
+		if (ret) {
+			dev_err(s->port.dev, "%s: device configuration error (%i)\n",
+				__func__, ret);
+		}
+		trace_si4455_recovery(s->port.dev, "cts_error", ret);
+		si4455_event(s, SI4455_EVENT_CTS_RECOVERY);
+		have_to_work = !ret;
+	}
+	if (s->connected)
+		mod_timer(&s->cts_wd_timer, jiffies + msecs_to_jiffies(100));
+	mutex_unlock(&s->mutex);
+
+	if (have_to_work)
+		si4455_do_work(&s->port);
+}
+
+static enum hrtimer_restart si4455_hop_event(struct hrtimer *t)
+{
+	struct si4455_port *s = container_of(t, struct si4455_port, hop_timer);
+
+	schedule_work(&s->hop_work);
+	hrtimer_forward_now(t, us_to_ktime(s->hop_dwell_us));
+
+	return HRTIMER_RESTART;
+}
+
+static bool si4455_survey_busy(struct si4455_port *s, u8 channel)
+{
+	u32 i;
+
+	if (!s->survey_busy_permille)
+		return false;
+
+	for (i = 0; i < s->survey_results_len; i++) {
+		if (s->survey_results[i].channel == channel)
+			return s->survey_results[i].occupancy_permille >
+			       s->survey_busy_permille;
+	}
+
+	return false;
+}
+
+/*
+ * The hop master skips the channels found busy by its last survey and
+ * announces the skipped entries, the followers skip the announced ones.
+ * Must be called with s->mutex held.
+ */
+static void si4455_hop_skip_update(struct si4455_port *s)
+{
+	u32 i;
+
+	if (!s->hop_master)
+		return;
+
+	s->hop_skip = 0;
+	for (i = 0; i < s->hop_table_len; i++) {
+		if (si4455_survey_busy(s, s->hop_table[i]))
+			s->hop_skip |= BIT(i);
+	}
+}
+
+static bool si4455_hop_skipped(struct si4455_port *s, u8 channel)
+{
+	u32 i;
+
+	for (i = 0; i < s->hop_table_len; i++) {
+		if (s->hop_table[i] == channel && (s->hop_skip & BIT(i)))
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * The next channel of the hop table, the skipped entries are passed
+ * while a free one is left.
+ */
+static u32 si4455_hop_next(struct si4455_port *s)
+{
+	u32 index = s->hop_index;
+	u32 i;
+
+	for (i = 0; i < s->hop_table_len; i++) {
+		index = (index + 1) % s->hop_table_len;
+		if (!(s->hop_skip & BIT(index)))
+			return index;
+	}
+
+	return (s->hop_index + 1) % s->hop_table_len;
+}
+
+static int si4455_u8_cmp(const void *a, const void *b)
+{
+	return *(const u8 *)a - *(const u8 *)b;
+}
+
+/*
+ * Samples above the busy threshold occupy the channel: csma_threshold
+ * if set, otherwise the lowest noise floor of the survey plus a margin.
+ * Must be called with s->mutex held.
+ */
+static void si4455_survey_finish(struct si4455_port *s)
+{
+	struct si4455_survey_result *result;
+	u32 samples = s->survey_samples;
+	u32 threshold = U8_MAX;
+	u32 busy;
+	u32 i;
+	u32 j;
+
+	for (i = 0; i < s->survey_table_len; i++) {
+		result = &s->survey_results[i];
+		sort(s->survey_rssi[i], samples, 1, si4455_u8_cmp, NULL);
+		result->channel = s->survey_table[i];
+		result->noise_floor = s->survey_rssi[i][samples / 10];
+		result->median = s->survey_rssi[i][samples / 2];
+		result->max = s->survey_rssi[i][samples - 1];
+		threshold = min_t(u32, threshold, result->noise_floor);
+	}
+
+	if (s->csma_threshold)
+		threshold = s->csma_threshold;
+	else
+		threshold = min_t(u32, threshold + SI4455_SURVEY_MARGIN,
+				  U8_MAX);
+
+	for (i = 0; i < s->survey_table_len; i++) {
+		busy = 0;
+		for (j = 0; j < samples; j++)
+			busy += s->survey_rssi[i][j] >= threshold;
+		s->survey_results[i].occupancy_permille = busy * 1000 / samples;
+	}
+
+	s->survey_results_len = s->survey_table_len;
+	s->survey_threshold = threshold;
+	s->survey_active = false;
+	si4455_hop_skip_update(s);
+	hrtimer_cancel(&s->survey_timer);
+	sysfs_notify(&s->port.dev->kobj, NULL, "survey");
+}
+
+static void si4455_hop_proc(struct work_struct *ws)
+{
+	struct si4455_port *s = container_of(ws, struct si4455_port, hop_work);
+	bool have_to_work = false;
+
+	mutex_lock(&s->mutex);
+	if (s->connected && si4455_hop_active(s)
+	    && !ktime_before(ktime_get(), s->hop_next_time)) {
+		/* A late work catches up, a resync moves the boundary ahead */
+		do {
+			s->hop_index = si4455_hop_next(s);
+			s->hop_count++;
+			s->hop_next_time = ktime_add_us(s->hop_next_time,
+							s->hop_dwell_us);
+		} while (!ktime_before(ktime_get(), s->hop_next_time));
+		s->hop_sync_due = s->hop_master;
+		/*
+		 * The current transmission finishes on its channel,
+		 * the next START_RX/START_TX carries the new one.
+		 * A packet being received is finished on its channel too,
+		 * its interrupt restarts the receiver on the new one.
+		 */
+		if (s->hop_locked
+		    && ++s->hop_lock_dwells < SI4455_HOP_LOCK_DWELLS) {
+			s->hop_deferred_count++;
+		} else {
+			s->hop_locked = false;
+			s->hop_lock_dwells = 0;
+			have_to_work = !s->tx_pending;
+		}
+	}
+	mutex_unlock(&s->mutex);
+
+	if (have_to_work)
+		si4455_do_work(&s->port);
+}
+
+/*
+ * Must be called with s->mutex held.
+ */
+static void si4455_hop_update(struct si4455_port *s)
+{
+	hrtimer_cancel(&s->hop_timer);
+	s->hop_locked = false;
+	s->hop_lock_dwells = 0;
+	s->hop_sync_due = s->hop_master;
+	/* The followers wait for the skipped entries of the new table */
+	s->hop_skip = 0;
+	si4455_hop_skip_update(s);
+	if (s->connected && si4455_hop_active(s)) {
+		s->hop_next_time = ktime_add_us(ktime_get(), s->hop_dwell_us);
+		hrtimer_start(&s->hop_timer, s->hop_next_time,
+			      HRTIMER_MODE_ABS);
+	}
+}
+
+static enum hrtimer_restart si4455_scan_event(struct hrtimer *t)
+{
+	struct si4455_port *s = container_of(t, struct si4455_port, scan_timer);
+
+	schedule_work(&s->scan_work);
+	hrtimer_forward_now(t, us_to_ktime(s->scan_dwell_us));
+
+	return HRTIMER_RESTART;
+}
+
+static void si4455_scan_proc(struct work_struct *ws)
+{
+	struct si4455_port *s = container_of(ws, struct si4455_port, scan_work);
+	bool have_to_work = false;
+
+	mutex_lock(&s->mutex);
+	if (s->connected && si4455_scan_active(s)
+	    && !(s->scan_locked
+		 && ++s->scan_lock_dwells < SI4455_SCAN_LOCK_DWELLS)) {
+		s->scan_locked = false;
+		s->scan_lock_dwells = 0;
+		s->scan_index = (s->scan_index + 1) % s->scan_table_len;
+		s->scan_visits[s->scan_index]++;
+		have_to_work = !s->tx_pending;
+	}
+	mutex_unlock(&s->mutex);
+
+	if (have_to_work)
+		si4455_do_work(&s->port);
+}
+
+/*
+ * Must be called with s->mutex held.
+ */
+static void si4455_scan_update(struct si4455_port *s)
+{
+	hrtimer_cancel(&s->scan_timer);
+	s->scan_locked = false;
+	s->scan_lock_dwells = 0;
+	if (s->connected && si4455_scan_active(s)) {
+		s->scan_visits[s->scan_index]++;
+		hrtimer_start(&s->scan_timer, us_to_ktime(s->scan_dwell_us),
+			      HRTIMER_MODE_REL);
+	}
+}
+
+static enum hrtimer_restart si4455_adr_event(struct hrtimer *t)
+{
+	struct si4455_port *s = container_of(t, struct si4455_port, adr_timer);
+
+	schedule_work(&s->adr_work);
+	hrtimer_forward_now(t, ms_to_ktime(SI4455_ADR_WINDOW_MS));
+
+	return HRTIMER_RESTART;
+}
+
+/*
+ * Evaluates the window: steps down to the previous(more robust) profile
+ * on CRC errors, retransmissions or low rssi, steps up to the next(faster)
+ * one if the rssi is high and the error ratios are below half of the
+ * limits. A radio hearing nothing for a few windows after the switch
+ * it requested returns to its previous profile, the peer may have missed
+ * the request. Quiet links without a requested switch are left alone.
+ */
+static void si4455_adr_proc(struct work_struct *ws)
+{
+	struct si4455_port *s = container_of(ws, struct si4455_port, adr_work);
+	bool have_to_work = false;
+	u32 crc_permille;
+	u32 retry_permille;
+	u32 retransmits;
+	u32 rssi_count;
+	u32 frames;
+	u32 rssi;
+	u32 crc;
+	u32 rx;
+	u32 next;
+
+	mutex_lock(&s->mutex);
+	if (!s->connected || !s->adr || s->profile_pending ||
+	    s->adr_request_pending || !si4455_adr_link(s))
+		goto out;
+
+	crc = s->stats.crc_error_count - s->adr_crc_base;
+	rx = s->stats.rx_packet_count - s->adr_rx_base;
+	frames = s->arq_stats.frame_count - s->adr_frame_base;
+	retransmits = s->arq_stats.retransmit_count - s->adr_retransmit_base;
+	rssi_count = s->adr_rssi_count;
+	rssi = rssi_count ? s->adr_rssi_sum / rssi_count : 0;
+	si4455_adr_reset(s);
+
+	if (s->adr_hold) {
+		s->adr_hold = false;
+		goto out;
+	}
+
+	if (!rssi_count && !crc) {
+		if (s->adr_verify &&
+		    ++s->adr_idle >= SI4455_ADR_FALLBACK_WINDOWS) {
+			s->adr_verify = false;
+			s->profile_next = s->adr_fallback;
+			s->profile_pending = true;
+			s->adr_stats.fallback_count++;
+			have_to_work = !s->tx_pending;
+		}
+		goto out;
+	}
+	s->adr_idle = 0;
+	/* The peer follows the requested profile */
+	s->adr_verify = false;
+
+	crc_permille = crc + rx ? crc * 1000 / (crc + rx) : 0;
+	retry_permille = frames + retransmits ?
+			 retransmits * 1000 / (frames + retransmits) : 0;
+
+	next = s->profile;
+	if (s->profile > 0 &&
+	    (crc_permille > s->adr_crc_permille ||
+	     retry_permille > s->adr_retry_permille ||
+	     rssi < s->adr_rssi_low)) {
+		next = s->profile - 1;
+	} else if (s->profile + 1 < s->profile_count &&
+		   rssi >= s->adr_rssi_high &&
+		   crc_permille <= s->adr_crc_permille / 2 &&
+		   retry_permille <= s->adr_retry_permille / 2) {
+		next = s->profile + 1;
+	}
+
+	/* The FEC parity has to fit into the packets of the profile */
+	if (next != s->profile &&
+	    !si4455_package_size_check(s, s->profiles[next].package_size)) {
+		if (next < s->profile)
+			s->adr_stats.down_count++;
+		else
+			s->adr_stats.up_count++;
+		s->adr_request = next;
+		s->adr_request_pending = true;
+		have_to_work = !s->tx_pending;
+	}
+out:
+	mutex_unlock(&s->mutex);
+
+	if (have_to_work)
+		si4455_do_work(&s->port);
+}
+
+/*
+ * Must be called with s->mutex held.
+ */
+static void si4455_adr_update(struct si4455_port *s)
+{
+	hrtimer_cancel(&s->adr_timer);
+	if (s->connected && s->adr) {
+		si4455_adr_reset(s);
+		s->adr_idle = 0;
+		s->adr_verify = false;
+		hrtimer_start(&s->adr_timer, ms_to_ktime(SI4455_ADR_WINDOW_MS),
+			      HRTIMER_MODE_REL);
+	}
+}
+
+static enum hrtimer_restart si4455_csma_event(struct hrtimer *t)
+{
+	struct si4455_port *s = container_of(t, struct si4455_port, csma_timer);
+
+	s->csma_deferred = false;
+	schedule_work(&s->tx_work);
+
+	return HRTIMER_NORESTART;
+}
+
+static enum hrtimer_restart si4455_arq_event(struct hrtimer *t)
+{
+	struct si4455_link *link = container_of(t, struct si4455_link, arq_timer);
+
+	link->arq_expired = true;
+	schedule_work(&link->s->arq_work);
+
+	return HRTIMER_NORESTART;
+}
+
+static void si4455_arq_proc(struct work_struct *ws)
+{
+	struct si4455_port *s = container_of(ws, struct si4455_port, arq_work);
+	struct si4455_link_frame *frame;
+	struct si4455_link *link;
+	bool have_to_work = false;
+	u32 i;
+
+	mutex_lock(&s->mutex);
+	for (i = 0; i <= s->remote_count; i++) {
+		link = si4455_link_get(s, i);
+		if (!link->arq_expired)
+			continue;
+
+		link->arq_expired = false;
+		if (!s->connected || link->tail == link->next)
+			continue;
+
+		frame = &link->queue[link->tail % SI4455_LINK_QUEUE_LEN];
+		if (frame->tx_count > s->arq_retries) {
+			dev_dbg(s->port.dev, "%s: frame(%u) dropped\n",
+				__func__, frame->seq);
+			link->tail++;
+			s->arq_stats.drop_count++;
+			link->peer.tx_sync = true;
+		}
+		/*
+		 * Go back N, restart from the oldest unacknowledged frame
+		 */
+		link->next = link->tail;
+		have_to_work = !s->tx_pending;
+	}
+	mutex_unlock(&s->mutex);
+
+	if (have_to_work)
+		si4455_do_work(&s->port);
+}
+
+static enum hrtimer_restart si4455_ack_event(struct hrtimer *t)
+{
+	struct si4455_link *link = container_of(t, struct si4455_link, ack_timer);
+
+	link->ack_due = true;
+	schedule_work(&link->s->tx_work);
+
+	return HRTIMER_NORESTART;
+}
+
+static enum hrtimer_restart si4455_tdma_event(struct hrtimer *t)
+{
+	struct si4455_port *s = container_of(t, struct si4455_port, tdma_timer);
+
+	schedule_work(&s->tdma_work);
+
+	return HRTIMER_NORESTART;
+}
+
+static void si4455_tdma_proc(struct work_struct *ws)
+{
+	struct si4455_port *s = container_of(ws, struct si4455_port, tdma_work);
+	bool have_to_work = false;
+
+	mutex_lock(&s->mutex);
+	if (s->connected && si4455_tdma_gateway(s) && !s->tdma_xmit_due &&
+	    !s->tdma_tx) {
+		if (s->tdma_slot) {
+			s->tdma_stats.slot_count++;
+			if (s->tdma_replied)
+				s->tdma_stats.slot_used_count++;
+		}
+		s->tdma_slot = (s->tdma_slot + 1) % (s->remote_count + 1);
+		if (s->tdma_slot == 0) {
+			s->tdma_stats.cycle_count++;
+			s->tdma_beacon_sent = false;
+		}
+		s->tdma_replied = false;
+		s->tdma_xmit_due = true;
+		have_to_work = !s->tx_pending;
+	}
+	mutex_unlock(&s->mutex);
+
+	if (have_to_work)
+		si4455_do_work(&s->port);
+}
+
+static void si4455_link_init(struct si4455_port *s, struct si4455_link *link,
+			     struct uart_port *port, u8 addr)
+{
+	link->s = s;
+	link->port = port;
+	link->addr = addr;
+	hrtimer_init(&link->arq_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	link->arq_timer.function = si4455_arq_event;
+	hrtimer_init(&link->ack_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	link->ack_timer.function = si4455_ack_event;
+	si4455_link_clear(link);
+}
+
+static void si4455_tx_proc(struct work_struct *ws)
+{
+	struct si4455_port *s = container_of(ws, struct si4455_port, tx_work);
+
+	si4455_do_work(&s->port);
+}
+
+static unsigned int si4455_tx_empty(struct uart_port *port)
+{
+	struct si4455_port *s = dev_get_drvdata(port->dev);
+
+	if (s->tx_pending || s->link.head != s->link.tail)
+		return 0;
+
+	return TIOCSER_TEMT;
+}
+
+static unsigned int si4455_get_mctrl(struct uart_port *port)
+{
+	int ret;
+	struct si4455_port *s = dev_get_drvdata(port->dev);
+
+	/*
+	 * there is no a continuous real "carrier" like on phone line,
+	 * but after configuration, the interface is ready to use the physical
+	 * transport channel
+	 */
+	ret = s->configured ? TIOCM_CAR | TIOCM_DSR : 0;
+	ret |= s->tx_pending ? 0 : TIOCM_CTS;
+
+	return ret;
+}
+
+static void si4455_set_mctrl(struct uart_port *port, unsigned int mctrl)
+{
+}
+
+static void si4455_set_termios(struct uart_port *port, struct ktermios *termios,
+			       struct ktermios *old)
+{
+	dev_dbg(port->dev, "termios->c_iflag = 0x%x", termios->c_iflag);
+	dev_dbg(port->dev, "termios->c_oflag = 0x%x", termios->c_oflag);
+	dev_dbg(port->dev, "termios->c_cflag = 0x%x", termios->c_cflag);
+	dev_dbg(port->dev, "termios->c_lflag = 0x%x", termios->c_lflag);
+	dev_dbg(port->dev, "termios->c_ispeed = %u", termios->c_ispeed);
+	dev_dbg(port->dev, "termios->c_ospeed = %u", termios->c_ospeed);
+	if ((termios->c_cflag & CSIZE) != CS8)
+		dev_err(port->dev, "%s: CSIZE must be CS8\n", __func__);
+}
+
+static int si4455_connect(struct si4455_port *s)
+{
+	mutex_lock(&s->mutex);
+	s->tx_pending = false;
+	s->link.tx_stopped = false;
+	s->rx_stopped = false;
+	s->csma_deferred = false;
+	s->csma_backoffs = 0;
+	si4455_link_reset(s);
+	s->connected = true;
+	mod_timer(&s->cts_wd_timer, jiffies + msecs_to_jiffies(100));
+	si4455_hop_update(s);
+	si4455_scan_update(s);
+	si4455_tdma_update(s);
+	si4455_adr_update(s);
+	mutex_unlock(&s->mutex);
+	return si4455_do_work(&s->port);
+}
+
+static void si4455_disconnect(struct si4455_port *s)
+{
+	mutex_lock(&s->mutex);
+	del_timer_sync(&s->tx_wd_timer);
+	del_timer_sync(&s->cts_wd_timer);
+	hrtimer_cancel(&s->hop_timer);
+	hrtimer_cancel(&s->scan_timer);
+	hrtimer_cancel(&s->csma_timer);
+	hrtimer_cancel(&s->tdma_timer);
+	hrtimer_cancel(&s->per_timer);
+	hrtimer_cancel(&s->survey_timer);
+	hrtimer_cancel(&s->adr_timer);
+	s->survey_active = false;
+	si4455_link_stop(s);
+	s->connected = false;
+	si4455_change_state(&s->port, SI4455_CMD_CHANGE_STATE_STATE_SLEEP);
+	mutex_unlock(&s->mutex);
+}
+
+static enum hrtimer_restart si4455_survey_event(struct hrtimer *t)
+{
+	struct si4455_port *s = container_of(t, struct si4455_port, survey_timer);
+
+	schedule_work(&s->survey_work);
+	hrtimer_forward_now(t, us_to_ktime(s->survey_interval_us));
+
+	return HRTIMER_RESTART;
+}
+
+/*
+ * Samples the RSSI of the surveyed channel, then moves to the next one.
+ */
+static void si4455_survey_proc(struct work_struct *ws)
+{
+	struct si4455_port *s = container_of(ws, struct si4455_port, survey_work);
+	struct si4455_modem_status modem_status;
+	bool have_to_work = false;
+	bool disconnect = false;
+
+	mutex_lock(&s->mutex);
+	if (!s->connected || !s->survey_active || s->tx_pending)
+		goto out;
+
+	if (si4455_get_modem_status(&s->port, 0, &modem_status))
+		goto out;
+
+	s->survey_rssi[s->survey_index][s->survey_sample++] =
+		modem_status.curr_rssi;
+	if (s->survey_sample < s->survey_samples)
+		goto out;
+
+	s->survey_sample = 0;
+	if (++s->survey_index == s->survey_table_len) {
+		s->survey_index = 0;
+		si4455_survey_finish(s);
+		disconnect = s->survey_connected;
+		s->survey_connected = false;
+	}
+	have_to_work = true;
+out:
+	mutex_unlock(&s->mutex);
+
+	if (disconnect)
+		si4455_disconnect(s);
+	else if (have_to_work)
+		si4455_do_work(&s->port);
+}
+
+/*
+ * The members of a bond are connected together with the tty of the master.
+ */
+static int si4455_startup(struct uart_port *port)
+{
+	struct si4455_port *s = dev_get_drvdata(port->dev);
+	u32 i;
+	int ret;
+
+	/* The radio is driven by its bond master, a PER test or a survey */
+	if (s->bond_master || s->per_connected || s->survey_connected)
+		return -EBUSY;
+
+	ret = si4455_connect(s);
+	mutex_lock(&si4455_bond_lock);
+	for (i = 0; i < s->bond_count; i++)
+		si4455_connect(s->bond_members[i]);
+	mutex_unlock(&si4455_bond_lock);
+
+	return ret;
+}
+
+static void si4455_shutdown(struct uart_port *port)
+{
+	struct si4455_port *s = dev_get_drvdata(port->dev);
+	u32 i;
+
+	mutex_lock(&si4455_bond_lock);
+	for (i = 0; i < s->bond_count; i++)
+		si4455_disconnect(s->bond_members[i]);
+	mutex_unlock(&si4455_bond_lock);
+	si4455_disconnect(s);
+}
+
+static const char *si4455_type(struct uart_port *port)
+{
+	struct si4455_port *s = dev_get_drvdata(port->dev);
+
+	if (port->type != PORT_SI4455)
+		return NULL;
+	if (s->part_info.rom_id == 3)
+		return "SI4455-B1A";
+	else if (s->part_info.rom_id == 6)
+		return "SI4455-C2A";
+
+	return "SI4455(UNKNOWN-REV)";
+}
+
+static void si4455_config_port(struct uart_port *port, int flags)
+{
+	if (flags & UART_CONFIG_TYPE)
+		port->type = PORT_SI4455;
+}
+
+static int si4455_verify_port(struct uart_port *port, struct serial_struct *s)
+{
+	if (s->type != PORT_UNKNOWN && s->type != PORT_SI4455)
+		return -EINVAL;
+
+	if (s->irq != port->irq)
+		return -EINVAL;
+
+	return 0;
+}
+
+static void si4455_start_tx(struct uart_port *port)
+{
+	struct si4455_port *s = container_of(port, struct si4455_port, port);
+
+	s->link.tx_stopped = false;
+	/* Called under the port lock, the IST clears it under s->mutex */
+	if (!READ_ONCE(s->tx_request))
+		WRITE_ONCE(s->tx_request, ktime_get());
+	schedule_work(&s->tx_work);
+}
+
+static void si4455_stop_tx(struct uart_port *port)
+{
+	struct si4455_port *s = container_of(port, struct si4455_port, port);
+
+	s->link.tx_stopped = true;
+}
+
+static void si4455_stop_rx(struct uart_port *port)
+{
+	struct si4455_port *s = container_of(port, struct si4455_port, port);
+
+	mutex_lock(&s->mutex);
+	s->rx_stopped = true;
+	si4455_change_state(&s->port, SI4455_CMD_CHANGE_STATE_STATE_SLEEP);
+	mutex_unlock(&s->mutex);
+}
+
+static const struct uart_ops si4455_ops = {
+	.tx_empty		= si4455_tx_empty,
+	/*
+	 * set_mctrl: required by serial_core, but not used
+	 */
+	.set_mctrl		= si4455_set_mctrl,
+	.get_mctrl		= si4455_get_mctrl,
+	.stop_tx		= si4455_stop_tx,
+	.start_tx		= si4455_start_tx,
+	.stop_rx		= si4455_stop_rx,
+	.startup		= si4455_startup,
+	.shutdown		= si4455_shutdown,
+	.set_termios		= si4455_set_termios,
+	.type			= si4455_type,
+	.config_port		= si4455_config_port,
+	.verify_port		= si4455_verify_port,
+};
+
+static unsigned int si4455_remote_tx_empty(struct uart_port *port)
+{
+	struct si4455_remote *r = container_of(port, struct si4455_remote, port);
+
+	if (r->link.head != r->link.tail)
+		return 0;
+
+	return TIOCSER_TEMT;
+}
+
+static unsigned int si4455_remote_get_mctrl(struct uart_port *port)
+{
+	struct si4455_remote *r = container_of(port, struct si4455_remote, port);
+
+	return r->link.s->configured ? TIOCM_CAR | TIOCM_DSR | TIOCM_CTS : 0;
+}
+
+static int si4455_remote_startup(struct uart_port *port)
+{
+	struct si4455_remote *r = container_of(port, struct si4455_remote, port);
+	struct si4455_port *s = r->link.s;
+
+	mutex_lock(&s->mutex);
+	si4455_link_clear(&r->link);
+	r->link.tx_stopped = false;
+	r->link.rx_stopped = false;
+	mutex_unlock(&s->mutex);
+
+	return 0;
+}
+
+static void si4455_remote_shutdown(struct uart_port *port)
+{
+	struct si4455_remote *r = container_of(port, struct si4455_remote, port);
+	struct si4455_port *s = r->link.s;
+
+	mutex_lock(&s->mutex);
+	r->link.tx_stopped = true;
+	r->link.rx_stopped = true;
+	hrtimer_cancel(&r->link.arq_timer);
+	hrtimer_cancel(&r->link.ack_timer);
+	mutex_unlock(&s->mutex);
+}
+
+static void si4455_remote_start_tx(struct uart_port *port)
+{
+	struct si4455_remote *r = container_of(port, struct si4455_remote, port);
+
+	r->link.tx_stopped = false;
+	schedule_work(&r->link.s->tx_work);
+}
+
+static void si4455_remote_stop_tx(struct uart_port *port)
+{
+	struct si4455_remote *r = container_of(port, struct si4455_remote, port);
+
+	r->link.tx_stopped = true;
+}
+
+static void si4455_remote_stop_rx(struct uart_port *port)
+{
+	struct si4455_remote *r = container_of(port, struct si4455_remote, port);
+
+	r->link.rx_stopped = true;
+}
+
+/*
+ * Remote ports share the radio of the main port,
+ * they carry data while the main port is open.
+ */
+static const struct uart_ops si4455_remote_ops = {
+	.tx_empty		= si4455_remote_tx_empty,
+	.set_mctrl		= si4455_set_mctrl,
+	.get_mctrl		= si4455_remote_get_mctrl,
+	.stop_tx		= si4455_remote_stop_tx,
+	.start_tx		= si4455_remote_start_tx,
+	.stop_rx		= si4455_remote_stop_rx,
+	.startup		= si4455_remote_startup,
+	.shutdown		= si4455_remote_shutdown,
+	.set_termios		= si4455_set_termios,
+	.type			= si4455_type,
+	.config_port		= si4455_config_port,
+	.verify_port		= si4455_verify_port,
+};
+
+static int si4455_remote_add(struct si4455_port *s, u8 addr)
+{
+	struct si4455_remote *r;
+	int line;
+	int ret;
+
+	line = si4455_line_get();
+	if (line == SI4455_UART_NRMAX)
+		return -ERANGE;
+
+	r = kzalloc(sizeof(*r), GFP_KERNEL);
+	if (!r) {
+		clear_bit(line, si4455_port_lines);
+		return -ENOMEM;
+	}
+
+	r->port.dev		= s->port.dev;
+	r->port.line		= line;
+	r->port.irq		= s->port.irq;
+	r->port.type		= PORT_SI4455;
+	r->port.fifosize	= SI4455_FIFO_SIZE;
+	r->port.flags		= UPF_FIXED_TYPE | UPF_LOW_LATENCY;
+	r->port.iotype		= UPIO_PORT;
+	r->port.iobase		= 1;
+	r->port.ops		= &si4455_remote_ops;
+	si4455_link_init(s, &r->link, &r->port, addr);
+	r->link.tx_stopped = true;
+	r->link.rx_stopped = true;
+
+	ret = uart_add_one_port(&si4455_uart, &r->port);
+	if (ret) {
+		clear_bit(line, si4455_port_lines);
+		kfree(r);
+		return ret;
+	}
+
+	mutex_lock(&s->mutex);
+	s->remotes[s->remote_count++] = r;
+	mutex_unlock(&s->mutex);
+
+	return 0;
+}
+
+static void si4455_remote_remove(struct si4455_remote *r)
+{
+	int line = r->port.line;
+
+	uart_remove_one_port(&si4455_uart, &r->port);
+	hrtimer_cancel(&r->link.arq_timer);
+	hrtimer_cancel(&r->link.ack_timer);
+	kfree(r);
+	clear_bit(line, si4455_port_lines);
+}
+
+/*
+ * Removes the remote ports not in the list and adds a remote port
+ * for every new address, ports of kept addresses stay open.
+ */
+static int si4455_remotes_set(struct si4455_port *s, const u8 *addrs, u32 len)
+{
+	struct si4455_remote *removed[SI4455_REMOTE_MAX];
+	struct si4455_remote *r;
+	u32 removed_count = 0;
+	u32 kept = 0;
+	bool exists;
+	u32 i;
+	int ret = 0;
+
+	mutex_lock(&s->remotes_lock);
+	mutex_lock(&s->mutex);
+	for (i = 0; i < s->remote_count; i++) {
+		r = s->remotes[i];
+		if (memchr(addrs, r->link.addr, len)) {
+			s->remotes[kept++] = r;
+			continue;
+		}
+
+		if (s->link_tx == &r->link) {
+			s->link_tx_frame = false;
+			s->link_tx = NULL;
+		}
+		if (s->tdma_grant == &r->link)
+			s->tdma_grant = NULL;
+		removed[removed_count++] = r;
+	}
+	s->remote_count = kept;
+	s->link_rr = 0;
+	mutex_unlock(&s->mutex);
+
+	for (i = 0; i < removed_count; i++)
+		si4455_remote_remove(removed[i]);
+
+	for (i = 0; i < len && !ret; i++) {
+		mutex_lock(&s->mutex);
+		exists = si4455_link_find(s, addrs[i]) != NULL;
+		mutex_unlock(&s->mutex);
+		if (!exists)
+			ret = si4455_remote_add(s, addrs[i]);
+	}
+	mutex_unlock(&s->remotes_lock);
+
+	return ret;
+}
+
+static int si4455_remotes_show(struct seq_file *m, void *v)
+{
+	struct si4455_port *s = m->private;
+	struct si4455_remote *r;
+	u32 i;
+
+	mutex_lock(&s->mutex);
+	for (i = 0; i < s->remote_count; i++) {
+		r = s->remotes[i];
+		seq_printf(m, "%u %s%u %u %u %u\n", r->link.addr,
+			   SI4455_DEV_NAME, r->port.line, r->port.icount.tx,
+			   r->port.icount.rx, r->link.head - r->link.tail);
+	}
+	mutex_unlock(&s->mutex);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(si4455_remotes);
+
+static int si4455_tdma_utilisation_show(struct seq_file *m, void *v)
+{
+	struct si4455_port *s = m->private;
+	u32 slots = s->tdma_stats.slot_count;
+
+	/*
+	 * Per mille of the poll slots the polled node replied in
+	 */
+	seq_printf(m, "%u\n", slots ?
+		   (u32)div_u64((u64)s->tdma_stats.slot_used_count * 1000, slots)
+		   : 0);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(si4455_tdma_utilisation);
+
+static int si4455_tdma_nodes_show(struct seq_file *m, void *v)
+{
+	struct si4455_tdma_node_stats *stats;
+	struct si4455_port *s = m->private;
+	u32 i;
+
+	mutex_lock(&s->mutex);
+	for (i = 0; i < s->remote_count; i++) {
+		stats = &s->remotes[i]->link.tdma_stats;
+		seq_printf(m, "%u %u %u %u %u\n", s->remotes[i]->link.addr,
+			   stats->poll_count, stats->reply_count,
+			   stats->latency_us, stats->latency_max_us);
+	}
+	mutex_unlock(&s->mutex);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(si4455_tdma_nodes);
+
+static int si4455_bond_members_show(struct seq_file *m, void *v)
+{
+	struct si4455_port *s = m->private;
+	struct si4455_port *member;
+	u32 i;
+
+	mutex_lock(&si4455_bond_lock);
+	for (i = 0; i < s->bond_count; i++) {
+		member = s->bond_members[i];
+		seq_printf(m, "%s%u %u %u %u %u\n", SI4455_DEV_NAME,
+			   member->port.line, member->bond_stats.tx_frame_count,
+			   member->bond_stats.rx_frame_count,
+			   member->bond_stats.fault_count,
+			   !time_before(jiffies, member->bond_holdoff_end));
+	}
+	mutex_unlock(&si4455_bond_lock);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(si4455_bond_members);
+
+static int si4455_hist_show(struct seq_file *m, void *v)
+{
+	struct si4455_hist *hist = m->private;
+	u64 low;
+	u32 i;
+
+	seq_printf(m, "count %u sum %llu max %u\n", hist->count,
+		   hist->sum, hist->max);
+	for (i = 0; i < SI4455_HIST_BUCKETS; i++) {
+		if (!hist->bucket[i])
+			continue;
+
+		low = i ? BIT_ULL(i - 1) : 0;
+		if (i == SI4455_HIST_BUCKETS - 1)
+			seq_printf(m, "%llu- %u\n", low, hist->bucket[i]);
+		else
+			seq_printf(m, "%llu-%llu %u\n", low,
+				   i ? BIT_ULL(i) - 1 : 0, hist->bucket[i]);
+	}
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(si4455_hist);
+
+static int si4455_hist_reset_set(void *data, u64 val)
+{
+	struct si4455_port *s = data;
+
+	mutex_lock(&s->mutex);
+	memset(&s->hists, 0, sizeof(s->hists));
+	mutex_unlock(&s->mutex);
+
+	return 0;
+}
+DEFINE_DEBUGFS_ATTRIBUTE(si4455_hist_reset_fops, NULL,
+			 si4455_hist_reset_set, "%llu\n");
+
+static int si4455_spi_cost_show(struct seq_file *m, void *v)
+{
+	struct si4455_port *s = m->private;
+	struct si4455_spi_cost *costs[] = { &s->spi_tx_cost, &s->spi_rx_cost };
+	const char * const names[] = { "tx", "rx" };
+	struct si4455_spi_cost *cost;
+	u32 i;
+
+	mutex_lock(&s->mutex);
+	for (i = 0; i < ARRAY_SIZE(costs); i++) {
+		cost = costs[i];
+		seq_printf(m, "%s packets %u xfers %llu bytes %llu last %u/%u max %u/%u budget %u over_budget %u\n",
+			   names[i], cost->packets, cost->xfers, cost->bytes,
+			   cost->last_xfers, cost->last_bytes,
+			   cost->max_xfers, cost->max_bytes,
+			   cost->budget, cost->over_budget);
+	}
+	mutex_unlock(&s->mutex);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(si4455_spi_cost);
+
+static int si4455_spi_reset_set(void *data, u64 val)
+{
+	struct si4455_port *s = data;
+	u32 tx_budget;
+	u32 rx_budget;
+
+	mutex_lock(&s->mutex);
+	tx_budget = s->spi_tx_cost.budget;
+	rx_budget = s->spi_rx_cost.budget;
+	memset(&s->spi_tx_cost, 0, sizeof(s->spi_tx_cost));
+	memset(&s->spi_rx_cost, 0, sizeof(s->spi_rx_cost));
+	s->spi_tx_cost.budget = tx_budget;
+	s->spi_rx_cost.budget = rx_budget;
+	s->spi_xfers = 0;
+	s->spi_bytes = 0;
+	mutex_unlock(&s->mutex);
+
+	return 0;
+}
+DEFINE_DEBUGFS_ATTRIBUTE(si4455_spi_reset_fops, NULL,
+			 si4455_spi_reset_set, "%llu\n");
+
+static int si4455_props_parse(const char __user *ubuf, size_t count,
+			      u8 *values, u32 max)
+{
+	char *tokens;
+	char *cur;
+	char *tok;
+	int n = 0;
+	int ret = 0;
+
+	tokens = memdup_user_nul(ubuf, count);
+	if (IS_ERR(tokens))
+		return PTR_ERR(tokens);
+
+	cur = tokens;
+	while ((tok = strsep(&cur, " ,\t\n")) != NULL) {
+		if (*tok == '\0')
+			continue;
+
+		if (n == max) {
+			ret = -E2BIG;
+			break;
+		}
+
+		ret = kstrtou8(tok, 0, &values[n]);
+		if (ret)
+			break;
+
+		n++;
+	}
+	kfree(tokens);
+
+	return ret ? ret : n;
+}
+
+static int si4455_props_show(struct seq_file *m, void *v)
+{
+	struct si4455_port *s = m->private;
+	struct si4455_property *prop;
+	u32 i;
+
+	mutex_lock(&s->mutex);
+	for (i = 0; i < s->props_len; i++) {
+		prop = &s->props[i];
+		seq_printf(m, "0x%02x 0x%02x 0x%02x\n", prop->group,
+			   prop->number, prop->value);
+	}
+	mutex_unlock(&s->mutex);
+
+	return 0;
+}
+
+static int si4455_props_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, si4455_props_show, inode->i_private);
+}
+
+/*
+ * Sets properties: "<group> <number> <value> [<value>...]"
+ */
+static ssize_t si4455_props_write(struct file *file, const char __user *ubuf,
+				  size_t count, loff_t *ppos)
+{
+	struct seq_file *m = file->private_data;
+	struct si4455_port *s = m->private;
+	u8 val[2 + SI4455_PROPERTY_COUNT_MAX];
+	int n;
+	int ret;
+
+	n = si4455_props_parse(ubuf, count, val, ARRAY_SIZE(val));
+	if (n < 0)
+		return n;
+
+	if (n < 3 || !si4455_property_valid(val[0], val[1], n - 2))
+		return -EINVAL;
+
+	mutex_lock(&s->mutex);
+	ret = si4455_props_store(s, val[0], val[1], n - 2, &val[2]);
+	if (ret)
+		goto out;
+
+	/* A transmission in progress is not disturbed */
+	if (s->configured && s->power_count > 0 && !s->tx_pending)
+		ret = si4455_set_property(&s->port, val[0], val[1], n - 2,
+					  &val[2]);
+	else
+		s->props_pending = true;
+out:
+	mutex_unlock(&s->mutex);
+	if (ret)
+		return ret;
+
+	/* RX restarts with the new properties */
+	schedule_work(&s->tx_work);
+
+	return count;
+}
+
+static const struct file_operations si4455_props_fops = {
+	.owner		= THIS_MODULE,
+	.open		= si4455_props_open,
+	.read		= seq_read,
+	.write		= si4455_props_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int si4455_props_get_show(struct seq_file *m, void *v)
+{
+	struct si4455_port *s = m->private;
+	u8 values[SI4455_PROPERTY_COUNT_MAX];
+	int ret = -ENODEV;
+	u32 i;
+
+	mutex_lock(&s->mutex);
+	if (s->configured && s->power_count > 0)
+		ret = si4455_get_property(&s->port, s->props_get_group,
+					  s->props_get_number,
+					  s->props_get_count, values);
+	if (!ret) {
+		for (i = 0; i < s->props_get_count; i++)
+			seq_printf(m, "0x%02x 0x%02x 0x%02x\n",
+				   s->props_get_group,
+				   s->props_get_number + i, values[i]);
+	}
+	mutex_unlock(&s->mutex);
+
+	return ret;
+}
+
+static int si4455_props_get_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, si4455_props_get_show, inode->i_private);
+}
+
+/*
+ * Selects the properties read: "<group> <number> [<count>]"
+ */
+static ssize_t si4455_props_get_write(struct file *file,
+				      const char __user *ubuf, size_t count,
+				      loff_t *ppos)
+{
+	struct seq_file *m = file->private_data;
+	struct si4455_port *s = m->private;
+	u8 val[3];
+	int n;
+
+	n = si4455_props_parse(ubuf, count, val, ARRAY_SIZE(val));
+	if (n < 0)
+		return n;
+
+	if (n == 2)
+		val[2] = 1;
+	if (n < 2 || !si4455_property_valid(val[0], val[1], val[2]))
+		return -EINVAL;
+
+	mutex_lock(&s->mutex);
+	s->props_get_group = val[0];
+	s->props_get_number = val[1];
+	s->props_get_count = val[2];
+	mutex_unlock(&s->mutex);
+
+	return count;
+}
+
+static const struct file_operations si4455_props_get_fops = {
+	.owner		= THIS_MODULE,
+	.open		= si4455_props_get_open,
+	.read		= seq_read,
+	.write		= si4455_props_get_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int si4455_props_reset_set(void *data, u64 val)
+{
+	struct si4455_port *s = data;
+
+	mutex_lock(&s->mutex);
+	s->props_len = 0;
+	s->props_pending = false;
+	mutex_unlock(&s->mutex);
+
+	return 0;
+}
+DEFINE_DEBUGFS_ATTRIBUTE(si4455_props_reset_fops, NULL,
+			 si4455_props_reset_set, "%llu\n");
+
+static int si4455_scan_stats_show(struct seq_file *m, void *v)
+{
+	struct si4455_port *s = m->private;
+	u32 i;
+
+	mutex_lock(&s->mutex);
+	for (i = 0; i < s->scan_table_len; i++)
+		seq_printf(m, "%u %u %u\n", s->scan_table[i],
+			   s->scan_visits[i], s->scan_hits[i]);
+	mutex_unlock(&s->mutex);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(si4455_scan_stats);
+
+static int si4455_csma_busy_ratio_show(struct seq_file *m, void *v)
+{
+	struct si4455_port *s = m->private;
+	u32 attempts = s->csma_attempt_count;
+
+	/*
+	 * Busy assessments per thousand attempts
+	 */
+	seq_printf(m, "%u\n", attempts ?
+		   (u32)div_u64((u64)s->csma_busy_count * 1000, attempts) : 0);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(si4455_csma_busy_ratio);
+
+static int si4455_comp_ratio_show(struct seq_file *m, void *v)
+{
+	struct si4455_port *s = m->private;
+	u64 in_bytes = s->comp_stats.in_bytes;
+
+	/*
+	 * Transmitted bytes per thousand input bytes
+	 */
+	seq_printf(m, "%llu\n", in_bytes ?
+		   div64_u64(s->comp_stats.out_bytes * 1000, in_bytes) : 0);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(si4455_comp_ratio);
+
+static void si4455_debugfs_init(struct device *dev)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+	struct dentry *dbgfs_si_dir;
+	struct dentry *dbgfs_csma_dir;
+	struct dentry *dbgfs_arq_dir;
+	struct dentry *dbgfs_frag_dir;
+	struct dentry *dbgfs_comp_dir;
+	struct dentry *dbgfs_fec_dir;
+	struct dentry *dbgfs_addr_dir;
+	struct dentry *dbgfs_tdma_dir;
+	struct dentry *dbgfs_bond_dir;
+	struct dentry *dbgfs_hist_dir;
+	struct dentry *dbgfs_spi_dir;
+	struct dentry *dbgfs_props_dir;
+	struct dentry *dbgfs_tpc_dir;
+	struct dentry *dbgfs_profile_dir;
+	struct dentry *dbgfs_adr_dir;
+	struct dentry *dbgfs_partinfo_dir;
+
+	s->dbgfs_dir = debugfs_create_dir(dev_name(dev), NULL);
+
+	dbgfs_si_dir = debugfs_create_dir("si4455", s->dbgfs_dir);
+
+	debugfs_create_u32("cts_error_count", 0444, dbgfs_si_dir,
+			   &s->cts_error_count);
+
+	debugfs_create_u32("tx_error_count", 0444, dbgfs_si_dir,
+			   &s->tx_error_count);
+
+	debugfs_create_u32("hop_count", 0444, dbgfs_si_dir,
+			   &s->hop_count);
+
+	debugfs_create_u32("hop_sync_count", 0444, dbgfs_si_dir,
+			   &s->hop_sync_count);
+
+	debugfs_create_u32("hop_deferred_count", 0444, dbgfs_si_dir,
+			   &s->hop_deferred_count);
+
+	debugfs_create_file("scan_stats", 0444, dbgfs_si_dir, s,
+			    &si4455_scan_stats_fops);
+
+	dbgfs_csma_dir = debugfs_create_dir("csma", dbgfs_si_dir);
+
+	debugfs_create_u32("attempt_count", 0444, dbgfs_csma_dir,
+			   &s->csma_attempt_count);
+
+	debugfs_create_u32("busy_count", 0444, dbgfs_csma_dir,
+			   &s->csma_busy_count);
+
+	debugfs_create_u32("forced_count", 0444, dbgfs_csma_dir,
+			   &s->csma_forced_count);
+
+	debugfs_create_file("busy_ratio", 0444, dbgfs_csma_dir, s,
+			    &si4455_csma_busy_ratio_fops);
+
+	dbgfs_arq_dir = debugfs_create_dir("arq", dbgfs_si_dir);
+
+	debugfs_create_u32("frame_count", 0444, dbgfs_arq_dir,
+			   &s->arq_stats.frame_count);
+
+	debugfs_create_u32("retransmit_count", 0444, dbgfs_arq_dir,
+			   &s->arq_stats.retransmit_count);
+
+	debugfs_create_u32("drop_count", 0444, dbgfs_arq_dir,
+			   &s->arq_stats.drop_count);
+
+	debugfs_create_u32("duplicate_count", 0444, dbgfs_arq_dir,
+			   &s->arq_stats.duplicate_count);
+
+	debugfs_create_u32("out_of_order_count", 0444, dbgfs_arq_dir,
+			   &s->arq_stats.out_of_order_count);
+
+	debugfs_create_u32("reordered_count", 0444, dbgfs_arq_dir,
+			   &s->arq_stats.reordered_count);
+
+	debugfs_create_u32("ack_count", 0444, dbgfs_arq_dir,
+			   &s->arq_stats.ack_count);
+
+	debugfs_create_u32("rtt_min_us", 0444, dbgfs_arq_dir,
+			   &s->arq_stats.rtt_min_us);
+
+	debugfs_create_u32("rtt_max_us", 0444, dbgfs_arq_dir,
+			   &s->arq_stats.rtt_max_us);
+
+	debugfs_create_u32("srtt_us", 0444, dbgfs_arq_dir,
+			   &s->arq_stats.srtt_us);
+
+	debugfs_create_u32("rttvar_us", 0444, dbgfs_arq_dir,
+			   &s->arq_stats.rttvar_us);
+
+	debugfs_create_u32("rto_us", 0444, dbgfs_arq_dir,
+			   &s->arq_stats.rto_us);
+
+	dbgfs_frag_dir = debugfs_create_dir("frag", dbgfs_si_dir);
+
+	debugfs_create_u32("message_tx_count", 0444, dbgfs_frag_dir,
+			   &s->frag_stats.message_tx_count);
+
+	debugfs_create_u32("message_rx_count", 0444, dbgfs_frag_dir,
+			   &s->frag_stats.message_rx_count);
+
+	debugfs_create_u32("drop_count", 0444, dbgfs_frag_dir,
+			   &s->frag_stats.drop_count);
+
+	debugfs_create_u32("timeout_count", 0444, dbgfs_frag_dir,
+			   &s->frag_stats.timeout_count);
+
+	dbgfs_comp_dir = debugfs_create_dir("compress", dbgfs_si_dir);
+
+	debugfs_create_u64("in_bytes", 0444, dbgfs_comp_dir,
+			   &s->comp_stats.in_bytes);
+
+	debugfs_create_u64("out_bytes", 0444, dbgfs_comp_dir,
+			   &s->comp_stats.out_bytes);
+
+	debugfs_create_u64("compress_ns", 0444, dbgfs_comp_dir,
+			   &s->comp_stats.compress_ns);
+
+	debugfs_create_u64("decompress_ns", 0444, dbgfs_comp_dir,
+			   &s->comp_stats.decompress_ns);
+
+	debugfs_create_u32("compressed_count", 0444, dbgfs_comp_dir,
+			   &s->comp_stats.compressed_count);
+
+	debugfs_create_u32("decompressed_count", 0444, dbgfs_comp_dir,
+			   &s->comp_stats.decompressed_count);
+
+	debugfs_create_u32("error_count", 0444, dbgfs_comp_dir,
+			   &s->comp_stats.error_count);
+
+	debugfs_create_file("ratio", 0444, dbgfs_comp_dir, s,
+			    &si4455_comp_ratio_fops);
+
+	dbgfs_fec_dir = debugfs_create_dir("fec", dbgfs_si_dir);
+
+	debugfs_create_u32("corrected_count", 0444, dbgfs_fec_dir,
+			   &s->fec_stats.corrected_count);
+
+	debugfs_create_u32("symbol_count", 0444, dbgfs_fec_dir,
+			   &s->fec_stats.symbol_count);
+
+	debugfs_create_u32("uncorrectable_count", 0444, dbgfs_fec_dir,
+			   &s->fec_stats.uncorrectable_count);
+
+	debugfs_create_u32("crc_recovered_count", 0444, dbgfs_fec_dir,
+			   &s->fec_stats.crc_recovered_count);
+
+	debugfs_create_u32("check_error_count", 0444, dbgfs_fec_dir,
+			   &s->fec_stats.check_error_count);
+
+	dbgfs_addr_dir = debugfs_create_dir("addr", dbgfs_si_dir);
+
+	debugfs_create_u32("foreign_count", 0444, dbgfs_addr_dir,
+			   &s->addr_stats.foreign_count);
+
+	debugfs_create_u32("unaddressed_count", 0444, dbgfs_addr_dir,
+			   &s->addr_stats.unaddressed_count);
+
+	debugfs_create_u32("unknown_count", 0444, dbgfs_addr_dir,
+			   &s->addr_stats.unknown_count);
+
+	debugfs_create_file("remotes", 0444, dbgfs_addr_dir, s,
+			    &si4455_remotes_fops);
+
+	dbgfs_tdma_dir = debugfs_create_dir("tdma", dbgfs_si_dir);
+
+	debugfs_create_u32("cycle_count", 0444, dbgfs_tdma_dir,
+			   &s->tdma_stats.cycle_count);
+
+	debugfs_create_u32("slot_count", 0444, dbgfs_tdma_dir,
+			   &s->tdma_stats.slot_count);
+
+	debugfs_create_u32("slot_used_count", 0444, dbgfs_tdma_dir,
+			   &s->tdma_stats.slot_used_count);
+
+	debugfs_create_file("utilisation", 0444, dbgfs_tdma_dir, s,
+			    &si4455_tdma_utilisation_fops);
+
+	debugfs_create_u32("beacon_count", 0444, dbgfs_tdma_dir,
+			   &s->tdma_stats.beacon_count);
+
+	debugfs_create_u32("grant_count", 0444, dbgfs_tdma_dir,
+			   &s->tdma_stats.grant_count);
+
+	debugfs_create_file("nodes", 0444, dbgfs_tdma_dir, s,
+			    &si4455_tdma_nodes_fops);
+
+	dbgfs_bond_dir = debugfs_create_dir("bond", dbgfs_si_dir);
+
+	debugfs_create_u32("tx_frame_count", 0444, dbgfs_bond_dir,
+			   &s->bond_stats.tx_frame_count);
+
+	debugfs_create_u32("rx_frame_count", 0444, dbgfs_bond_dir,
+			   &s->bond_stats.rx_frame_count);
+
+	debugfs_create_u32("fault_count", 0444, dbgfs_bond_dir,
+			   &s->bond_stats.fault_count);
+
+	debugfs_create_file("members", 0444, dbgfs_bond_dir, s,
+			    &si4455_bond_members_fops);
+
+	dbgfs_hist_dir = debugfs_create_dir("hist", dbgfs_si_dir);
+
+	debugfs_create_file("cts_wait_us", 0444, dbgfs_hist_dir,
+			    &s->hists.cts_wait_us, &si4455_hist_fops);
+
+	debugfs_create_file("spi_xfer_us", 0444, dbgfs_hist_dir,
+			    &s->hists.spi_xfer_us, &si4455_hist_fops);
+
+	debugfs_create_file("irq_push_us", 0444, dbgfs_hist_dir,
+			    &s->hists.irq_push_us, &si4455_hist_fops);
+
+	debugfs_create_file("tx_latency_us", 0444, dbgfs_hist_dir,
+			    &s->hists.tx_latency_us, &si4455_hist_fops);
+
+	debugfs_create_file("irq_packets", 0444, dbgfs_hist_dir,
+			    &s->hists.irq_packets, &si4455_hist_fops);
+
+	debugfs_create_file_unsafe("reset", 0200, dbgfs_hist_dir, s,
+				   &si4455_hist_reset_fops);
+
+	dbgfs_spi_dir = debugfs_create_dir("spi", dbgfs_si_dir);
+
+	debugfs_create_u64("xfers", 0444, dbgfs_spi_dir, &s->spi_xfers);
+
+	debugfs_create_u64("bytes", 0444, dbgfs_spi_dir, &s->spi_bytes);
+
+	debugfs_create_u32("tx_budget", 0644, dbgfs_spi_dir,
+			   &s->spi_tx_cost.budget);
+
+	debugfs_create_u32("rx_budget", 0644, dbgfs_spi_dir,
+			   &s->spi_rx_cost.budget);
+
+	debugfs_create_file("packet_cost", 0444, dbgfs_spi_dir, s,
+			    &si4455_spi_cost_fops);
+
+	debugfs_create_file_unsafe("reset", 0200, dbgfs_spi_dir, s,
+				   &si4455_spi_reset_fops);
+
+	dbgfs_props_dir = debugfs_create_dir("props", dbgfs_si_dir);
+
+	debugfs_create_file("set", 0644, dbgfs_props_dir, s,
+			    &si4455_props_fops);
+
+	debugfs_create_file("get", 0644, dbgfs_props_dir, s,
+			    &si4455_props_get_fops);
+
+	debugfs_create_file_unsafe("reset", 0200, dbgfs_props_dir, s,
+				   &si4455_props_reset_fops);
+
+	dbgfs_tpc_dir = debugfs_create_dir("tpc", dbgfs_si_dir);
+
+	debugfs_create_u32("report_tx_count", 0444, dbgfs_tpc_dir,
+			   &s->tpc_stats.report_tx_count);
+
+	debugfs_create_u32("report_rx_count", 0444, dbgfs_tpc_dir,
+			   &s->tpc_stats.report_rx_count);
+
+	debugfs_create_u32("step_up_count", 0444, dbgfs_tpc_dir,
+			   &s->tpc_stats.step_up_count);
+
+	debugfs_create_u32("step_down_count", 0444, dbgfs_tpc_dir,
+			   &s->tpc_stats.step_down_count);
+
+	debugfs_create_u32("peer_rssi", 0444, dbgfs_tpc_dir,
+			   &s->tpc_stats.peer_rssi);
+
+	debugfs_create_u32("peer_crc_permille", 0444, dbgfs_tpc_dir,
+			   &s->tpc_stats.peer_crc_permille);
+
+	dbgfs_profile_dir = debugfs_create_dir("profile", dbgfs_si_dir);
+
+	debugfs_create_u32("switch_count", 0444, dbgfs_profile_dir,
+			   &s->profile_stats.switch_count);
+
+	debugfs_create_u32("replay_count", 0444, dbgfs_profile_dir,
+			   &s->profile_stats.replay_count);
+
+	debugfs_create_u32("full_count", 0444, dbgfs_profile_dir,
+			   &s->profile_stats.full_count);
+
+	debugfs_create_u32("command_count", 0444, dbgfs_profile_dir,
+			   &s->profile_stats.command_count);
+
+	debugfs_create_u32("last_switch_us", 0444, dbgfs_profile_dir,
+			   &s->profile_stats.last_switch_us);
+
+	dbgfs_adr_dir = debugfs_create_dir("adr", dbgfs_si_dir);
+
+	debugfs_create_u32("rate_tx_count", 0444, dbgfs_adr_dir,
+			   &s->adr_stats.rate_tx_count);
+
+	debugfs_create_u32("rate_rx_count", 0444, dbgfs_adr_dir,
+			   &s->adr_stats.rate_rx_count);
+
+	debugfs_create_u32("up_count", 0444, dbgfs_adr_dir,
+			   &s->adr_stats.up_count);
+
+	debugfs_create_u32("down_count", 0444, dbgfs_adr_dir,
+			   &s->adr_stats.down_count);
+
+	debugfs_create_u32("fallback_count", 0444, dbgfs_adr_dir,
+			   &s->adr_stats.fallback_count);
+
+	dbgfs_partinfo_dir = debugfs_create_dir("partinfo", dbgfs_si_dir);
+
+	debugfs_create_u8("chip_rev", 0444, dbgfs_partinfo_dir,
+			  &s->part_info.chip_rev);
+
+	debugfs_create_u8("rom_id", 0444, dbgfs_partinfo_dir,
+			  &s->part_info.rom_id);
+
+	debugfs_create_u16("part", 0444, dbgfs_partinfo_dir,
+			   &s->part_info.part);
+}
+
+static void si4455_debugfs_clear(struct device *dev)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+
+	debugfs_remove_recursive(s->dbgfs_dir);
+}
+
+static int __maybe_unused si4455_suspend(struct device *dev)
+{
+	int ret;
+	struct si4455_port *s = dev_get_drvdata(dev);
+
+	mutex_lock(&s->mutex);
+	ret = si4455_cancel_tx(&s->port);
+	if (ret) {
+		mutex_unlock(&s->mutex);
+		dev_err(dev, "%s: si4455_cancel_tx error (%i)\n",
+			__func__, ret);
+		return ret;
+	}
+
+	ret = si4455_change_state(&s->port, SI4455_CMD_CHANGE_STATE_STATE_SLEEP);
+	s->suspended = !ret;
+	mutex_unlock(&s->mutex);
+
+	if (ret) {
+		dev_err(dev, "%s: si4455_change_state error (%i)\n",
+			__func__, ret);
+		return ret;
+	}
+
+	return uart_suspend_port(&si4455_uart, &s->port);
+}
+
+static int __maybe_unused si4455_resume(struct device *dev)
+{
+	int ret;
+	struct si4455_port *s = dev_get_drvdata(dev);
+
+	ret = uart_resume_port(&si4455_uart, &s->port);
+	if (ret) {
+		dev_err(dev, "%s: uart_resume_port error (%i)\n",
+			__func__, ret);
+		return ret;
+	}
+
+	s->suspended = false;
+	s->rx_stopped = false;
+
+	return si4455_do_work(&s->port);
+}
+
+static SIMPLE_DEV_PM_OPS(si4455_pm_ops, si4455_suspend, si4455_resume);
+
+static ssize_t package_size_show(struct device *dev,
+				 struct device_attribute *attr, char *buf)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", s->package_size);
+}
+
+static ssize_t package_size_store(struct device *dev,
+				  struct device_attribute *attr,
+				  const char *buf, size_t count)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+	unsigned long val;
+	int ret;
+
+	ret = kstrtoul(buf, 10, &val);
+	if (ret)
+		return ret;
+
+	if (val > SI4455_FIFO_SIZE)
+		return -EINVAL;
+
+	mutex_lock(&s->mutex);
+	ret = si4455_package_size_check(s, val);
+	if (!ret)
+		s->package_size = val;
+	mutex_unlock(&s->mutex);
+	if (ret)
+		return ret;
+
+	ret = si4455_do_work(&s->port);
+
+	return ret ? ret : count;
+}
+
+/*
+ * package_size: rw sysfs entry.
+ * Sets or returns the package size.
+ * The new value applied immediately.
+ * Variable package size (package_size == 0)
+ * currently not supported by driver.
+ */
+static DEVICE_ATTR_RW(package_size);
+
+static ssize_t rx_channel_show(struct device *dev,
+			       struct device_attribute *attr, char *buf)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", s->rx_channel);
+}
+
+static ssize_t rx_channel_store(struct device *dev,
+				struct device_attribute *attr,
+				const char *buf, size_t count)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+	unsigned long val;
+	int ret;
+
+	ret = kstrtoul(buf, 10, &val);
+	if (ret)
+		return ret;
+
+	s->rx_channel = val;
+	schedule_work(&s->tx_work);
+
+	return count;
+}
+
+/*
+ * rx_channel: rw sysfs entry.
+ * Sets or returns the receive channel index.
+ * The new value applied by the next START_RX command.
+ */
+static DEVICE_ATTR_RW(rx_channel);
+
+static ssize_t tx_channel_show(struct device *dev,
+			       struct device_attribute *attr, char *buf)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", s->tx_channel);
+}
+
+static ssize_t tx_channel_store(struct device *dev,
+				struct device_attribute *attr,
+				const char *buf, size_t count)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+	unsigned long val;
+	int ret;
+
+	ret = kstrtoul(buf, 10, &val);
+	if (ret)
+		return ret;
+
+	s->tx_channel = val;
+	schedule_work(&s->tx_work);
+
+	return count;
+}
+
+/*
+ * tx_channel: rw sysfs entry.
+ * Sets or returns the transmit channel index.
+ * The new value will be used on next data transmit.
+ */
+static DEVICE_ATTR_RW(tx_channel);
+
+static ssize_t tx_timeout_show(struct device *dev,
+			       struct device_attribute *attr, char *buf)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", s->tx_wd_timeout);
+}
+
+static ssize_t tx_timeout_store(struct device *dev,
+				struct device_attribute *attr,
+				const char *buf, size_t count)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+	unsigned long val;
+	int ret;
+
+	ret = kstrtoul(buf, 10, &val);
+	if (ret)
+		return ret;
+
+	s->tx_wd_timeout = val;
+	ret = si4455_do_work(&s->port);
+
+	return ret ? ret : count;
+}
+
+/*
+ * tx_timeout: rw sysfs entry.
+ * Sets or returns the transmit timeout.
+ * The new value will be used on next data transmit.
+ */
+static DEVICE_ATTR_RW(tx_timeout);
+
+static int si4455_parse_channel_list(const char *buf, u8 *list, u32 max)
+{
+	char *tokens;
+	char *cur;
+	char *tok;
+	int count = 0;
+	int ret = 0;
+
+	tokens = kstrdup(buf, GFP_KERNEL);
+	if (!tokens)
+		return -ENOMEM;
+
+	cur = tokens;
+	while ((tok = strsep(&cur, " ,\t\n")) != NULL) {
+		if (*tok == '\0')
+			continue;
+
+		if (count == max) {
+			ret = -E2BIG;
+			break;
+		}
+
+		ret = kstrtou8(tok, 10, &list[count]);
+		if (ret)
+			break;
+
+		count++;
+	}
+	kfree(tokens);
+
+	return ret ? ret : count;
+}
+
+static ssize_t si4455_show_channel_list(char *buf, const u8 *list, u32 len)
+{
+	ssize_t ret = 0;
+	u32 i;
+
+	for (i = 0; i < len; i++)
+		ret += sprintf(buf + ret, i ? " %u" : "%u", list[i]);
+
+	return ret + sprintf(buf + ret, "\n");
+}
+
+static ssize_t hop_table_show(struct device *dev,
+			      struct device_attribute *attr, char *buf)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+	ssize_t ret;
+
+	mutex_lock(&s->mutex);
+	ret = si4455_show_channel_list(buf, s->hop_table, s->hop_table_len);
+	mutex_unlock(&s->mutex);
+
+	return ret;
+}
+
+static ssize_t hop_table_store(struct device *dev,
+			       struct device_attribute *attr,
+			       const char *buf, size_t count)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+	u8 table[SI4455_CHANNEL_LIST_MAX];
+	int ret;
+
+	ret = si4455_parse_channel_list(buf, table, ARRAY_SIZE(table));
+	if (ret < 0)
+		return ret;
+
+	mutex_lock(&s->mutex);
+	memcpy(s->hop_table, table, ret);
+	s->hop_table_len = ret;
+	s->hop_index = 0;
+	si4455_hop_update(s);
+	mutex_unlock(&s->mutex);
+	schedule_work(&s->tx_work);
+
+	return count;
+}
+
+/*
+ * hop_table: rw sysfs entry.
+ * Sets or returns the frequency hopping channel list.
+ * Channel indexes separated by space or comma, empty list disables hopping.
+ */
+static DEVICE_ATTR_RW(hop_table);
+
+static ssize_t hop_dwell_us_show(struct device *dev,
+				 struct device_attribute *attr, char *buf)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", s->hop_dwell_us);
+}
+
+static ssize_t hop_dwell_us_store(struct device *dev,
+				  struct device_attribute *attr,
+				  const char *buf, size_t count)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+	unsigned long val;
+	int ret;
+
+	ret = kstrtoul(buf, 10, &val);
+	if (ret)
+		return ret;
+
+	if (val && val < SI4455_HOP_DWELL_MIN_US)
+		return -EINVAL;
+
+	mutex_lock(&s->mutex);
+	s->hop_dwell_us = val;
+	si4455_hop_update(s);
+	mutex_unlock(&s->mutex);
+	schedule_work(&s->tx_work);
+
+	return count;
+}
+
+/*
+ * hop_dwell_us: rw sysfs entry.
+ * Sets or returns the time(us) spent on each hop_table channel.
+ * Zero disables hopping.
+ */
+static DEVICE_ATTR_RW(hop_dwell_us);
+
+static ssize_t hop_master_show(struct device *dev,
+			       struct device_attribute *attr, char *buf)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", s->hop_master);
+}
+
+static ssize_t hop_master_store(struct device *dev,
+				struct device_attribute *attr,
+				const char *buf, size_t count)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+	bool val;
+	int ret;
+
+	ret = kstrtobool(buf, &val);
+	if (ret)
+		return ret;
+
+	mutex_lock(&s->mutex);
+	s->hop_master = val;
+	s->hop_sync_due = val;
+	s->hop_skip = 0;
+	si4455_hop_skip_update(s);
+	mutex_unlock(&s->mutex);
+	schedule_work(&s->tx_work);
+
+	return count;
+}
+
+/*
+ * hop_master: rw sysfs entry.
+ * Sets or returns whether the radio announces the hop phase to its peers.
+ */
+static DEVICE_ATTR_RW(hop_master);
+
+static ssize_t scan_table_show(struct device *dev,
+			       struct device_attribute *attr, char *buf)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+	ssize_t ret;
+
+	mutex_lock(&s->mutex);
+	ret = si4455_show_channel_list(buf, s->scan_table, s->scan_table_len);
+	mutex_unlock(&s->mutex);
+
+	return ret;
+}
+
+static ssize_t scan_table_store(struct device *dev,
+				struct device_attribute *attr,
+				const char *buf, size_t count)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+	u8 table[SI4455_CHANNEL_LIST_MAX];
+	int ret;
+
+	ret = si4455_parse_channel_list(buf, table, ARRAY_SIZE(table));
+	if (ret < 0)
+		return ret;
+
+	mutex_lock(&s->mutex);
+	memcpy(s->scan_table, table, ret);
+	memset(s->scan_visits, 0, sizeof(s->scan_visits));
+	memset(s->scan_hits, 0, sizeof(s->scan_hits));
+	s->scan_table_len = ret;
+	s->scan_index = 0;
+	si4455_scan_update(s);
+	mutex_unlock(&s->mutex);
+	schedule_work(&s->tx_work);
+
+	return count;
+}
+
+/*
+ * scan_table: rw sysfs entry.
+ * Sets or returns the scanned receive channel list.
+ * Channel indexes separated by space or comma, empty list disables scanning.
+ */
+static DEVICE_ATTR_RW(scan_table);
+
+static ssize_t scan_dwell_us_show(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", s->scan_dwell_us);
+}
+
+static ssize_t scan_dwell_us_store(struct device *dev,
+				   struct device_attribute *attr,
+				   const char *buf, size_t count)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+	unsigned long val;
+	int ret;
+
+	ret = kstrtoul(buf, 10, &val);
+	if (ret)
+		return ret;
+
+	if (val && val < SI4455_SCAN_DWELL_MIN_US)
+		return -EINVAL;
+
+	mutex_lock(&s->mutex);
+	s->scan_dwell_us = val;
+	si4455_scan_update(s);
+	mutex_unlock(&s->mutex);
+	schedule_work(&s->tx_work);
+
+	return count;
+}
+
+/*
+ * scan_dwell_us: rw sysfs entry.
+ * Sets or returns the time(us) spent on each scan_table channel.
+ * Zero disables scanning.
+ */
+static DEVICE_ATTR_RW(scan_dwell_us);
+
+static ssize_t csma_threshold_show(struct device *dev,
+				   struct device_attribute *attr, char *buf)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", s->csma_threshold);
+}
+
+static ssize_t csma_threshold_store(struct device *dev,
+				    struct device_attribute *attr,
+				    const char *buf, size_t count)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+	unsigned long val;
+	int ret;
+
+	ret = kstrtoul(buf, 10, &val);
+	if (ret)
+		return ret;
+
+	if (val > 255)
+		return -EINVAL;
+
+	mutex_lock(&s->mutex);
+	s->csma_threshold = val;
+	mutex_unlock(&s->mutex);
+
+	return count;
+}
+
+/*
+ * csma_threshold: rw sysfs entry.
+ * Sets or returns the rssi level, the channel is busy at or above.
+ * Zero disables listen before talk.
+ */
+static DEVICE_ATTR_RW(csma_threshold);
+
+static ssize_t csma_slot_us_show(struct device *dev,
+				 struct device_attribute *attr, char *buf)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", s->csma_slot_us);
+}
+
+static ssize_t csma_slot_us_store(struct device *dev,
+				  struct device_attribute *attr,
+				  const char *buf, size_t count)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+	unsigned long val;
+	int ret;
+
+	ret = kstrtoul(buf, 10, &val);
+	if (ret)
+		return ret;
+
+	if (val == 0 || val > USEC_PER_SEC)
+		return -EINVAL;
+
+	mutex_lock(&s->mutex);
+	s->csma_slot_us = val;
+	mutex_unlock(&s->mutex);
+
+	return count;
+}
+
+/*
+ * csma_slot_us: rw sysfs entry.
+ * Sets or returns the backoff slot time(us).
+ */
+static DEVICE_ATTR_RW(csma_slot_us);
+
+static ssize_t csma_max_backoffs_show(struct device *dev,
+				      struct device_attribute *attr, char *buf)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", s->csma_max_backoffs);
+}
+
+static ssize_t csma_max_backoffs_store(struct device *dev,
+				       struct device_attribute *attr,
+				       const char *buf, size_t count)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+	unsigned long val;
+	int ret;
+
+	ret = kstrtoul(buf, 10, &val);
+	if (ret)
+		return ret;
+
+	mutex_lock(&s->mutex);
+	s->csma_max_backoffs = val;
+	mutex_unlock(&s->mutex);
+
+	return count;
+}
+
+/*
+ * csma_max_backoffs: rw sysfs entry.
+ * Sets or returns the number of backoffs before a forced transmit.
+ */
+static DEVICE_ATTR_RW(csma_max_backoffs);
+
+static ssize_t arq_window_show(struct device *dev,
+			       struct device_attribute *attr, char *buf)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", s->arq_window);
+}
+
+static ssize_t arq_window_store(struct device *dev,
+				struct device_attribute *attr,
+				const char *buf, size_t count)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+	unsigned long val;
+	bool link_enabled;
+	int ret;
+
+	ret = kstrtoul(buf, 10, &val);
+	if (ret)
+		return ret;
+
+	if (val > SI4455_ARQ_WINDOW_MAX)
+		return -EINVAL;
+
+	mutex_lock(&s->mutex);
+	link_enabled = si4455_link_enabled(s);
+	s->arq_window = val;
+	if (link_enabled != si4455_link_enabled(s))
+		si4455_link_reset(s);
+	mutex_unlock(&s->mutex);
+	schedule_work(&s->tx_work);
+
+	return count;
+}
+
+/*
+ * arq_window: rw sysfs entry.
+ * Sets or returns the number of unacknowledged frames in flight.
+ * Zero disables the reliable link layer.
+ */
+static DEVICE_ATTR_RW(arq_window);
+
+static ssize_t arq_retries_show(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", s->arq_retries);
+}
+
+static ssize_t arq_retries_store(struct device *dev,
+				 struct device_attribute *attr,
+				 const char *buf, size_t count)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+	unsigned long val;
+	int ret;
+
+	ret = kstrtoul(buf, 10, &val);
+	if (ret)
+		return ret;
+
+	if (val > 254)
+		return -EINVAL;
+
+	mutex_lock(&s->mutex);
+	s->arq_retries = val;
+	mutex_unlock(&s->mutex);
+
+	return count;
+}
+
+/*
+ * arq_retries: rw sysfs entry.
+ * Sets or returns the number of retransmissions before a frame is dropped.
+ */
+static DEVICE_ATTR_RW(arq_retries);
+
+static ssize_t arq_ack_delay_us_show(struct device *dev,
+				     struct device_attribute *attr, char *buf)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", s->arq_ack_delay_us);
+}
+
+static ssize_t arq_ack_delay_us_store(struct device *dev,
+				      struct device_attribute *attr,
+				      const char *buf, size_t count)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+	unsigned long val;
+	int ret;
+
+	ret = kstrtoul(buf, 10, &val);
+	if (ret)
+		return ret;
+
+	if (val > USEC_PER_SEC)
+		return -EINVAL;
+
+	mutex_lock(&s->mutex);
+	s->arq_ack_delay_us = val;
+	mutex_unlock(&s->mutex);
+
+	return count;
+}
+
+/*
+ * arq_ack_delay_us: rw sysfs entry.
+ * Sets or returns the time(us) the acknowledgment waits for further frames.
+ */
+static DEVICE_ATTR_RW(arq_ack_delay_us);
+
+static ssize_t mtu_show(struct device *dev,
+			struct device_attribute *attr, char *buf)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", s->mtu);
+}
+
+static ssize_t mtu_store(struct device *dev,
+			 struct device_attribute *attr,
+			 const char *buf, size_t count)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+	unsigned long val;
+	bool link_enabled;
+	u32 i;
+	int ret;
+
+	ret = kstrtoul(buf, 10, &val);
+	if (ret)
+		return ret;
+
+	if (val > SI4455_LINK_MTU_MAX)
+		return -EINVAL;
+
+	mutex_lock(&s->mutex);
+	link_enabled = si4455_link_enabled(s);
+	s->mtu = val;
+	for (i = 0; i <= s->remote_count; i++)
+		si4455_link_get(s, i)->reasm_active = false;
+	if (link_enabled != si4455_link_enabled(s))
+		si4455_link_reset(s);
+	mutex_unlock(&s->mutex);
+	schedule_work(&s->tx_work);
+
+	return count;
+}
+
+/*
+ * mtu: rw sysfs entry.
+ * Sets or returns the maximum message size carried in fragments.
+ * Zero disables framing.
+ */
+static DEVICE_ATTR_RW(mtu);
+
+static ssize_t reasm_timeout_ms_show(struct device *dev,
+				     struct device_attribute *attr, char *buf)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", s->reasm_timeout_ms);
+}
+
+static ssize_t reasm_timeout_ms_store(struct device *dev,
+				      struct device_attribute *attr,
+				      const char *buf, size_t count)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+	unsigned long val;
+	int ret;
+
+	ret = kstrtoul(buf, 10, &val);
+	if (ret)
+		return ret;
+
+	if (val == 0 || val > MSEC_PER_SEC * 60)
+		return -EINVAL;
+
+	mutex_lock(&s->mutex);
+	s->reasm_timeout_ms = val;
+	mutex_unlock(&s->mutex);
+
+	return count;
+}
+
+/*
+ * reasm_timeout_ms: rw sysfs entry.
+ * Sets or returns the time(ms) a partially received message is kept.
+ */
+static DEVICE_ATTR_RW(reasm_timeout_ms);
+
+static ssize_t compress_show(struct device *dev,
+			     struct device_attribute *attr, char *buf)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", s->comp_wrkmem ? 1 : 0);
+}
+
+static ssize_t compress_store(struct device *dev,
+			      struct device_attribute *attr,
+			      const char *buf, size_t count)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+	bool val;
+	int ret;
+
+	ret = kstrtobool(buf, &val);
+	if (ret)
+		return ret;
+
+	mutex_lock(&s->mutex);
+	/*
+	 * Only messages of several fragments get shorter in packets
+	 */
+	if (val && !s->mtu) {
+		ret = -EINVAL;
+	} else if (val && !s->comp_wrkmem) {
+		s->comp_wrkmem = kzalloc(LZO1X_1_MEM_COMPRESS, GFP_KERNEL);
+		if (!s->comp_wrkmem)
+			ret = -ENOMEM;
+	} else if (!val) {
+		kfree(s->comp_wrkmem);
+		s->comp_wrkmem = NULL;
+	}
+	mutex_unlock(&s->mutex);
+
+	return ret ? ret : count;
+}
+
+/*
+ * compress: rw sysfs entry.
+ * Enables or disables the compression of transmitted link layer messages,
+ * requires framing(mtu). Compressed messages are always decompressed on receive.
+ */
+static DEVICE_ATTR_RW(compress);
+
+/*
+ * Replaces the Reed-Solomon codec, fec_roots == 0 disables the coding.
+ * The parity must leave room for the payload and the link header.
+ */
+static int si4455_fec_setup(struct si4455_port *s, u32 roots, u32 depth)
+{
+	struct rs_control *rs = NULL;
+
+	if (roots && si4455_packet_max(s) <=
+	    roots * depth + SI4455_FEC_CHECK_SIZE + si4455_link_hdr_size(s))
+		return -EINVAL;
+
+	if (roots) {
+		rs = init_rs(SI4455_FEC_SYMSIZE, SI4455_FEC_GFPOLY, 0, 1, roots);
+		if (!rs)
+			return -ENOMEM;
+	}
+
+	free_rs(s->fec_rs);
+	s->fec_rs = rs;
+	s->fec_roots = roots;
+	s->fec_depth = depth;
+	si4455_link_reset(s);
+
+	return 0;
+}
+
+static ssize_t fec_roots_show(struct device *dev,
+			      struct device_attribute *attr, char *buf)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", s->fec_roots);
+}
+
+static ssize_t fec_roots_store(struct device *dev,
+			       struct device_attribute *attr,
+			       const char *buf, size_t count)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+	unsigned long val;
+	int ret;
+
+	ret = kstrtoul(buf, 10, &val);
+	if (ret)
+		return ret;
+
+	if (val > SI4455_FEC_ROOTS_MAX || val % 2)
+		return -EINVAL;
+
+	mutex_lock(&s->mutex);
+	ret = si4455_fec_setup(s, val, s->fec_depth);
+	mutex_unlock(&s->mutex);
+	schedule_work(&s->tx_work);
+
+	return ret ? ret : count;
+}
+
+/*
+ * fec_roots: rw sysfs entry.
+ * Sets or returns the number of Reed-Solomon parity bytes per codeword.
+ * The codeword corrects fec_roots / 2 byte errors.
+ * Zero disables the forward error correction.
+ */
+static DEVICE_ATTR_RW(fec_roots);
+
+static ssize_t fec_depth_show(struct device *dev,
+			      struct device_attribute *attr, char *buf)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", s->fec_depth);
+}
+
+static ssize_t fec_depth_store(struct device *dev,
+			       struct device_attribute *attr,
+			       const char *buf, size_t count)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+	unsigned long val;
+	int ret;
+
+	ret = kstrtoul(buf, 10, &val);
+	if (ret)
+		return ret;
+
+	if (val < 1 || val > SI4455_FEC_DEPTH_MAX)
+		return -EINVAL;
+
+	mutex_lock(&s->mutex);
+	ret = si4455_fec_setup(s, s->fec_roots, val);
+	mutex_unlock(&s->mutex);
+	schedule_work(&s->tx_work);
+
+	return ret ? ret : count;
+}
+
+/*
+ * fec_depth: rw sysfs entry.
+ * Sets or returns the number of interleaved codewords per packet.
+ */
+static DEVICE_ATTR_RW(fec_depth);
+
+static ssize_t address_show(struct device *dev,
+			    struct device_attribute *attr, char *buf)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", s->address);
+}
+
+static ssize_t address_store(struct device *dev,
+			     struct device_attribute *attr,
+			     const char *buf, size_t count)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+	unsigned long val;
+	int ret;
+
+	ret = kstrtoul(buf, 10, &val);
+	if (ret)
+		return ret;
+
+	if (val >= SI4455_ADDR_BROADCAST)
+		return -EINVAL;
+
+	mutex_lock(&s->mutex);
+	s->address = val;
+	si4455_link_reset(s);
+	si4455_tdma_update(s);
+	mutex_unlock(&s->mutex);
+	schedule_work(&s->tx_work);
+
+	return count;
+}
+
+/*
+ * address: rw sysfs entry.
+ * Sets or returns the node address of the link layer.
+ * Zero disables the addressing.
+ */
+static DEVICE_ATTR_RW(address);
+
+static ssize_t remotes_show(struct device *dev,
+			    struct device_attribute *attr, char *buf)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+	ssize_t ret = 0;
+	u32 i;
+
+	mutex_lock(&s->mutex);
+	for (i = 0; i < s->remote_count; i++)
+		ret += sprintf(buf + ret, i ? " %u" : "%u",
+			       s->remotes[i]->link.addr);
+	mutex_unlock(&s->mutex);
+	ret += sprintf(buf + ret, "\n");
+
+	return ret;
+}
+
+static ssize_t remotes_store(struct device *dev,
+			     struct device_attribute *attr,
+			     const char *buf, size_t count)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+	u8 addrs[SI4455_REMOTE_MAX];
+	int len;
+	int ret;
+	int i;
+
+	len = si4455_parse_channel_list(buf, addrs, SI4455_REMOTE_MAX);
+	if (len < 0)
+		return len;
+
+	for (i = 0; i < len; i++) {
+		if (addrs[i] == 0 || addrs[i] == SI4455_ADDR_BROADCAST ||
+		    memchr(addrs, addrs[i], i))
+			return -EINVAL;
+	}
+
+	ret = si4455_remotes_set(s, addrs, len);
+	schedule_work(&s->tx_work);
+
+	return ret ? ret : count;
+}
+
+/*
+ * remotes: rw sysfs entry.
+ * Sets or returns the addresses of the remote nodes,
+ * every remote node gets its own tty.
+ */
+static DEVICE_ATTR_RW(remotes);
+
+static ssize_t tdma_slot_us_show(struct device *dev,
+				 struct device_attribute *attr, char *buf)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", s->tdma_slot_us);
+}
+
+static ssize_t tdma_slot_us_store(struct device *dev,
+				  struct device_attribute *attr,
+				  const char *buf, size_t count)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+	unsigned long val;
+	int ret;
+
+	ret = kstrtoul(buf, 10, &val);
+	if (ret)
+		return ret;
+
+	if (val && val < SI4455_TDMA_SLOT_MIN_US)
+		return -EINVAL;
+
+	mutex_lock(&s->mutex);
+	s->tdma_slot_us = val;
+	si4455_tdma_update(s);
+	mutex_unlock(&s->mutex);
+	schedule_work(&s->tx_work);
+
+	return count;
+}
+
+/*
+ * tdma_slot_us: rw sysfs entry.
+ * Sets or returns the time(us) the gateway waits for the reply
+ * of the polled node. Zero disables the time slotted mode.
+ */
+static DEVICE_ATTR_RW(tdma_slot_us);
+
+/*
+ * Must be called with si4455_bond_lock held.
+ */
+static void si4455_bond_attach(struct si4455_port *s,
+			       struct si4455_port *member, bool rx_only)
+{
+	mutex_lock(&member->mutex);
+	member->bond_master = s;
+	member->bond_rx_only = rx_only;
+	member->bond_errors = member->cts_error_count + member->tx_error_count;
+	member->bond_holdoff_end = jiffies;
+	mutex_unlock(&member->mutex);
+
+	mutex_lock(&s->mutex);
+	s->bond_members[s->bond_count++] = member;
+	if (rx_only)
+		s->duplex_rx = member;
+	mutex_unlock(&s->mutex);
+
+	if (s->connected)
+		si4455_connect(member);
+}
+
+/*
+ * Must be called with si4455_bond_lock held.
+ */
+static void si4455_bond_detach(struct si4455_port *s,
+			       struct si4455_port *member)
+{
+	u32 i;
+
+	mutex_lock(&s->mutex);
+	for (i = 0; i < s->bond_count; i++) {
+		if (s->bond_members[i] == member) {
+			s->bond_members[i] = s->bond_members[--s->bond_count];
+			break;
+		}
+	}
+	if (s->duplex_rx == member)
+		s->duplex_rx = NULL;
+	mutex_unlock(&s->mutex);
+
+	si4455_disconnect(member);
+	si4455_link_tx_end(member, false);
+	mutex_lock(&member->mutex);
+	member->bond_master = NULL;
+	member->bond_rx_only = false;
+	mutex_unlock(&member->mutex);
+}
+
+/*
+ * Checks whether the radio can join the bond of s.
+ * Must be called with si4455_bond_lock held.
+ */
+static int si4455_bond_check(struct si4455_port *s, u8 line, bool rx_only)
+{
+	struct si4455_port *member;
+
+	member = line < SI4455_UART_NRMAX ? si4455_radios[line] : NULL;
+	if (!member || member == s || member->bond_count)
+		return -EINVAL;
+
+	/*
+	 * The tty of a member is not used while bonded
+	 */
+	if (member->bond_master != s &&
+	    (member->bond_master || member->connected))
+		return -EBUSY;
+
+	if (member->bond_master == s && member->bond_rx_only != rx_only)
+		return -EBUSY;
+
+	return 0;
+}
+
+static ssize_t bond_show(struct device *dev,
+			 struct device_attribute *attr, char *buf)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+	ssize_t ret = 0;
+	u32 i;
+
+	mutex_lock(&si4455_bond_lock);
+	for (i = 0; i < s->bond_count; i++) {
+		if (s->bond_members[i]->bond_rx_only)
+			continue;
+
+		ret += sprintf(buf + ret, ret ? " %u" : "%u",
+			       s->bond_members[i]->port.line);
+	}
+	mutex_unlock(&si4455_bond_lock);
+	ret += sprintf(buf + ret, "\n");
+
+	return ret;
+}
+
+static ssize_t bond_store(struct device *dev,
+			  struct device_attribute *attr,
+			  const char *buf, size_t count)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+	struct si4455_port *member;
+	u8 lines[SI4455_BOND_MAX];
+	int len;
+	int ret = 0;
+	int i;
+
+	len = si4455_parse_channel_list(buf, lines, SI4455_BOND_MAX);
+	if (len < 0)
+		return len;
+
+	for (i = 0; i < len; i++) {
+		if (memchr(lines, lines[i], i))
+			return -EINVAL;
+	}
+
+	mutex_lock(&si4455_bond_lock);
+	if (s->bond_master || len + !!s->duplex_rx > SI4455_BOND_MAX) {
+		ret = -EBUSY;
+		goto out;
+	}
+
+	for (i = 0; i < len && !ret; i++)
+		ret = si4455_bond_check(s, lines[i], false);
+	if (ret)
+		goto out;
+
+	for (i = s->bond_count; i > 0; i--) {
+		member = s->bond_members[i - 1];
+		if (!member->bond_rx_only &&
+		    !memchr(lines, member->port.line, len))
+			si4455_bond_detach(s, member);
+	}
+
+	for (i = 0; i < len; i++) {
+		member = si4455_radios[lines[i]];
+		if (member->bond_master != s)
+			si4455_bond_attach(s, member, false);
+	}
+out:
+	mutex_unlock(&si4455_bond_lock);
+
+	return ret ? ret : count;
+}
+
+/*
+ * bond: rw sysfs entry.
+ * Sets or returns the port lines of the radios bonded to this port,
+ * the frames of the tty are striped across this radio and the members.
+ */
+static DEVICE_ATTR_RW(bond);
+
+static ssize_t duplex_show(struct device *dev,
+			   struct device_attribute *attr, char *buf)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+	ssize_t ret;
+
+	mutex_lock(&si4455_bond_lock);
+	if (s->duplex_rx)
+		ret = sprintf(buf, "%u\n", s->duplex_rx->port.line);
+	else
+		ret = sprintf(buf, "\n");
+	mutex_unlock(&si4455_bond_lock);
+
+	return ret;
+}
+
+static ssize_t duplex_store(struct device *dev,
+			    struct device_attribute *attr,
+			    const char *buf, size_t count)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+	u8 line;
+	int len;
+	int ret = 0;
+
+	len = si4455_parse_channel_list(buf, &line, 1);
+	if (len < 0)
+		return len;
+
+	mutex_lock(&si4455_bond_lock);
+	if (s->bond_master) {
+		ret = -EBUSY;
+		goto out;
+	}
+
+	if (len && s->duplex_rx && s->duplex_rx->port.line == line)
+		goto out;
+
+	if (len) {
+		ret = si4455_bond_check(s, line, true);
+		if (!ret && !s->duplex_rx && s->bond_count == SI4455_BOND_MAX)
+			ret = -EBUSY;
+		if (ret)
+			goto out;
+	}
+
+	if (s->duplex_rx)
+		si4455_bond_detach(s, s->duplex_rx);
+	if (len)
+		si4455_bond_attach(s, si4455_radios[line], true);
+out:
+	mutex_unlock(&si4455_bond_lock);
+	schedule_work(&s->tx_work);
+
+	return ret ? ret : count;
+}
+
+/*
+ * duplex: rw sysfs entry.
+ * Sets or returns the port line of the radio receiving for this port,
+ * this radio transmits only.
+ */
+static DEVICE_ATTR_RW(duplex);
+
+static ssize_t rx_last_channel_show(struct device *dev,
+				    struct device_attribute *attr, char *buf)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", s->rx_last_channel);
+}
+
+/*
+ * rx_last_channel: ro sysfs entry.
+ * Returns the channel index of the latest received packet.
+ */
+static DEVICE_ATTR_RO(rx_last_channel);
+
+static ssize_t current_rssi_show(struct device *dev,
+				 struct device_attribute *attr, char *buf)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", s->current_rssi);
+}
+
+/*
+ * current_rssi: ro sysfs entry.
+ * Returns the latest rssi value measured by chip.
+ */
+static DEVICE_ATTR_RO(current_rssi);
+
+static ssize_t events_show(struct device *dev,
+			   struct device_attribute *attr, char *buf)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+	ssize_t ret = 0;
+	u32 i;
+
+	for (i = 0; i < SI4455_EVENT_COUNT; i++)
+		ret += sprintf(buf + ret, "%s %u\n", si4455_event_names[i],
+			       s->event_count[i]);
+
+	return ret;
+}
+
+/*
+ * events: ro sysfs entry.
+ * Returns the number of link events by type, one per line.
+ * Pollable, pollers are woken up(POLLPRI) on every event.
+ */
+static DEVICE_ATTR_RO(events);
+
+static ssize_t rssi_threshold_show(struct device *dev,
+				   struct device_attribute *attr, char *buf)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", s->rssi_threshold);
+}
+
+static ssize_t rssi_threshold_store(struct device *dev,
+				    struct device_attribute *attr,
+				    const char *buf, size_t count)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+	unsigned long val;
+	int ret;
+
+	ret = kstrtoul(buf, 10, &val);
+	if (ret)
+		return ret;
+
+	if (val > 255)
+		return -EINVAL;
+
+	mutex_lock(&s->mutex);
+	s->rssi_threshold = val;
+	s->rssi_low = false;
+	mutex_unlock(&s->mutex);
+
+	return count;
+}
+
+/*
+ * rssi_threshold: rw sysfs entry.
+ * Sets or returns the rssi level, received packets below it raise
+ * a rssi_low event. Zero disables the rssi events.
+ */
+static DEVICE_ATTR_RW(rssi_threshold);
+
+/*
+ * Starts the power control from the maximum level,
+ * the level of the image is restored when stopped.
+ */
+static int si4455_tpc_start(struct si4455_port *s, u32 target)
+{
+	int ret;
+
+	if (!si4455_tpc_enabled(s) && target) {
+		ret = si4455_get_property(&s->port, SI4455_PROP_GROUP_PA,
+					  SI4455_PROP_PA_PWR_LVL, 1,
+					  &s->tpc_saved_level);
+		if (ret)
+			return ret;
+
+		s->tpc_target_rssi = target;
+		s->tpc_restore = false;
+		return si4455_tpc_set_level(s, s->tpc_level_max);
+	}
+
+	if (si4455_tpc_enabled(s) && !target) {
+		s->tpc_target_rssi = 0;
+		s->tpc_restore = true;
+		ret = si4455_tpc_set_level(s, s->tpc_saved_level);
+		if (!ret && !s->props_pending)
+			s->tpc_restore = false;
+		return ret;
+	}
+
+	s->tpc_target_rssi = target;
+
+	return 0;
+}
+
+static ssize_t tpc_target_rssi_show(struct device *dev,
+				    struct device_attribute *attr, char *buf)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", s->tpc_target_rssi);
+}
+
+static ssize_t tpc_target_rssi_store(struct device *dev,
+				     struct device_attribute *attr,
+				     const char *buf, size_t count)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+	unsigned long val;
+	int ret;
+
+	ret = kstrtoul(buf, 10, &val);
+	if (ret)
+		return ret;
+
+	if (val > 255)
+		return -EINVAL;
+
+	mutex_lock(&s->mutex);
+	if (s->configured && s->power_count > 0)
+		ret = si4455_tpc_start(s, val);
+	else
+		ret = -ENODEV;
+	mutex_unlock(&s->mutex);
+
+	return ret ? ret : count;
+}
+
+/*
+ * tpc_target_rssi: rw sysfs entry.
+ * Sets or returns the rssi level the link peers should receive
+ * the packets at. Zero disables the transmit power control.
+ */
+static DEVICE_ATTR_RW(tpc_target_rssi);
+
+static ssize_t tpc_level_min_show(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", s->tpc_level_min);
+}
+
+static ssize_t tpc_level_min_store(struct device *dev,
+				   struct device_attribute *attr,
+				   const char *buf, size_t count)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+	unsigned long val;
+	int ret;
+
+	ret = kstrtoul(buf, 10, &val);
+	if (ret)
+		return ret;
+
+	mutex_lock(&s->mutex);
+	if (val > s->tpc_level_max) {
+		ret = -EINVAL;
+	} else {
+		s->tpc_level_min = val;
+		if (si4455_tpc_enabled(s) && s->tpc_level < val)
+			ret = si4455_tpc_set_level(s, val);
+	}
+	mutex_unlock(&s->mutex);
+
+	return ret ? ret : count;
+}
+
+/*
+ * tpc_level_min: rw sysfs entry.
+ * Sets or returns the lowest PA level of the transmit power control.
+ */
+static DEVICE_ATTR_RW(tpc_level_min);
+
+static ssize_t tpc_level_max_show(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", s->tpc_level_max);
+}
+
+static ssize_t tpc_level_max_store(struct device *dev,
+				   struct device_attribute *attr,
+				   const char *buf, size_t count)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+	unsigned long val;
+	int ret;
+
+	ret = kstrtoul(buf, 10, &val);
+	if (ret)
+		return ret;
+
+	mutex_lock(&s->mutex);
+	if (val > SI4455_PA_PWR_LVL_MAX || val < s->tpc_level_min) {
+		ret = -EINVAL;
+	} else {
+		s->tpc_level_max = val;
+		if (si4455_tpc_enabled(s) && s->tpc_level > val)
+			ret = si4455_tpc_set_level(s, val);
+	}
+	mutex_unlock(&s->mutex);
+
+	return ret ? ret : count;
+}
+
+/*
+ * tpc_level_max: rw sysfs entry.
+ * Sets or returns the highest PA level of the transmit power control,
+ * the control starts from this level.
+ */
+static DEVICE_ATTR_RW(tpc_level_max);
+
+static ssize_t tpc_crc_permille_show(struct device *dev,
+				     struct device_attribute *attr, char *buf)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", s->tpc_crc_permille);
+}
+
+static ssize_t tpc_crc_permille_store(struct device *dev,
+				      struct device_attribute *attr,
+				      const char *buf, size_t count)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+	unsigned long val;
+	int ret;
+
+	ret = kstrtoul(buf, 10, &val);
+	if (ret)
+		return ret;
+
+	if (val > 1000)
+		return -EINVAL;
+
+	mutex_lock(&s->mutex);
+	s->tpc_crc_permille = val;
+	mutex_unlock(&s->mutex);
+
+	return count;
+}
+
+/*
+ * tpc_crc_permille: rw sysfs entry.
+ * Sets or returns the CRC error ratio reported by a peer
+ * above which the PA level is raised.
+ */
+static DEVICE_ATTR_RW(tpc_crc_permille);
+
+static ssize_t tpc_level_show(struct device *dev,
+			      struct device_attribute *attr, char *buf)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", s->tpc_level);
+}
+
+/*
+ * tpc_level: ro sysfs entry.
+ * Returns the PA level set by the transmit power control.
+ */
+static DEVICE_ATTR_RO(tpc_level);
+
+static ssize_t profile_show(struct device *dev,
+			    struct device_attribute *attr, char *buf)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%s\n", s->profiles[s->profile].name);
+}
+
+static ssize_t profile_store(struct device *dev,
+			     struct device_attribute *attr,
+			     const char *buf, size_t count)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+	int ret = 0;
+	u32 i;
+
+	for (i = 0; i < s->profile_count; i++) {
+		if (sysfs_streq(buf, s->profiles[i].name))
+			break;
+	}
+	if (i == s->profile_count)
+		return -EINVAL;
+
+	mutex_lock(&s->mutex);
+	if (!s->configured || s->power_count == 0) {
+		ret = -ENODEV;
+	} else if (si4455_package_size_check(s, s->profiles[i].package_size)) {
+		/* The FEC parity does not fit into the packets of the profile */
+		ret = -EINVAL;
+	} else if (s->tx_pending) {
+		/* A transmission in progress is not disturbed */
+		s->profile_next = i;
+		s->profile_pending = true;
+	} else {
+		ret = si4455_profile_switch(s, i);
+	}
+	mutex_unlock(&s->mutex);
+	if (ret)
+		return ret;
+
+	schedule_work(&s->tx_work);
+
+	return count;
+}
+
+/*
+ * profile: rw sysfs entry.
+ * Sets or returns the name of the active radio configuration profile.
+ */
+static DEVICE_ATTR_RW(profile);
+
+static ssize_t profiles_show(struct device *dev,
+			     struct device_attribute *attr, char *buf)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+	ssize_t ret = 0;
+	u32 i;
+
+	for (i = 0; i < s->profile_count; i++)
+		ret += sprintf(buf + ret, "%s %u\n", s->profiles[i].name,
+			       s->profiles[i].package_size);
+
+	return ret;
+}
+
+/*
+ * profiles: ro sysfs entry.
+ * Returns the profiles of the firmware, one per line: name and package size.
+ */
+static DEVICE_ATTR_RO(profiles);
 
-	if (s->tx_pending) {
-		sent = (s->package_size == 0) ? s->tx_pending_size
-			: s->package_size;
-		port->icount.tx += sent;
-		xmit->tail = (xmit->tail + sent) & (UART_XMIT_SIZE - 1);
-		si4455_end_tx(port);
-		s->tx_pending = 0;
-		s->tx_pending_size = 0;
-		uart_handle_cts_change(&s->port, TIOCM_CTS);
-	}
+static ssize_t adr_show(struct device *dev,
+			struct device_attribute *attr, char *buf)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", s->adr);
 }
 
-static irqreturn_t si4455_ist(int irq, void *dev_id)
+static ssize_t adr_store(struct device *dev,
+			 struct device_attribute *attr,
+			 const char *buf, size_t count)
 {
-	struct si4455_port *s = (struct si4455_port *)dev_id;
-	struct uart_port *port = &s->port;
+	struct si4455_port *s = dev_get_drvdata(dev);
+	unsigned long val;
 	int ret;
-	struct si4455_int_status int_status = { 0 };
-	struct si4455_fifo_info fifo_info = { 0 };
-	bool have_to_do = false;
-
-	if (s->suspended || !s->connected || !s->configured || s->power_count == 0)
-		return IRQ_NONE;
 
-	mutex_lock(&s->mutex);
-	ret = si4455_get_int_status(port, 0, 0, 0, &int_status);
-	if (ret) {
-		mutex_unlock(&s->mutex);
-		return IRQ_NONE;
-	}
+	ret = kstrtoul(buf, 10, &val);
+	if (ret)
+		return ret;
 
-	dev_dbg(port->dev, "%s: int_pend: 0x%x\n", __func__, int_status.int_pend);
-	dev_dbg(port->dev, "%s: int_status: 0x%x\n", __func__, int_status.int_status);
-	dev_dbg(port->dev, "%s: ph_pend: 0x%x\n", __func__, int_status.ph_pend);
-	dev_dbg(port->dev, "%s: ph_status: 0x%x\n", __func__, int_status.ph_status);
-	dev_dbg(port->dev, "%s: modem_pend: 0x%x\n", __func__, int_status.modem_pend);
-	dev_dbg(port->dev, "%s: modem_status: 0x%x\n", __func__, int_status.modem_status);
-	dev_dbg(port->dev, "%s: chip_pend: 0x%x\n", __func__, int_status.chip_pend);
-	dev_dbg(port->dev, "%s: chip_status: 0x%x\n", __func__, int_status.chip_status);
+	if (val > 1 || (val && s->profile_count < 2))
+		return -EINVAL;
 
-	if (int_status.chip_pend & SI4455_CMD_GET_CHIP_STATUS_ERROR_PEND_BIT) {
-		dev_err(port->dev, "%s: chip_pend:CMD_ERROR_PEND\n", __func__);
-		si4455_change_state(port, SI4455_CMD_CHANGE_STATE_STATE_SLEEP);
-		si4455_fifo_info(&s->port, SI4455_CMD_FIFO_INFO_ARG_RX_BIT,
-				 &fifo_info);
-		have_to_do = true;
-	} else if (int_status.ph_pend & SI4455_CMD_GET_INT_STATUS_PACKET_SENT_PEND_BIT) {
-		dev_dbg(port->dev, "%s: ph_pend:PACKET_SENT_PEND\n", __func__);
-		si4455_change_state(port, SI4455_CMD_CHANGE_STATE_STATE_SLEEP);
-		si4455_handle_tx_pend(s);
-		have_to_do = true;
-	} else if (int_status.ph_pend & SI4455_CMD_GET_INT_STATUS_PACKET_RX_PEND_BIT) {
-		dev_dbg(port->dev, "%s: ph_pend:PACKET_RX_PEND\n", __func__);
-		si4455_get_modem_status(port, 0, &s->modem_status);
-		s->current_rssi = s->modem_status.curr_rssi;
-		si4455_change_state(port, SI4455_CMD_CHANGE_STATE_STATE_SLEEP);
-		si4455_fifo_info(port, 0, &fifo_info);
-		si4455_handle_rx_pend(s, &fifo_info);
-		have_to_do = true;
-	} else if (int_status.ph_pend & SI4455_CMD_GET_INT_STATUS_CRC_ERROR_BIT) {
-		dev_dbg(port->dev, "%s: ph_pend:CRC_ERROR_PEND\n", __func__);
-		si4455_change_state(port, SI4455_CMD_CHANGE_STATE_STATE_SLEEP);
-		si4455_fifo_info(&s->port, SI4455_CMD_FIFO_INFO_ARG_RX_BIT,
-				 &fifo_info);
-		have_to_do = true;
-	}
+	mutex_lock(&s->mutex);
+	s->adr = val;
+	s->adr_request_pending = false;
+	si4455_adr_update(s);
 	mutex_unlock(&s->mutex);
-	if (have_to_do)
-		si4455_do_work(port);
-	return IRQ_HANDLED;
+
+	return count;
 }
 
-static void si4455_tx_wd_event(struct timer_list *t)
+/*
+ * adr: rw sysfs entry.
+ * Enables(1) or disables(0) the data rate adaptation across the profiles,
+ * the profiles are ordered from the most robust to the fastest.
+ */
+static DEVICE_ATTR_RW(adr);
+
+static ssize_t adr_rssi_low_show(struct device *dev,
+				 struct device_attribute *attr, char *buf)
 {
-	struct si4455_port *s = from_timer(s, t, tx_wd_timer);
+	struct si4455_port *s = dev_get_drvdata(dev);
 
-	if (s->tx_pending)
-		schedule_work(&s->tx_wd_work);
+	return sprintf(buf, "%u\n", s->adr_rssi_low);
 }
 
-static void si4455_tx_wd_proc(struct work_struct *ws)
+static ssize_t adr_rssi_low_store(struct device *dev,
+				  struct device_attribute *attr,
+				  const char *buf, size_t count)
 {
-	struct si4455_port *s = container_of(ws, struct si4455_port, tx_wd_work);
-	bool have_to_work = false;
+	struct si4455_port *s = dev_get_drvdata(dev);
+	unsigned long val;
+	int ret;
+
+	ret = kstrtoul(buf, 10, &val);
+	if (ret)
+		return ret;
+
+	if (val > 255)
+		return -EINVAL;
 
 	mutex_lock(&s->mutex);
-	if (s->connected && s->tx_pending) {
-		si4455_cancel_tx(&s->port);
-		s->tx_error_count++;
-		have_to_work = true;
-		dev_err(s->port.dev,
-			"%s: curent transmit operation interrupted by wd timeout\n",
-			__func__);
-	}
+	s->adr_rssi_low = val;
 	mutex_unlock(&s->mutex);
 
-	if (have_to_work)
-		si4455_do_work(&s->port);
+	return count;
 }
 
-static void si4455_cts_wd_event(struct timer_list *t)
+/*
+ * adr_rssi_low: rw sysfs entry.
+ * Sets or returns the rssi level below which the data rate is lowered.
+ */
+static DEVICE_ATTR_RW(adr_rssi_low);
+
+static ssize_t adr_rssi_high_show(struct device *dev,
+				  struct device_attribute *attr, char *buf)
 {
-	struct si4455_port *s = from_timer(s, t, cts_wd_timer);
+	struct si4455_port *s = dev_get_drvdata(dev);
 
-	if (s->cts_error)
-		schedule_work(&s->cts_wd_work);
-	else
-		mod_timer(&s->cts_wd_timer, jiffies + msecs_to_jiffies(100));
+	return sprintf(buf, "%u\n", s->adr_rssi_high);
 }
 
-static void si4455_cts_wd_proc(struct work_struct *ws)
+static ssize_t adr_rssi_high_store(struct device *dev,
+				   struct device_attribute *attr,
+				   const char *buf, size_t count)
 {
-	struct si4455_port *s = container_of(ws, struct si4455_port, cts_wd_work);
-	const struct firmware *ez_fw = NULL;
-	bool have_to_work = false;
+	struct si4455_port *s = dev_get_drvdata(dev);
+	unsigned long val;
 	int ret;
 
+	ret = kstrtoul(buf, 10, &val);
+	if (ret)
+		return ret;
+
+	if (val > 255)
+		return -EINVAL;
+
 	mutex_lock(&s->mutex);
-	if (s->cts_error) {
-		dev_err(s->port.dev, "%s: interface recovery\n", __func__);
-		ret = request_firmware(&ez_fw, s->ez_fw_name, s->port.dev);
-		if (ret) {
-			dev_err(s->port.dev, "%s: firmware(%s) request error (%i)\n",
-				__func__, s->ez_fw_name, ret);
-		} else {
-			si4455_s_power(s->port.dev, false);
-			ret = si4455_re_configure(&s->port, ez_fw);
-			release_firmware(ez_fw);
-			if (ret) {
-				dev_err(s->port.dev, "%s: device configuration error (%i)\n",
-					__func__, ret);
-			}
-		}
-		have_to_work = !ret;
-	}
-	if (s->connected)
-		mod_timer(&s->cts_wd_timer, jiffies + msecs_to_jiffies(100));
+	s->adr_rssi_high = val;
 	mutex_unlock(&s->mutex);
 
-	if (have_to_work)
-		si4455_do_work(&s->port);
+	return count;
 }
 
-static void si4455_tx_proc(struct work_struct *ws)
-{
-	struct si4455_port *s = container_of(ws, struct si4455_port, tx_work);
-
-	si4455_do_work(&s->port);
-}
+/*
+ * adr_rssi_high: rw sysfs entry.
+ * Sets or returns the rssi level from which the data rate is raised.
+ */
+static DEVICE_ATTR_RW(adr_rssi_high);
 
-static unsigned int si4455_tx_empty(struct uart_port *port)
+static ssize_t adr_crc_permille_show(struct device *dev,
+				     struct device_attribute *attr, char *buf)
 {
-	struct si4455_port *s = dev_get_drvdata(port->dev);
+	struct si4455_port *s = dev_get_drvdata(dev);
 
-	return s->tx_pending ? 0 : TIOCSER_TEMT;
+	return sprintf(buf, "%u\n", s->adr_crc_permille);
 }
 
-static unsigned int si4455_get_mctrl(struct uart_port *port)
+static ssize_t adr_crc_permille_store(struct device *dev,
+				      struct device_attribute *attr,
+				      const char *buf, size_t count)
 {
+	struct si4455_port *s = dev_get_drvdata(dev);
+	unsigned long val;
 	int ret;
-	struct si4455_port *s = dev_get_drvdata(port->dev);
 
-	/*
-	 * there is no a continuous real "carrier" like on phone line,
-	 * but after configuration, the interface is ready to use the physical
-	 * transport channel
-	 */
-	ret = s->configured ? TIOCM_CAR | TIOCM_DSR : 0;
-	ret |= s->tx_pending ? 0 : TIOCM_CTS;
+	ret = kstrtoul(buf, 10, &val);
+	if (ret)
+		return ret;
 
-	return ret;
-}
+	if (val > 1000)
+		return -EINVAL;
 
-static void si4455_set_mctrl(struct uart_port *port, unsigned int mctrl)
-{
+	mutex_lock(&s->mutex);
+	s->adr_crc_permille = val;
+	mutex_unlock(&s->mutex);
+
+	return count;
 }
 
-static void si4455_set_termios(struct uart_port *port, struct ktermios *termios,
-			       struct ktermios *old)
+/*
+ * adr_crc_permille: rw sysfs entry.
+ * Sets or returns the CRC error ratio above which the data rate is lowered.
+ */
+static DEVICE_ATTR_RW(adr_crc_permille);
+
+static ssize_t adr_retry_permille_show(struct device *dev,
+				       struct device_attribute *attr, char *buf)
 {
-	dev_dbg(port->dev, "termios->c_iflag = 0x%x", termios->c_iflag);
-	dev_dbg(port->dev, "termios->c_oflag = 0x%x", termios->c_oflag);
-	dev_dbg(port->dev, "termios->c_cflag = 0x%x", termios->c_cflag);
-	dev_dbg(port->dev, "termios->c_lflag = 0x%x", termios->c_lflag);
-	dev_dbg(port->dev, "termios->c_ispeed = %u", termios->c_ispeed);
-	dev_dbg(port->dev, "termios->c_ospeed = %u", termios->c_ospeed);
-	if ((termios->c_cflag & CSIZE) != CS8)
-		dev_err(port->dev, "%s: CSIZE must be CS8\n", __func__);
+	struct si4455_port *s = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", s->adr_retry_permille);
 }
 
-static int si4455_startup(struct uart_port *port)
+static ssize_t adr_retry_permille_store(struct device *dev,
+					struct device_attribute *attr,
+					const char *buf, size_t count)
 {
-	struct si4455_port *s = dev_get_drvdata(port->dev);
+	struct si4455_port *s = dev_get_drvdata(dev);
+	unsigned long val;
+	int ret;
+
+	ret = kstrtoul(buf, 10, &val);
+	if (ret)
+		return ret;
+
+	if (val > 1000)
+		return -EINVAL;
 
 	mutex_lock(&s->mutex);
-	s->tx_pending = false;
-	s->tx_stopped = false;
-	s->rx_stopped = false;
-	s->connected = true;
-	mod_timer(&s->cts_wd_timer, jiffies + msecs_to_jiffies(100));
+	s->adr_retry_permille = val;
 	mutex_unlock(&s->mutex);
-	return si4455_do_work(port);
+
+	return count;
 }
 
-static void si4455_shutdown(struct uart_port *port)
+/*
+ * adr_retry_permille: rw sysfs entry.
+ * Sets or returns the retransmission ratio above which the data rate
+ * is lowered.
+ */
+static DEVICE_ATTR_RW(adr_retry_permille);
+
+static const char * const si4455_per_modes[] = {
+	[SI4455_PER_OFF] = "off",
+	[SI4455_PER_TX] = "tx",
+	[SI4455_PER_RX] = "rx",
+};
+
+/*
+ * Starts or stops a test, the results are cleared on start.
+ * A test on a closed port opens the radio until it is stopped.
+ */
+static int si4455_per_start(struct si4455_port *s, u32 mode)
 {
-	struct si4455_port *s = dev_get_drvdata(port->dev);
+	bool connect = false;
+	bool disconnect = false;
+	int ret = 0;
 
+	mutex_lock(&si4455_bond_lock);
 	mutex_lock(&s->mutex);
-	del_timer_sync(&s->tx_wd_timer);
-	del_timer_sync(&s->cts_wd_timer);
-	s->connected = false;
-	si4455_change_state(&s->port, SI4455_CMD_CHANGE_STATE_STATE_SLEEP);
+	if (mode != SI4455_PER_OFF && (s->bond_master || s->bond_count)) {
+		ret = -EBUSY;
+		goto out;
+	}
+
+	hrtimer_cancel(&s->per_timer);
+	s->per_mode = mode;
+	if (mode != SI4455_PER_OFF) {
+		memset(&s->per_stats, 0, sizeof(s->per_stats));
+		if (!s->connected) {
+			connect = true;
+			s->per_connected = true;
+		}
+	} else {
+		disconnect = s->per_connected;
+		s->per_connected = false;
+	}
+out:
 	mutex_unlock(&s->mutex);
-}
+	mutex_unlock(&si4455_bond_lock);
 
-static const char *si4455_type(struct uart_port *port)
-{
-	struct si4455_port *s = dev_get_drvdata(port->dev);
+	if (ret)
+		return ret;
 
-	if (port->type != PORT_SI4455)
-		return NULL;
-	if (s->part_info.rom_id == 3)
-		return "SI4455-B1A";
-	else if (s->part_info.rom_id == 6)
-		return "SI4455-C2A";
+	if (connect)
+		return si4455_connect(s);
 
-	return "SI4455(UNKNOWN-REV)";
-}
+	if (disconnect)
+		si4455_disconnect(s);
+	else
+		schedule_work(&s->tx_work);
 
-static void si4455_config_port(struct uart_port *port, int flags)
-{
-	if (flags & UART_CONFIG_TYPE)
-		port->type = PORT_SI4455;
+	return 0;
 }
 
-static int si4455_verify_port(struct uart_port *port, struct serial_struct *s)
+static ssize_t per_test_show(struct device *dev,
+			     struct device_attribute *attr, char *buf)
 {
-	if (s->type != PORT_UNKNOWN && s->type != PORT_SI4455)
-		return -EINVAL;
-
-	if (s->irq != port->irq)
-		return -EINVAL;
+	struct si4455_port *s = dev_get_drvdata(dev);
 
-	return 0;
+	return sprintf(buf, "%s\n", si4455_per_modes[s->per_mode]);
 }
 
-static void si4455_start_tx(struct uart_port *port)
+static ssize_t per_test_store(struct device *dev,
+			      struct device_attribute *attr,
+			      const char *buf, size_t count)
 {
-	struct si4455_port *s = container_of(port, struct si4455_port, port);
+	struct si4455_port *s = dev_get_drvdata(dev);
+	int mode;
+	int ret;
 
-	s->tx_stopped = false;
-	schedule_work(&s->tx_work);
+	mode = sysfs_match_string(si4455_per_modes, buf);
+	if (mode < 0)
+		return mode;
+
+	ret = si4455_per_start(s, mode);
+
+	return ret ? ret : count;
 }
 
-static void si4455_stop_tx(struct uart_port *port)
+/*
+ * per_test: rw sysfs entry.
+ * Starts(tx, rx) or stops(off) the packet error rate test,
+ * or returns the current test mode.
+ */
+static DEVICE_ATTR_RW(per_test);
+
+static ssize_t per_count_show(struct device *dev,
+			      struct device_attribute *attr, char *buf)
 {
-	struct si4455_port *s = container_of(port, struct si4455_port, port);
+	struct si4455_port *s = dev_get_drvdata(dev);
 
-	s->tx_stopped = true;
+	return sprintf(buf, "%u\n", s->per_count);
 }
 
-static void si4455_stop_rx(struct uart_port *port)
+static ssize_t per_count_store(struct device *dev,
+			       struct device_attribute *attr,
+			       const char *buf, size_t count)
 {
-	struct si4455_port *s = container_of(port, struct si4455_port, port);
+	struct si4455_port *s = dev_get_drvdata(dev);
+	unsigned long val;
+	int ret;
+
+	ret = kstrtoul(buf, 10, &val);
+	if (ret)
+		return ret;
+
+	if (val == 0 || val > SI4455_PER_COUNT_MAX)
+		return -EINVAL;
 
 	mutex_lock(&s->mutex);
-	s->rx_stopped = true;
-	si4455_change_state(&s->port, SI4455_CMD_CHANGE_STATE_STATE_SLEEP);
+	s->per_count = val;
 	mutex_unlock(&s->mutex);
+
+	return count;
 }
 
-static const struct uart_ops si4455_ops = {
-	.tx_empty		= si4455_tx_empty,
-	/*
-	 * set_mctrl: required by serial_core, but not used
-	 */
-	.set_mctrl		= si4455_set_mctrl,
-	.get_mctrl		= si4455_get_mctrl,
-	.stop_tx		= si4455_stop_tx,
-	.start_tx		= si4455_start_tx,
-	.stop_rx		= si4455_stop_rx,
-	.startup		= si4455_startup,
-	.shutdown		= si4455_shutdown,
-	.set_termios		= si4455_set_termios,
-	.type			= si4455_type,
-	.config_port		= si4455_config_port,
-	.verify_port		= si4455_verify_port,
-};
+/*
+ * per_count: rw sysfs entry.
+ * Sets or returns the number of packets sent by a tx test.
+ * The new value will be used on next test start.
+ */
+static DEVICE_ATTR_RW(per_count);
 
-static void si4455_debugfs_init(struct device *dev)
+static ssize_t per_interval_us_show(struct device *dev,
+				    struct device_attribute *attr, char *buf)
 {
 	struct si4455_port *s = dev_get_drvdata(dev);
-	struct dentry *dbgfs_si_dir;
-	struct dentry *dbgfs_partinfo_dir;
 
-	s->dbgfs_dir = debugfs_create_dir(dev_name(dev), NULL);
-
-	dbgfs_si_dir = debugfs_create_dir("si4455", s->dbgfs_dir);
-
-	debugfs_create_u32("cts_error_count", 0444, dbgfs_si_dir,
-			   &s->cts_error_count);
+	return sprintf(buf, "%u\n", s->per_interval_us);
+}
 
-	debugfs_create_u32("tx_error_count", 0444, dbgfs_si_dir,
-			   &s->tx_error_count);
+static ssize_t per_interval_us_store(struct device *dev,
+				     struct device_attribute *attr,
+				     const char *buf, size_t count)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+	unsigned long val;
+	int ret;
 
-	dbgfs_partinfo_dir = debugfs_create_dir("partinfo", dbgfs_si_dir);
+	ret = kstrtoul(buf, 10, &val);
+	if (ret)
+		return ret;
 
-	debugfs_create_u8("chip_rev", 0444, dbgfs_partinfo_dir,
-			  &s->part_info.chip_rev);
+	if (val > UINT_MAX)
+		return -EINVAL;
 
-	debugfs_create_u8("rom_id", 0444, dbgfs_partinfo_dir,
-			  &s->part_info.rom_id);
+	mutex_lock(&s->mutex);
+	s->per_interval_us = val;
+	mutex_unlock(&s->mutex);
 
-	debugfs_create_u16("part", 0444, dbgfs_partinfo_dir,
-			   &s->part_info.part);
+	return count;
 }
 
-static void si4455_debugfs_clear(struct device *dev)
+/*
+ * per_interval_us: rw sysfs entry.
+ * Sets or returns the time between the starts of the test packets,
+ * zero sends them back to back.
+ */
+static DEVICE_ATTR_RW(per_interval_us);
+
+static ssize_t per_stats_show(struct device *dev,
+			      struct device_attribute *attr, char *buf)
 {
 	struct si4455_port *s = dev_get_drvdata(dev);
+	struct si4455_per_stats per;
+	u32 missing = 0;
+	u32 per_ppm = 0;
+	u32 rssi_avg = 0;
 
-	debugfs_remove_recursive(s->dbgfs_dir);
+	mutex_lock(&s->mutex);
+	per = s->per_stats;
+	mutex_unlock(&s->mutex);
+
+	if (per.count > per.received + per.crc_error)
+		missing = per.count - per.received - per.crc_error;
+	if (per.count && per.count >= per.good)
+		per_ppm = div_u64((u64)(per.count - per.good) * 1000000,
+				  per.count);
+	if (per.received)
+		rssi_avg = div_u64(per.rssi_sum, per.received);
+
+	return sprintf(buf,
+		       "sent %u\ncount %u\ngood %u\ncrc_error %u\nbit_error %u\nbit_errors %u\nmissing %u\nduplicate %u\nother %u\nrssi_min %u\nrssi_avg %u\nrssi_max %u\nper_ppm %u\n",
+		       per.sent, per.count, per.good, per.crc_error,
+		       per.bit_error, per.bit_errors, missing, per.duplicate,
+		       per.other, per.rssi_min, rssi_avg, per.rssi_max,
+		       per_ppm);
 }
 
-static int __maybe_unused si4455_suspend(struct device *dev)
+/*
+ * per_stats: ro sysfs entry.
+ * Returns the results of the current or last test, one per line.
+ * Pollable, the transmitter notifies when the last packet is sent.
+ */
+static DEVICE_ATTR_RO(per_stats);
+
+/*
+ * Starts or aborts a survey sweep.
+ * A survey started on a closed port opens the radio until its end.
+ */
+static int si4455_survey_start(struct si4455_port *s, bool start)
 {
-	int ret;
-	struct si4455_port *s = dev_get_drvdata(dev);
+	bool connect = false;
+	bool disconnect = false;
+	int ret = 0;
 
+	mutex_lock(&si4455_bond_lock);
 	mutex_lock(&s->mutex);
-	ret = si4455_cancel_tx(&s->port);
-	if (ret) {
-		mutex_unlock(&s->mutex);
-		dev_err(dev, "%s: si4455_cancel_tx error (%i)\n",
-			__func__, ret);
-		return ret;
-	}
+	if (start) {
+		if (s->bond_master || s->bond_count) {
+			ret = -EBUSY;
+			goto out;
+		}
 
-	ret = si4455_change_state(&s->port, SI4455_CMD_CHANGE_STATE_STATE_SLEEP);
-	s->suspended = !ret;
+		if (!s->survey_table_len) {
+			ret = -EINVAL;
+			goto out;
+		}
+
+		s->survey_active = true;
+		s->survey_index = 0;
+		s->survey_sample = 0;
+		if (!s->connected) {
+			connect = true;
+			s->survey_connected = true;
+		}
+		hrtimer_start(&s->survey_timer,
+			      us_to_ktime(s->survey_interval_us),
+			      HRTIMER_MODE_REL);
+	} else if (s->survey_active) {
+		s->survey_active = false;
+		hrtimer_cancel(&s->survey_timer);
+		disconnect = s->survey_connected;
+		s->survey_connected = false;
+	}
+out:
 	mutex_unlock(&s->mutex);
+	mutex_unlock(&si4455_bond_lock);
 
-	if (ret) {
-		dev_err(dev, "%s: si4455_change_state error (%i)\n",
-			__func__, ret);
+	if (ret)
 		return ret;
-	}
 
-	return uart_suspend_port(&si4455_uart, &s->port);
+	if (connect)
+		return si4455_connect(s);
+
+	if (disconnect)
+		si4455_disconnect(s);
+	else
+		schedule_work(&s->tx_work);
+
+	return 0;
 }
 
-static int __maybe_unused si4455_resume(struct device *dev)
+static ssize_t survey_show(struct device *dev,
+			   struct device_attribute *attr, char *buf)
 {
-	int ret;
 	struct si4455_port *s = dev_get_drvdata(dev);
 
-	ret = uart_resume_port(&si4455_uart, &s->port);
-	if (ret) {
-		dev_err(dev, "%s: uart_resume_port error (%i)\n",
-			__func__, ret);
+	return sprintf(buf, "%u\n", s->survey_active);
+}
+
+static ssize_t survey_store(struct device *dev,
+			    struct device_attribute *attr,
+			    const char *buf, size_t count)
+{
+	struct si4455_port *s = dev_get_drvdata(dev);
+	unsigned long val;
+	int ret;
+
+	ret = kstrtoul(buf, 10, &val);
+	if (ret)
 		return ret;
-	}
 
-	s->suspended = false;
-	s->rx_stopped = false;
+	if (val > 1)
+		return -EINVAL;
 
-	return si4455_do_work(&s->port);
+	ret = si4455_survey_start(s, val);
+
+	return ret ? ret : count;
 }
 
-static SIMPLE_DEV_PM_OPS(si4455_pm_ops, si4455_suspend, si4455_resume);
+/*
+ * survey: rw sysfs entry.
+ * Starts(1) or aborts(0) a sweep over the survey_table channels,
+ * or returns whether a sweep is running.
+ * Pollable, pollers are woken up(POLLPRI) at the end of the sweep.
+ */
+static DEVICE_ATTR_RW(survey);
 
-static ssize_t package_size_show(struct device *dev,
+static ssize_t survey_table_show(struct device *dev,
 				 struct device_attribute *attr, char *buf)
 {
 	struct si4455_port *s = dev_get_drvdata(dev);
+	ssize_t ret;
 
-	return sprintf(buf, "%u\n", s->package_size);
+	mutex_lock(&s->mutex);
+	ret = si4455_show_channel_list(buf, s->survey_table,
+				       s->survey_table_len);
+	mutex_unlock(&s->mutex);
+
+	return ret;
 }
 
-static ssize_t package_size_store(struct device *dev,
+static ssize_t survey_table_store(struct device *dev,
 				  struct device_attribute *attr,
 				  const char *buf, size_t count)
 {
 	struct si4455_port *s = dev_get_drvdata(dev);
-	unsigned long val;
+	u8 table[SI4455_CHANNEL_LIST_MAX];
 	int ret;
 
-	ret = kstrtoul(buf, 10, &val);
-	if (ret)
+	ret = si4455_parse_channel_list(buf, table, ARRAY_SIZE(table));
+	if (ret < 0)
 		return ret;
 
-	if (val > SI4455_FIFO_SIZE)
-		return -EINVAL;
-
-	s->package_size = val;
-	ret = si4455_do_work(&s->port);
+	mutex_lock(&s->mutex);
+	if (s->survey_active) {
+		mutex_unlock(&s->mutex);
+		return -EBUSY;
+	}
+	memcpy(s->survey_table, table, ret);
+	s->survey_table_len = ret;
+	mutex_unlock(&s->mutex);
 
-	return ret ? ret : count;
+	return count;
 }
 
 /*
- * package_size: rw sysfs entry.
- * Sets or returns the package size.
- * The new value applied immediately.
- * Variable package size (package_size == 0)
- * currently not supported by driver.
+ * survey_table: rw sysfs entry.
+ * Sets or returns the surveyed channel list.
+ * Channel indexes separated by space or comma.
  */
-static DEVICE_ATTR_RW(package_size);
+static DEVICE_ATTR_RW(survey_table);
 
-static ssize_t rx_channel_show(struct device *dev,
-			       struct device_attribute *attr, char *buf)
+static ssize_t survey_samples_show(struct device *dev,
+				   struct device_attribute *attr, char *buf)
 {
 	struct si4455_port *s = dev_get_drvdata(dev);
 
-	return sprintf(buf, "%u\n", s->rx_channel);
+	return sprintf(buf, "%u\n", s->survey_samples);
 }
 
-static ssize_t rx_channel_store(struct device *dev,
-				struct device_attribute *attr,
-				const char *buf, size_t count)
+static ssize_t survey_samples_store(struct device *dev,
+				    struct device_attribute *attr,
+				    const char *buf, size_t count)
 {
 	struct si4455_port *s = dev_get_drvdata(dev);
 	unsigned long val;
@@ -1284,30 +7820,37 @@ static ssize_t rx_channel_store(struct device *dev,
 	if (ret)
 		return ret;
 
-	s->rx_channel = val;
-	ret = si4455_do_work(&s->port);
+	if (val == 0 || val > SI4455_SURVEY_SAMPLES_MAX)
+		return -EINVAL;
 
-	return ret ? ret : count;
+	mutex_lock(&s->mutex);
+	if (s->survey_active) {
+		mutex_unlock(&s->mutex);
+		return -EBUSY;
+	}
+	s->survey_samples = val;
+	mutex_unlock(&s->mutex);
+
+	return count;
 }
 
 /*
- * rx_channel: rw sysfs entry.
- * Sets or returns the receive channel index.
- * The new value applied immediately.
+ * survey_samples: rw sysfs entry.
+ * Sets or returns the number of RSSI samples taken on each channel.
  */
-static DEVICE_ATTR_RW(rx_channel);
+static DEVICE_ATTR_RW(survey_samples);
 
-static ssize_t tx_channel_show(struct device *dev,
-			       struct device_attribute *attr, char *buf)
+static ssize_t survey_interval_us_show(struct device *dev,
+				       struct device_attribute *attr, char *buf)
 {
 	struct si4455_port *s = dev_get_drvdata(dev);
 
-	return sprintf(buf, "%u\n", s->tx_channel);
+	return sprintf(buf, "%u\n", s->survey_interval_us);
 }
 
-static ssize_t tx_channel_store(struct device *dev,
-				struct device_attribute *attr,
-				const char *buf, size_t count)
+static ssize_t survey_interval_us_store(struct device *dev,
+					struct device_attribute *attr,
+					const char *buf, size_t count)
 {
 	struct si4455_port *s = dev_get_drvdata(dev);
 	unsigned long val;
@@ -1317,30 +7860,35 @@ static ssize_t tx_channel_store(struct device *dev,
 	if (ret)
 		return ret;
 
-	s->tx_channel = val;
-	ret = si4455_do_work(&s->port);
+	if (val < SI4455_SURVEY_INTERVAL_MIN_US || val > UINT_MAX)
+		return -EINVAL;
 
-	return ret ? ret : count;
+	mutex_lock(&s->mutex);
+	s->survey_interval_us = val;
+	mutex_unlock(&s->mutex);
+
+	return count;
 }
 
 /*
- * tx_channel: rw sysfs entry.
- * Sets or returns the transmit channel index.
- * The new value will be used on next data transmit.
+ * survey_interval_us: rw sysfs entry.
+ * Sets or returns the time(us) between the RSSI samples.
+ * The new value will be used on next sweep.
  */
-static DEVICE_ATTR_RW(tx_channel);
+static DEVICE_ATTR_RW(survey_interval_us);
 
-static ssize_t tx_timeout_show(struct device *dev,
-			       struct device_attribute *attr, char *buf)
+static ssize_t survey_busy_permille_show(struct device *dev,
+					 struct device_attribute *attr,
+					 char *buf)
 {
 	struct si4455_port *s = dev_get_drvdata(dev);
 
-	return sprintf(buf, "%u\n", s->tx_wd_timeout);
+	return sprintf(buf, "%u\n", s->survey_busy_permille);
 }
 
-static ssize_t tx_timeout_store(struct device *dev,
-				struct device_attribute *attr,
-				const char *buf, size_t count)
+static ssize_t survey_busy_permille_store(struct device *dev,
+					  struct device_attribute *attr,
+					  const char *buf, size_t count)
 {
 	struct si4455_port *s = dev_get_drvdata(dev);
 	unsigned long val;
@@ -1350,32 +7898,99 @@ static ssize_t tx_timeout_store(struct device *dev,
 	if (ret)
 		return ret;
 
-	s->tx_wd_timeout = val;
-	ret = si4455_do_work(&s->port);
+	if (val > 1000)
+		return -EINVAL;
 
-	return ret ? ret : count;
+	mutex_lock(&s->mutex);
+	s->survey_busy_permille = val;
+	si4455_hop_skip_update(s);
+	mutex_unlock(&s->mutex);
+
+	return count;
 }
 
 /*
- * tx_timeout: rw sysfs entry.
- * Sets or returns the transmit timeout.
- * The new value will be used on next data transmit.
+ * survey_busy_permille: rw sysfs entry.
+ * Sets or returns the occupancy above which hopping skips a channel.
+ * Zero disables skipping.
  */
-static DEVICE_ATTR_RW(tx_timeout);
+static DEVICE_ATTR_RW(survey_busy_permille);
 
-static ssize_t current_rssi_show(struct device *dev,
-				 struct device_attribute *attr, char *buf)
+static ssize_t survey_results_show(struct device *dev,
+				   struct device_attribute *attr, char *buf)
 {
 	struct si4455_port *s = dev_get_drvdata(dev);
+	struct si4455_survey_result *result;
+	ssize_t ret = 0;
+	u32 i;
 
-	return sprintf(buf, "%u\n", s->current_rssi);
+	mutex_lock(&s->mutex);
+	for (i = 0; i < s->survey_results_len; i++) {
+		result = &s->survey_results[i];
+		ret += sprintf(buf + ret, "%u %u %u %u %u %u\n",
+			       result->channel, result->noise_floor,
+			       result->median, result->max,
+			       result->occupancy_permille,
+			       si4455_hop_skipped(s, result->channel));
+	}
+	mutex_unlock(&s->mutex);
+
+	return ret;
 }
 
 /*
- * current_rssi: ro sysfs entry.
- * Returns the latest rssi value measured by chip.
+ * survey_results: ro sysfs entry.
+ * Returns the result of the last sweep, one channel per line:
+ * channel, noise floor, median and maximum rssi, occupancy(permille),
+ * skipped by hopping(1) or not(0).
  */
-static DEVICE_ATTR_RO(current_rssi);
+static DEVICE_ATTR_RO(survey_results);
+
+static ssize_t stats_read(struct file *filp, struct kobject *kobj,
+			  struct bin_attribute *attr, char *buf,
+			  loff_t off, size_t count)
+{
+	struct si4455_port *s = dev_get_drvdata(kobj_to_dev(kobj));
+	struct si4455_link_stats stats;
+	ktime_t now = ktime_get();
+
+	if (off >= sizeof(stats))
+		return 0;
+
+	count = min_t(size_t, count, sizeof(stats) - off);
+
+	mutex_lock(&s->mutex);
+	stats = s->stats;
+	stats.cts_error_count = s->cts_error_count;
+	stats.tx_error_count = s->tx_error_count;
+	stats.tx_bytes_per_sec = si4455_rate_get(&s->stats_tx_rate, now);
+	stats.rx_bytes_per_sec = si4455_rate_get(&s->stats_rx_rate, now);
+	if (stats.rssi_count) {
+		stats.rssi_avg = div64_u64(s->stats_rssi_sum, stats.rssi_count);
+		stats.afc_avg = div64_s64(s->stats_afc_sum, stats.rssi_count);
+		/* the average keeps 4 fractional bits */
+		stats.rssi_ewma_x16 = s->stats_rssi_ewma.internal;
+	}
+	mutex_unlock(&s->mutex);
+
+	stats.version = SI4455_STATS_VERSION;
+	stats.size = sizeof(stats);
+	stats.timestamp_ns = ktime_to_ns(now);
+	memcpy(buf, (u8 *)&stats + off, count);
+
+	return count;
+}
+
+/*
+ * stats: ro binary sysfs entry.
+ * Returns the link statistics snapshot(struct si4455_link_stats).
+ */
+static BIN_ATTR_RO(stats, sizeof(struct si4455_link_stats));
+
+static struct bin_attribute *si4455_bin_attributes[] = {
+	&bin_attr_stats,
+	NULL
+};
 
 static struct attribute *si4455_attributes[] = {
 	&dev_attr_package_size.attr,
@@ -1383,11 +7998,58 @@ static struct attribute *si4455_attributes[] = {
 	&dev_attr_tx_channel.attr,
 	&dev_attr_tx_timeout.attr,
 	&dev_attr_current_rssi.attr,
+	&dev_attr_hop_table.attr,
+	&dev_attr_hop_dwell_us.attr,
+	&dev_attr_hop_master.attr,
+	&dev_attr_scan_table.attr,
+	&dev_attr_scan_dwell_us.attr,
+	&dev_attr_rx_last_channel.attr,
+	&dev_attr_csma_threshold.attr,
+	&dev_attr_csma_slot_us.attr,
+	&dev_attr_csma_max_backoffs.attr,
+	&dev_attr_arq_window.attr,
+	&dev_attr_arq_retries.attr,
+	&dev_attr_arq_ack_delay_us.attr,
+	&dev_attr_mtu.attr,
+	&dev_attr_reasm_timeout_ms.attr,
+	&dev_attr_compress.attr,
+	&dev_attr_fec_roots.attr,
+	&dev_attr_fec_depth.attr,
+	&dev_attr_address.attr,
+	&dev_attr_remotes.attr,
+	&dev_attr_tdma_slot_us.attr,
+	&dev_attr_bond.attr,
+	&dev_attr_duplex.attr,
+	&dev_attr_events.attr,
+	&dev_attr_rssi_threshold.attr,
+	&dev_attr_tpc_target_rssi.attr,
+	&dev_attr_tpc_level_min.attr,
+	&dev_attr_tpc_level_max.attr,
+	&dev_attr_tpc_crc_permille.attr,
+	&dev_attr_tpc_level.attr,
+	&dev_attr_profile.attr,
+	&dev_attr_profiles.attr,
+	&dev_attr_adr.attr,
+	&dev_attr_adr_rssi_low.attr,
+	&dev_attr_adr_rssi_high.attr,
+	&dev_attr_adr_crc_permille.attr,
+	&dev_attr_adr_retry_permille.attr,
+	&dev_attr_per_test.attr,
+	&dev_attr_per_count.attr,
+	&dev_attr_per_interval_us.attr,
+	&dev_attr_per_stats.attr,
+	&dev_attr_survey.attr,
+	&dev_attr_survey_table.attr,
+	&dev_attr_survey_samples.attr,
+	&dev_attr_survey_interval_us.attr,
+	&dev_attr_survey_busy_permille.attr,
+	&dev_attr_survey_results.attr,
 	NULL
 };
 
 static const struct attribute_group si4455_attr_group = {
 	.attrs = si4455_attributes,
+	.bin_attrs = si4455_bin_attributes,
 };
 
 static int si4455_probe(struct device *dev,
@@ -1395,7 +8057,7 @@ static int si4455_probe(struct device *dev,
 {
 	int ret;
 	struct si4455_port *s;
-	const void *of_ptr;
+	const char *fw_name;
 	const struct firmware *ez_fw = NULL;
 	int line;
 
@@ -1406,13 +8068,16 @@ static int si4455_probe(struct device *dev,
 
 	dev_set_drvdata(dev, s);
 	mutex_init(&s->mutex);
+	mutex_init(&s->remotes_lock);
+	ewma_si4455_rssi_init(&s->stats_rssi_ewma);
 
 	/* Alloc port line */
-	line = find_first_zero_bit(si4455_port_lines, SI4455_UART_NRMAX);
+	line = si4455_line_get();
 	if (line == SI4455_UART_NRMAX) {
 		dev_err(dev, "Unable to reguest port line index\n");
-		ret = -ERANGE;
-		goto out_generic;
+		mutex_destroy(&s->remotes_lock);
+		mutex_destroy(&s->mutex);
+		return -ERANGE;
 	}
 
 	s->shdn_gpio = devm_gpiod_get(dev, "shutdown", GPIOD_OUT_HIGH);
@@ -1422,50 +8087,63 @@ static int si4455_probe(struct device *dev,
 		goto out_generic;
 	}
 
-	of_ptr = of_get_property(dev->of_node, "silabs,package-size", NULL);
-	if (IS_ERR_OR_NULL(of_ptr)) {
+	/*
+	 * Device properties come from the device tree,
+	 * or from a software node(e.g. si4455_sim).
+	 */
+	if (device_property_read_u32(dev, "silabs,package-size",
+				     &s->package_size)) {
 		dev_err(dev, "dt silabs,package-size property not present\n");
 		ret = -EINVAL;
 		goto out_generic;
 	}
-	s->package_size = be32_to_cpup(of_ptr);
 	if (s->package_size > SI4455_FIFO_SIZE) {
 		dev_err(dev, "dt silabs,package-size property maximum is %i\n", SI4455_FIFO_SIZE);
 		ret = -EINVAL;
 		goto out_generic;
 	}
 
-	of_ptr = of_get_property(dev->of_node, "silabs,tx-channel", NULL);
-	if (IS_ERR_OR_NULL(of_ptr)) {
+	if (device_property_read_u32(dev, "silabs,tx-channel",
+				     &s->tx_channel)) {
 		dev_err(dev, "dt silabs,tx-channel property not present\n");
 		ret = -EINVAL;
 		goto out_generic;
 	}
-	s->tx_channel = be32_to_cpup(of_ptr);
 
-	of_ptr = of_get_property(dev->of_node, "silabs,rx-channel", NULL);
-	if (IS_ERR_OR_NULL(of_ptr)) {
+	if (device_property_read_u32(dev, "silabs,rx-channel",
+				     &s->rx_channel)) {
 		dev_err(dev, "dt silabs,rx-channel property not present\n");
 		ret = -EINVAL;
 		goto out_generic;
 	}
-	s->rx_channel = be32_to_cpup(of_ptr);
 
-	of_ptr = of_get_property(dev->of_node, "silabs,tx-timeout-ms", NULL);
-	if (IS_ERR_OR_NULL(of_ptr)) {
+	if (device_property_read_u32(dev, "silabs,tx-timeout-ms",
+				     &s->tx_wd_timeout)) {
 		s->tx_wd_timeout = 100;
 		dev_warn(dev, "dt silabs,tx-timeout-ms property not present\n");
-	} else {
-		s->tx_wd_timeout = be32_to_cpup(of_ptr);
 	}
 
-	of_ptr = of_get_property(dev->of_node, "firmware-name", NULL);
-	if (IS_ERR_OR_NULL(of_ptr)) {
+	if (device_property_read_string(dev, "firmware-name", &fw_name)) {
 		dev_err(dev, "dt firmware-name property not present\n");
 		ret = -EINVAL;
 		goto out_generic;
 	}
-	strncpy(s->ez_fw_name, of_ptr, sizeof(s->ez_fw_name) - 1);
+	strncpy(s->ez_fw_name, fw_name, sizeof(s->ez_fw_name) - 1);
+
+	s->csma_slot_us = 1000;
+	s->csma_max_backoffs = 4;
+	s->arq_retries = SI4455_ARQ_RETRIES;
+	s->reasm_timeout_ms = SI4455_LINK_REASM_TIMEOUT_MS;
+	s->fec_depth = 1;
+	s->per_count = 1000;
+	s->survey_samples = 32;
+	s->survey_interval_us = 1000;
+	s->props_get_group = 0x22;
+	s->props_get_count = 4;
+	s->tpc_level_max = SI4455_PA_PWR_LVL_MAX;
+	s->tpc_crc_permille = 50;
+	s->adr_crc_permille = 50;
+	s->adr_retry_permille = 100;
 
 	/* Initialize port data */
 	s->port.dev		= dev;
@@ -1506,8 +8184,14 @@ static int si4455_probe(struct device *dev,
 		goto out_generic;
 	}
 
-	ret = si4455_re_configure(&s->port, ez_fw);
+	ret = si4455_fw_load(s, ez_fw);
 	release_firmware(ez_fw);
+	if (ret) {
+		dev_err(dev, "firmware(%s) format error (%i)\n", s->ez_fw_name, ret);
+		goto out_generic;
+	}
+
+	ret = si4455_re_configure(&s->port);
 	if (ret) {
 		dev_err(dev, "device configuration error (%i)\n", ret);
 		ret = -EINVAL;
@@ -1530,6 +8214,35 @@ static int si4455_probe(struct device *dev,
 	timer_setup(&s->tx_wd_timer, si4455_tx_wd_event, 0);
 	/* Initialize timer for recovering interface */
 	timer_setup(&s->cts_wd_timer, si4455_cts_wd_event, 0);
+	/* Initialize queue and timer for channel hopping */
+	INIT_WORK(&s->hop_work, si4455_hop_proc);
+	hrtimer_init(&s->hop_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	s->hop_timer.function = si4455_hop_event;
+	/* Initialize queue and timer for receive channel scanning */
+	INIT_WORK(&s->scan_work, si4455_scan_proc);
+	hrtimer_init(&s->scan_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	s->scan_timer.function = si4455_scan_event;
+	/* Initialize timer for listen before talk backoff */
+	hrtimer_init(&s->csma_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	s->csma_timer.function = si4455_csma_event;
+	/* Initialize queue and timers for link layer retransmission */
+	INIT_WORK(&s->arq_work, si4455_arq_proc);
+	si4455_link_init(s, &s->link, &s->port, SI4455_ADDR_BROADCAST);
+	/* Initialize queue and timer for time slotted polling */
+	INIT_WORK(&s->tdma_work, si4455_tdma_proc);
+	hrtimer_init(&s->tdma_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	s->tdma_timer.function = si4455_tdma_event;
+	/* Initialize timer for packet error rate test pacing */
+	hrtimer_init(&s->per_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	s->per_timer.function = si4455_per_event;
+	/* Initialize queue and timer for channel survey sampling */
+	INIT_WORK(&s->survey_work, si4455_survey_proc);
+	hrtimer_init(&s->survey_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	s->survey_timer.function = si4455_survey_event;
+	/* Initialize queue and timer for data rate adaptation */
+	INIT_WORK(&s->adr_work, si4455_adr_proc);
+	hrtimer_init(&s->adr_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	s->adr_timer.function = si4455_adr_event;
 
 	/* Register port */
 	ret = uart_add_one_port(&si4455_uart, &s->port);
@@ -1538,7 +8251,6 @@ static int si4455_probe(struct device *dev,
 		goto out_uart;
 	}
 
-	set_bit(line, si4455_port_lines);
 	s->port.line = line;
 
 	ret = sysfs_create_group(&dev->kobj, &si4455_attr_group);
@@ -1553,16 +8265,21 @@ static int si4455_probe(struct device *dev,
 	ret = devm_request_threaded_irq(dev, irq, NULL, si4455_ist,
 					IRQF_ONESHOT | IRQF_SHARED,
 					dev_name(dev), s);
-	if (!ret)
+	if (!ret) {
+		mutex_lock(&si4455_bond_lock);
+		si4455_radios[line] = s;
+		mutex_unlock(&si4455_bond_lock);
 		return 0;
+	}
 
 	dev_err(dev, "Unable to reguest IRQ %i\n", irq);
 	sysfs_remove_group(&dev->kobj, &si4455_attr_group);
 
 out_uart:
 	uart_remove_one_port(&si4455_uart, &s->port);
-	clear_bit(line, si4455_port_lines);
 out_generic:
+	clear_bit(line, si4455_port_lines);
+	mutex_destroy(&s->remotes_lock);
 	mutex_destroy(&s->mutex);
 	si4455_s_power(dev, false);
 
@@ -1574,10 +8291,38 @@ static int si4455_remove(struct device *dev)
 	struct si4455_port *s = dev_get_drvdata(dev);
 	int line = s->port.line;
 
-	cancel_work_sync(&s->tx_work);
 	sysfs_remove_group(&dev->kobj, &si4455_attr_group);
+	mutex_lock(&si4455_bond_lock);
+	if (s->bond_master)
+		si4455_bond_detach(s->bond_master, s);
+	while (s->bond_count)
+		si4455_bond_detach(s, s->bond_members[0]);
+	si4455_radios[line] = NULL;
+	mutex_unlock(&si4455_bond_lock);
+	si4455_remotes_set(s, NULL, 0);
+	if (s->per_connected || s->survey_connected)
+		si4455_disconnect(s);
+	hrtimer_cancel(&s->per_timer);
+	hrtimer_cancel(&s->survey_timer);
+	cancel_work_sync(&s->survey_work);
+	hrtimer_cancel(&s->adr_timer);
+	cancel_work_sync(&s->adr_work);
+	hrtimer_cancel(&s->csma_timer);
+	hrtimer_cancel(&s->tdma_timer);
+	cancel_work_sync(&s->tdma_work);
+	hrtimer_cancel(&s->link.arq_timer);
+	hrtimer_cancel(&s->link.ack_timer);
+	cancel_work_sync(&s->arq_work);
+	hrtimer_cancel(&s->hop_timer);
+	cancel_work_sync(&s->hop_work);
+	hrtimer_cancel(&s->scan_timer);
+	cancel_work_sync(&s->scan_work);
+	cancel_work_sync(&s->tx_work);
 	si4455_debugfs_clear(dev);
 	uart_remove_one_port(&si4455_uart, &s->port);
+	kfree(s->comp_wrkmem);
+	free_rs(s->fec_rs);
+	mutex_destroy(&s->remotes_lock);
 	mutex_destroy(&s->mutex);
 	clear_bit(line, si4455_port_lines);
 
@@ -1658,3 +8403,7 @@ module_exit(si4455_uart_exit);
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Jozsef Horvath <info@ministro.hu>");
 MODULE_DESCRIPTION("Si4455 serial driver");
+
+#if IS_ENABLED(CONFIG_SI4455_KUNIT_TEST)
+#include "si4455_kunit.c"
+#endif
@@ -0,0 +1,866 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Copyright (C) 2020 Jozsef Horvath <info@ministro.hu>
+ *
+ * KUnit tests of the si4455 driver against a mock SPI controller.
+ * The mock radio answers CTS at once and records every SPI message,
+ * the tests check the command sequence, the number of SPI transactions
+ * and bytes of the configuration, of a transmitted and of a received
+ * packet. A change adding a round trip to these paths fails the suite.
+ *
+ * Included at the end of si4455.c(CONFIG_SI4455_KUNIT_TEST), the suite
+ * runs when si4455 is loaded.
+ */
+#include <kunit/test.h>
+#include <linux/platform_device.h>
+
+#define SI4455_KUNIT_NAME					"si4455-kunit"
+#define SI4455_KUNIT_CMDS_MAX					32
+#define SI4455_KUNIT_REPLY_SIZE					16
+#define SI4455_KUNIT_RSSI					100
+
+/*
+ * SPI cost of the commands, the CTS poll reads READ_CMD_BUFF and the CTS byte
+ */
+#define SI4455_KUNIT_CTS_BYTES					2
+#define SI4455_KUNIT_CMD_BYTES(args)				\
+	(SI4455_KUNIT_CTS_BYTES + (args))
+#define SI4455_KUNIT_CMD_REPLY_BYTES(args, reply)		\
+	(SI4455_KUNIT_CMD_BYTES(args) + SI4455_KUNIT_CTS_BYTES + (reply))
+
+#define SI4455_KUNIT_INT_STATUS_BYTES				\
+	SI4455_KUNIT_CMD_REPLY_BYTES(4, SI4455_CMD_REPLY_COUNT_GET_INT_STATUS)
+#define SI4455_KUNIT_FIFO_INFO_BYTES				\
+	SI4455_KUNIT_CMD_REPLY_BYTES(SI4455_CMD_ARG_COUNT_FIFO_INFO,	\
+				     SI4455_CMD_REPLY_COUNT_FIFO_INFO)
+#define SI4455_KUNIT_MODEM_STATUS_BYTES				\
+	SI4455_KUNIT_CMD_REPLY_BYTES(SI4455_CMD_ARG_COUNT_GET_MODEM_STATUS, \
+				     SI4455_CMD_REPLY_COUNT_GET_MODEM_STATUS)
+#define SI4455_KUNIT_CHANGE_STATE_BYTES				\
+	SI4455_KUNIT_CMD_BYTES(SI4455_CMD_ARG_COUNT_CHANGE_STATE)
+#define SI4455_KUNIT_START_TX_BYTES				\
+	SI4455_KUNIT_CMD_BYTES(SI4455_CMD_ARG_COUNT_START_TX)
+#define SI4455_KUNIT_START_RX_BYTES				\
+	SI4455_KUNIT_CMD_BYTES(SI4455_CMD_ARG_COUNT_START_RX)
+
+/*
+ * Budgets(SPI transactions) of the hot paths:
+ * start of a transmission: GET_INT_STATUS, FIFO_INFO, WRITE_TX_FIFO, START_TX
+ * PACKET_SENT interrupt: GET_INT_STATUS, CHANGE_STATE, GET_INT_STATUS,
+ * the transmitted packet is accounted until CHANGE_STATE
+ * PACKET_RX interrupt: GET_INT_STATUS, GET_MODEM_STATUS, CHANGE_STATE,
+ * FIFO_INFO, READ_RX_FIFO
+ * restart of the receiver: GET_INT_STATUS, FIFO_INFO, START_RX
+ */
+#define SI4455_KUNIT_TX_START_XFERS				9
+#define SI4455_KUNIT_TX_SENT_XFERS				5
+#define SI4455_KUNIT_TX_DONE_XFERS				8
+#define SI4455_KUNIT_RX_XFERS					12
+#define SI4455_KUNIT_RX_START_XFERS				8
+
+struct si4455_kunit {
+	struct platform_device *pdev;
+	struct spi_controller *ctlr;
+	struct spi_device *spi;
+	struct si4455_port *s;
+	struct uart_state state;
+	/* SPI messages since the last si4455_kunit_reset() */
+	u32 xfers;
+	u32 bytes;
+	u8 cmds[SI4455_KUNIT_CMDS_MAX];
+	u32 cmd_count;
+	/* Mock radio */
+	u8 reply[SI4455_KUNIT_REPLY_SIZE];
+	u8 int_status[SI4455_CMD_REPLY_COUNT_GET_INT_STATUS];
+	u8 ezconfig_check;
+	u8 rx_fifo[SI4455_FIFO_SIZE];
+	u32 rx_count;
+	u8 tx_fifo[SI4455_FIFO_SIZE];
+	u32 tx_count;
+};
+
+static void si4455_kunit_command(struct si4455_kunit *ctx, const u8 *in)
+{
+	memset(ctx->reply, 0, sizeof(ctx->reply));
+
+	switch (in[0]) {
+	case SI4455_CMD_ID_GET_INT_STATUS:
+		memcpy(ctx->reply, ctx->int_status, sizeof(ctx->int_status));
+		/* The pending flags are cleared by reading them */
+		ctx->int_status[0] = 0;
+		ctx->int_status[2] = 0;
+		ctx->int_status[4] = 0;
+		ctx->int_status[6] = 0;
+		break;
+	case SI4455_CMD_ID_FIFO_INFO:
+		if (in[1] & SI4455_CMD_FIFO_INFO_ARG_RX_BIT)
+			ctx->rx_count = 0;
+		if (in[1] & SI4455_CMD_FIFO_INFO_ARG_TX_BIT)
+			ctx->tx_count = 0;
+		ctx->reply[0] = ctx->rx_count;
+		ctx->reply[1] = SI4455_FIFO_SIZE - ctx->tx_count;
+		break;
+	case SI4455_CMD_ID_GET_MODEM_STATUS:
+		ctx->reply[2] = SI4455_KUNIT_RSSI;
+		break;
+	case SI4455_CMD_ID_EZCONFIG_CHECK:
+		ctx->reply[0] = ctx->ezconfig_check;
+		break;
+	default:
+		break;
+	}
+}
+
+static void si4455_kunit_spi(struct si4455_kunit *ctx, const u8 *in, u8 *out,
+			     u32 length)
+{
+	u32 count = length - 1;
+
+	if (in[0] != SI4455_CMD_ID_READ_CMD_BUFF &&
+	    ctx->cmd_count < SI4455_KUNIT_CMDS_MAX)
+		ctx->cmds[ctx->cmd_count++] = in[0];
+
+	switch (in[0]) {
+	case SI4455_CMD_ID_READ_CMD_BUFF:
+		out[1] = 0xff;
+		memcpy(&out[2], ctx->reply,
+		       min_t(u32, length - 2, SI4455_KUNIT_REPLY_SIZE));
+		break;
+	case SI4455_CMD_ID_READ_RX_FIFO:
+		count = min(count, ctx->rx_count);
+		memcpy(&out[1], ctx->rx_fifo, count);
+		ctx->rx_count -= count;
+		memmove(ctx->rx_fifo, &ctx->rx_fifo[count], ctx->rx_count);
+		break;
+	case SI4455_CMD_ID_WRITE_TX_FIFO:
+		count = min_t(u32, count, SI4455_FIFO_SIZE - ctx->tx_count);
+		memcpy(&ctx->tx_fifo[ctx->tx_count], &in[1], count);
+		ctx->tx_count += count;
+		break;
+	default:
+		si4455_kunit_command(ctx, in);
+		break;
+	}
+}
+
+static int si4455_kunit_transfer_one_message(struct spi_controller *ctlr,
+					     struct spi_message *msg)
+{
+	struct si4455_kunit *ctx = spi_controller_get_devdata(ctlr);
+	struct spi_transfer *xfer;
+	u32 length = 0;
+	u32 pos = 0;
+	u8 *in;
+	u8 *out;
+	int ret = 0;
+
+	list_for_each_entry(xfer, &msg->transfers, transfer_list)
+		length += xfer->len;
+
+	in = kzalloc(length, GFP_KERNEL);
+	out = kzalloc(length, GFP_KERNEL);
+	if (!in || !out) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	list_for_each_entry(xfer, &msg->transfers, transfer_list) {
+		if (xfer->tx_buf)
+			memcpy(&in[pos], xfer->tx_buf, xfer->len);
+		pos += xfer->len;
+	}
+
+	ctx->xfers++;
+	ctx->bytes += length;
+	if (length)
+		si4455_kunit_spi(ctx, in, out, length);
+
+	pos = 0;
+	list_for_each_entry(xfer, &msg->transfers, transfer_list) {
+		if (xfer->rx_buf)
+			memcpy(xfer->rx_buf, &out[pos], xfer->len);
+		pos += xfer->len;
+	}
+	msg->actual_length = length;
+out:
+	kfree(out);
+	kfree(in);
+	msg->status = ret;
+	spi_finalize_current_message(ctlr);
+
+	return ret;
+}
+
+static void si4455_kunit_reset(struct si4455_kunit *ctx)
+{
+	ctx->xfers = 0;
+	ctx->bytes = 0;
+	ctx->cmd_count = 0;
+}
+
+static void si4455_kunit_expect_spi(struct kunit *test, u32 xfers, u32 bytes)
+{
+	struct si4455_kunit *ctx = test->priv;
+
+	KUNIT_EXPECT_EQ(test, ctx->xfers, xfers);
+	KUNIT_EXPECT_EQ(test, ctx->bytes, bytes);
+}
+
+static void si4455_kunit_expect_cmds(struct kunit *test, const u8 *cmds,
+				     u32 count)
+{
+	struct si4455_kunit *ctx = test->priv;
+
+	KUNIT_ASSERT_EQ(test, ctx->cmd_count, count);
+	KUNIT_EXPECT_EQ(test, memcmp(ctx->cmds, cmds, count), 0);
+}
+
+/*
+ * Queues the data in the transmit buffer from the tail
+ */
+static void si4455_kunit_xmit(struct si4455_kunit *ctx, u32 tail,
+			      const u8 *data, u32 length)
+{
+	struct circ_buf *xmit = &ctx->state.xmit;
+	u32 i;
+
+	xmit->tail = tail;
+	for (i = 0; i < length; i++)
+		xmit->buf[(tail + i) & (UART_XMIT_SIZE - 1)] = data[i];
+	xmit->head = (tail + length) & (UART_XMIT_SIZE - 1);
+}
+
+static void si4455_kunit_rx_packet(struct si4455_kunit *ctx, u32 length)
+{
+	u32 i;
+
+	for (i = 0; i < length; i++)
+		ctx->rx_fifo[i] = 0xa0 + i;
+	ctx->rx_count = length;
+}
+
+static void si4455_kunit_irq(struct si4455_kunit *ctx, u8 ph_pend,
+			     u8 chip_pend)
+{
+	memset(ctx->int_status, 0, sizeof(ctx->int_status));
+	ctx->int_status[2] = ph_pend;
+	ctx->int_status[6] = chip_pend;
+}
+
+static const u8 si4455_kunit_rx_start_cmds[] = {
+	SI4455_CMD_ID_GET_INT_STATUS,
+	SI4455_CMD_ID_FIFO_INFO,
+	SI4455_CMD_ID_START_RX,
+};
+
+static const u8 si4455_kunit_config[] = {
+	/* POWER_UP */
+	0x07, 0x02, 0x01, 0x00, 0x01, 0xc9, 0xc3, 0x80,
+	/* EZConfig array chunk */
+	0x12, SI4455_CMD_ID_WRITE_TX_FIFO,
+	0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+	0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x10,
+	/* SET_PROPERTY INT_CTL_ENABLE */
+	0x05, SI4455_CMD_ID_SET_PROPERTY, 0x01, 0x01, 0x00, 0x01,
+	/* EZCONFIG_CHECK */
+	0x03, SI4455_CMD_ID_EZCONFIG_CHECK, 0x12, 0x34,
+	0x00
+};
+
+static void si4455_kunit_configure(struct kunit *test)
+{
+	struct si4455_kunit *ctx = test->priv;
+	static const u8 cmds[] = {
+		0x02, SI4455_CMD_ID_GET_INT_STATUS,
+		SI4455_CMD_ID_WRITE_TX_FIFO,
+		SI4455_CMD_ID_SET_PROPERTY, SI4455_CMD_ID_GET_INT_STATUS,
+		SI4455_CMD_ID_EZCONFIG_CHECK, SI4455_CMD_ID_GET_INT_STATUS,
+	};
+	u32 bytes;
+
+	KUNIT_EXPECT_EQ(test, si4455_configure(&ctx->s->port,
+					       si4455_kunit_config), 0);
+
+	si4455_kunit_expect_cmds(test, cmds, ARRAY_SIZE(cmds));
+	/* A command and its response, then the interrupts are cleared */
+	bytes = SI4455_KUNIT_CMD_REPLY_BYTES(7, 1) +
+		SI4455_KUNIT_CMD_REPLY_BYTES(5, 1) +
+		SI4455_KUNIT_CMD_REPLY_BYTES(3, 1) +
+		3 * SI4455_KUNIT_INT_STATUS_BYTES +
+		SI4455_KUNIT_CMD_BYTES(0x12);
+	si4455_kunit_expect_spi(test, 3 * 6 + 2, bytes);
+
+	/* The EZConfig array is loaded through the TX FIFO */
+	KUNIT_ASSERT_EQ(test, ctx->tx_count, (u32)0x11);
+	KUNIT_EXPECT_EQ(test, memcmp(ctx->tx_fifo, &si4455_kunit_config[10],
+				     ctx->tx_count), 0);
+}
+
+static void si4455_kunit_configure_error(struct kunit *test)
+{
+	struct si4455_kunit *ctx = test->priv;
+
+	ctx->ezconfig_check = 1;
+	KUNIT_EXPECT_EQ(test, si4455_configure(&ctx->s->port,
+					       si4455_kunit_config), -EIO);
+
+	ctx->ezconfig_check = 0;
+	si4455_kunit_irq(ctx, 0, SI4455_CMD_GET_CHIP_STATUS_ERROR_PEND_BIT);
+	si4455_kunit_reset(ctx);
+	KUNIT_EXPECT_EQ(test, si4455_configure(&ctx->s->port,
+					       si4455_kunit_config), -EIO);
+	/* Stopped after the first command */
+	KUNIT_EXPECT_EQ(test, ctx->cmd_count, (u32)2);
+}
+
+static const u8 si4455_kunit_tx_cmds[] = {
+	SI4455_CMD_ID_GET_INT_STATUS,
+	SI4455_CMD_ID_FIFO_INFO,
+	SI4455_CMD_ID_WRITE_TX_FIFO,
+	SI4455_CMD_ID_START_TX,
+};
+
+static void si4455_kunit_start_tx_xmit_wrap(struct kunit *test)
+{
+	struct si4455_kunit *ctx = test->priv;
+	struct si4455_port *s = ctx->s;
+	u8 data[10];
+	u32 i;
+	int ret;
+
+	for (i = 0; i < sizeof(data); i++)
+		data[i] = 0x30 + i;
+	/* 4 bytes before the end of the buffer, 6 bytes from its start */
+	si4455_kunit_xmit(ctx, UART_XMIT_SIZE - 4, data, sizeof(data));
+
+	mutex_lock(&s->mutex);
+	ret = si4455_start_tx_xmit(&s->port);
+	mutex_unlock(&s->mutex);
+	KUNIT_EXPECT_EQ(test, ret, 0);
+	KUNIT_EXPECT_TRUE(test, s->tx_pending);
+	KUNIT_EXPECT_EQ(test, s->tx_pending_size, (u32)sizeof(data));
+
+	/* Variable packet: length byte and the data in order */
+	KUNIT_ASSERT_EQ(test, ctx->tx_count, (u32)sizeof(data) + 1);
+	KUNIT_EXPECT_EQ(test, ctx->tx_fifo[0], (u8)sizeof(data));
+	KUNIT_EXPECT_EQ(test, memcmp(&ctx->tx_fifo[1], data, sizeof(data)), 0);
+
+	si4455_kunit_expect_cmds(test, si4455_kunit_tx_cmds,
+				 ARRAY_SIZE(si4455_kunit_tx_cmds));
+	si4455_kunit_expect_spi(test, SI4455_KUNIT_TX_START_XFERS,
+				SI4455_KUNIT_INT_STATUS_BYTES +
+				SI4455_KUNIT_FIFO_INFO_BYTES +
+				1 + 1 + sizeof(data) +
+				SI4455_KUNIT_START_TX_BYTES);
+	KUNIT_EXPECT_EQ(test, s->spi_tx_xfers,
+			(u32)SI4455_KUNIT_TX_START_XFERS);
+
+	/* The data stays in the buffer until PACKET_SENT */
+	KUNIT_EXPECT_EQ(test, ctx->state.xmit.tail, (int)UART_XMIT_SIZE - 4);
+}
+
+static void si4455_kunit_start_tx_xmit_fixed(struct kunit *test)
+{
+	struct si4455_kunit *ctx = test->priv;
+	struct si4455_port *s = ctx->s;
+	u8 data[20];
+	int ret;
+
+	memset(data, 0x55, sizeof(data));
+	s->package_size = 16;
+
+	/* A fixed size packet waits for a full payload */
+	si4455_kunit_xmit(ctx, 0, data, 10);
+	mutex_lock(&s->mutex);
+	ret = si4455_start_tx_xmit(&s->port);
+	mutex_unlock(&s->mutex);
+	KUNIT_EXPECT_EQ(test, ret, 0);
+	KUNIT_EXPECT_FALSE(test, s->tx_pending);
+	si4455_kunit_expect_spi(test, 0, 0);
+
+	si4455_kunit_xmit(ctx, 0, data, sizeof(data));
+	mutex_lock(&s->mutex);
+	ret = si4455_start_tx_xmit(&s->port);
+	mutex_unlock(&s->mutex);
+	KUNIT_EXPECT_EQ(test, ret, 0);
+	KUNIT_EXPECT_EQ(test, s->tx_pending_size, (u32)16);
+	KUNIT_EXPECT_EQ(test, ctx->tx_count, (u32)16);
+	si4455_kunit_expect_spi(test, SI4455_KUNIT_TX_START_XFERS,
+				SI4455_KUNIT_INT_STATUS_BYTES +
+				SI4455_KUNIT_FIFO_INFO_BYTES +
+				1 + 16 +
+				SI4455_KUNIT_START_TX_BYTES);
+}
+
+static void si4455_kunit_handle_rx_pend(struct kunit *test)
+{
+	struct si4455_kunit *ctx = test->priv;
+	struct si4455_port *s = ctx->s;
+	struct si4455_fifo_info fifo_info = { .rx_fifo_count = 12 };
+	static const u8 cmds[] = { SI4455_CMD_ID_READ_RX_FIFO };
+
+	si4455_kunit_rx_packet(ctx, 12);
+	mutex_lock(&s->mutex);
+	si4455_handle_rx_pend(s, &fifo_info, false);
+	mutex_unlock(&s->mutex);
+
+	/* A single FIFO read without CTS poll */
+	si4455_kunit_expect_cmds(test, cmds, ARRAY_SIZE(cmds));
+	si4455_kunit_expect_spi(test, 1, 1 + 12);
+	KUNIT_EXPECT_EQ(test, s->port.icount.rx, (u32)12);
+	KUNIT_EXPECT_EQ(test, s->stats.rx_bytes, (u64)12);
+	KUNIT_EXPECT_EQ(test, ctx->rx_count, (u32)0);
+}
+
+static void si4455_kunit_handle_tx_pend(struct kunit *test)
+{
+	struct si4455_kunit *ctx = test->priv;
+	struct si4455_port *s = ctx->s;
+	static const u8 cmds[] = { SI4455_CMD_ID_GET_INT_STATUS };
+	u8 data[5] = { 1, 2, 3, 4, 5 };
+
+	si4455_kunit_xmit(ctx, UART_XMIT_SIZE - 2, data, sizeof(data));
+	s->tx_pending = true;
+	s->tx_pending_size = sizeof(data);
+	s->tx_length = sizeof(data) + 1;
+	s->tx_start = ktime_get();
+
+	mutex_lock(&s->mutex);
+	si4455_handle_tx_pend(s);
+	mutex_unlock(&s->mutex);
+
+	si4455_kunit_expect_cmds(test, cmds, ARRAY_SIZE(cmds));
+	si4455_kunit_expect_spi(test, 3, SI4455_KUNIT_INT_STATUS_BYTES);
+	KUNIT_EXPECT_FALSE(test, s->tx_pending);
+	KUNIT_EXPECT_EQ(test, s->tx_pending_size, (u32)0);
+	KUNIT_EXPECT_EQ(test, ctx->state.xmit.tail, ctx->state.xmit.head);
+	KUNIT_EXPECT_EQ(test, s->port.icount.tx, (u32)sizeof(data));
+	KUNIT_EXPECT_EQ(test, s->stats.tx_packet_count, (u32)1);
+}
+
+static void si4455_kunit_ist_packet_sent(struct kunit *test)
+{
+	struct si4455_kunit *ctx = test->priv;
+	struct si4455_port *s = ctx->s;
+	static const u8 cmds[] = {
+		SI4455_CMD_ID_GET_INT_STATUS,
+		SI4455_CMD_ID_CHANGE_STATE,
+		SI4455_CMD_ID_GET_INT_STATUS,
+		/* Restart of the receiver */
+		SI4455_CMD_ID_GET_INT_STATUS,
+		SI4455_CMD_ID_FIFO_INFO,
+		SI4455_CMD_ID_START_RX,
+	};
+	u8 data[8];
+	u32 tx_bytes;
+
+	memset(data, 0x77, sizeof(data));
+	si4455_kunit_xmit(ctx, UART_XMIT_SIZE - 3, data, sizeof(data));
+	mutex_lock(&s->mutex);
+	KUNIT_ASSERT_EQ(test, si4455_start_tx_xmit(&s->port), 0);
+	mutex_unlock(&s->mutex);
+	tx_bytes = ctx->bytes;
+
+	si4455_kunit_reset(ctx);
+	si4455_kunit_irq(ctx, SI4455_CMD_GET_INT_STATUS_PACKET_SENT_PEND_BIT, 0);
+	KUNIT_EXPECT_TRUE(test, si4455_ist(0, s) == IRQ_HANDLED);
+
+	si4455_kunit_expect_cmds(test, cmds, ARRAY_SIZE(cmds));
+	si4455_kunit_expect_spi(test, SI4455_KUNIT_TX_DONE_XFERS +
+				SI4455_KUNIT_RX_START_XFERS,
+				2 * SI4455_KUNIT_INT_STATUS_BYTES +
+				SI4455_KUNIT_CHANGE_STATE_BYTES +
+				SI4455_KUNIT_INT_STATUS_BYTES +
+				SI4455_KUNIT_FIFO_INFO_BYTES +
+				SI4455_KUNIT_START_RX_BYTES);
+
+	/* Budget of a transmitted packet, from the start to PACKET_SENT */
+	KUNIT_EXPECT_EQ(test, s->spi_tx_cost.packets, (u32)1);
+	KUNIT_EXPECT_EQ(test, s->spi_tx_cost.last_xfers,
+			(u32)(SI4455_KUNIT_TX_START_XFERS +
+			      SI4455_KUNIT_TX_SENT_XFERS));
+	KUNIT_EXPECT_EQ(test, s->spi_tx_cost.last_bytes,
+			tx_bytes + SI4455_KUNIT_INT_STATUS_BYTES +
+			SI4455_KUNIT_CHANGE_STATE_BYTES);
+
+	KUNIT_EXPECT_FALSE(test, s->tx_pending);
+	KUNIT_EXPECT_EQ(test, ctx->state.xmit.tail, ctx->state.xmit.head);
+	KUNIT_EXPECT_EQ(test, s->port.icount.tx, (u32)sizeof(data));
+	KUNIT_EXPECT_EQ(test, s->hists.irq_packets.max, (u32)1);
+}
+
+static void si4455_kunit_ist_packet_rx(struct kunit *test)
+{
+	struct si4455_kunit *ctx = test->priv;
+	struct si4455_port *s = ctx->s;
+	static const u8 cmds[] = {
+		SI4455_CMD_ID_GET_INT_STATUS,
+		SI4455_CMD_ID_GET_MODEM_STATUS,
+		SI4455_CMD_ID_CHANGE_STATE,
+		SI4455_CMD_ID_FIFO_INFO,
+		SI4455_CMD_ID_READ_RX_FIFO,
+		/* Restart of the receiver */
+		SI4455_CMD_ID_GET_INT_STATUS,
+		SI4455_CMD_ID_FIFO_INFO,
+		SI4455_CMD_ID_START_RX,
+	};
+	u32 rx_bytes;
+
+	si4455_kunit_rx_packet(ctx, 20);
+	si4455_kunit_irq(ctx, SI4455_CMD_GET_INT_STATUS_PACKET_RX_PEND_BIT, 0);
+	KUNIT_EXPECT_TRUE(test, si4455_ist(0, s) == IRQ_HANDLED);
+
+	rx_bytes = SI4455_KUNIT_INT_STATUS_BYTES +
+		   SI4455_KUNIT_MODEM_STATUS_BYTES +
+		   SI4455_KUNIT_CHANGE_STATE_BYTES +
+		   SI4455_KUNIT_FIFO_INFO_BYTES +
+		   1 + 20;
+	si4455_kunit_expect_cmds(test, cmds, ARRAY_SIZE(cmds));
+	si4455_kunit_expect_spi(test, SI4455_KUNIT_RX_XFERS +
+				SI4455_KUNIT_RX_START_XFERS,
+				rx_bytes + SI4455_KUNIT_INT_STATUS_BYTES +
+				SI4455_KUNIT_FIFO_INFO_BYTES +
+				SI4455_KUNIT_START_RX_BYTES);
+
+	/* Budget of a received packet */
+	KUNIT_EXPECT_EQ(test, s->spi_rx_cost.packets, (u32)1);
+	KUNIT_EXPECT_EQ(test, s->spi_rx_cost.last_xfers,
+			(u32)SI4455_KUNIT_RX_XFERS);
+	KUNIT_EXPECT_EQ(test, s->spi_rx_cost.last_bytes, rx_bytes);
+
+	KUNIT_EXPECT_EQ(test, s->stats.rx_packet_count, (u32)1);
+	KUNIT_EXPECT_EQ(test, s->current_rssi, (u32)SI4455_KUNIT_RSSI);
+	KUNIT_EXPECT_EQ(test, s->port.icount.rx, (u32)20);
+}
+
+static void si4455_kunit_ist_crc_error(struct kunit *test)
+{
+	struct si4455_kunit *ctx = test->priv;
+	struct si4455_port *s = ctx->s;
+	static const u8 cmds[] = {
+		SI4455_CMD_ID_GET_INT_STATUS,
+		SI4455_CMD_ID_CHANGE_STATE,
+		SI4455_CMD_ID_FIFO_INFO,
+		SI4455_CMD_ID_GET_INT_STATUS,
+		SI4455_CMD_ID_FIFO_INFO,
+		SI4455_CMD_ID_START_RX,
+	};
+
+	/* Without FEC the packet is dropped with the RX FIFO */
+	si4455_kunit_rx_packet(ctx, 20);
+	si4455_kunit_irq(ctx, SI4455_CMD_GET_INT_STATUS_CRC_ERROR_BIT, 0);
+	KUNIT_EXPECT_TRUE(test, si4455_ist(0, s) == IRQ_HANDLED);
+
+	si4455_kunit_expect_cmds(test, cmds, ARRAY_SIZE(cmds));
+	KUNIT_EXPECT_EQ(test, s->stats.crc_error_count, (u32)1);
+	KUNIT_EXPECT_EQ(test, s->stats.rx_packet_count, (u32)0);
+	KUNIT_EXPECT_EQ(test, s->port.icount.rx, (u32)0);
+	KUNIT_EXPECT_EQ(test, ctx->rx_count, (u32)0);
+}
+
+static void si4455_kunit_ist_chip_error(struct kunit *test)
+{
+	struct si4455_kunit *ctx = test->priv;
+	struct si4455_port *s = ctx->s;
+	static const u8 cmds[] = {
+		SI4455_CMD_ID_GET_INT_STATUS,
+		SI4455_CMD_ID_CHANGE_STATE,
+		SI4455_CMD_ID_FIFO_INFO,
+		SI4455_CMD_ID_GET_INT_STATUS,
+		SI4455_CMD_ID_FIFO_INFO,
+		SI4455_CMD_ID_START_RX,
+	};
+
+	/* The packet events are dropped with the reset state */
+	si4455_kunit_rx_packet(ctx, 20);
+	si4455_kunit_irq(ctx, SI4455_CMD_GET_INT_STATUS_PACKET_RX_PEND_BIT,
+			 SI4455_CMD_GET_CHIP_STATUS_ERROR_PEND_BIT);
+	KUNIT_EXPECT_TRUE(test, si4455_ist(0, s) == IRQ_HANDLED);
+
+	si4455_kunit_expect_cmds(test, cmds, ARRAY_SIZE(cmds));
+	KUNIT_EXPECT_EQ(test, s->stats.chip_error_count, (u32)1);
+	KUNIT_EXPECT_EQ(test, s->stats.rx_packet_count, (u32)0);
+	KUNIT_EXPECT_EQ(test, s->hists.irq_packets.max, (u32)0);
+}
+
+static void si4455_kunit_ist_sent_and_rx(struct kunit *test)
+{
+	struct si4455_kunit *ctx = test->priv;
+	struct si4455_port *s = ctx->s;
+	u8 data[4] = { 9, 8, 7, 6 };
+
+	si4455_kunit_xmit(ctx, 0, data, sizeof(data));
+	mutex_lock(&s->mutex);
+	KUNIT_ASSERT_EQ(test, si4455_start_tx_xmit(&s->port), 0);
+	mutex_unlock(&s->mutex);
+
+	/* A packet received before PACKET_SENT was serviced */
+	si4455_kunit_reset(ctx);
+	si4455_kunit_rx_packet(ctx, 6);
+	si4455_kunit_irq(ctx, SI4455_CMD_GET_INT_STATUS_PACKET_SENT_PEND_BIT |
+			 SI4455_CMD_GET_INT_STATUS_PACKET_RX_PEND_BIT, 0);
+	KUNIT_EXPECT_TRUE(test, si4455_ist(0, s) == IRQ_HANDLED);
+
+	/* The interrupt status is read once for both */
+	si4455_kunit_expect_spi(test, SI4455_KUNIT_TX_DONE_XFERS +
+				SI4455_KUNIT_RX_XFERS - 3 +
+				SI4455_KUNIT_RX_START_XFERS,
+				2 * SI4455_KUNIT_INT_STATUS_BYTES +
+				SI4455_KUNIT_CHANGE_STATE_BYTES +
+				SI4455_KUNIT_MODEM_STATUS_BYTES +
+				SI4455_KUNIT_CHANGE_STATE_BYTES +
+				SI4455_KUNIT_FIFO_INFO_BYTES + 1 + 6 +
+				SI4455_KUNIT_INT_STATUS_BYTES +
+				SI4455_KUNIT_FIFO_INFO_BYTES +
+				SI4455_KUNIT_START_RX_BYTES);
+	KUNIT_EXPECT_EQ(test, s->stats.tx_packet_count, (u32)1);
+	KUNIT_EXPECT_EQ(test, s->stats.rx_packet_count, (u32)1);
+	KUNIT_EXPECT_EQ(test, s->port.icount.rx, (u32)6);
+	KUNIT_EXPECT_EQ(test, s->hists.irq_packets.max, (u32)2);
+}
+
+static void si4455_kunit_ist_idle(struct kunit *test)
+{
+	struct si4455_kunit *ctx = test->priv;
+	struct si4455_port *s = ctx->s;
+	static const u8 cmds[] = { SI4455_CMD_ID_GET_INT_STATUS };
+
+	/* Nothing pending: the status is read, the receiver is not touched */
+	si4455_kunit_irq(ctx, 0, 0);
+	KUNIT_EXPECT_TRUE(test, si4455_ist(0, s) == IRQ_HANDLED);
+	si4455_kunit_expect_cmds(test, cmds, ARRAY_SIZE(cmds));
+	si4455_kunit_expect_spi(test, 3, SI4455_KUNIT_INT_STATUS_BYTES);
+
+	/* Not connected: the interrupt is not ours */
+	si4455_kunit_reset(ctx);
+	s->connected = false;
+	KUNIT_EXPECT_TRUE(test, si4455_ist(0, s) == IRQ_NONE);
+	si4455_kunit_expect_spi(test, 0, 0);
+}
+
+static void si4455_kunit_hop_resync(struct kunit *test)
+{
+	struct si4455_kunit *ctx = test->priv;
+	struct si4455_port *s = ctx->s;
+	struct si4455_link_hdr hdr = { .len = 11 };
+	u8 data[11] = { SI4455_LINK_CTRL_HOP, 4, 2 };
+
+	mutex_lock(&s->mutex);
+	s->hop_table_len = 4;
+	s->hop_dwell_us = 1000000;
+	/* The modem interrupts as enabled by si4455_do_work() */
+	s->scan_irq = true;
+	si4455_hop_update(s);
+
+	/*
+	 * Sent 300ms into the dwell of index 2 with index 0 skipped,
+	 * received 1ms after its sync
+	 */
+	put_unaligned_le32(300000, &data[3]);
+	put_unaligned_le32(BIT(0), &data[7]);
+	s->rx_sync_time = ktime_get();
+	s->ist_time = ktime_add_us(s->rx_sync_time, 1000);
+	si4455_link_ctrl(s, &s->link, &hdr, data);
+	KUNIT_EXPECT_EQ(test, s->hop_index, (u32)2);
+	KUNIT_EXPECT_TRUE(test, s->hop_next_time ==
+			  ktime_add_us(s->ist_time, 699000));
+	KUNIT_EXPECT_EQ(test, s->hop_sync_count, (u32)1);
+	KUNIT_EXPECT_EQ(test, s->hop_skip, (u32)BIT(0));
+
+	/* Another hop_table length */
+	data[1] = 5;
+	data[2] = 3;
+	si4455_link_ctrl(s, &s->link, &hdr, data);
+	KUNIT_EXPECT_EQ(test, s->hop_index, (u32)2);
+
+	/* A packet being received defers the restart of the receiver */
+	s->hop_locked = true;
+	s->hop_next_time = ktime_get();
+	mutex_unlock(&s->mutex);
+	si4455_kunit_reset(ctx);
+	si4455_hop_proc(&s->hop_work);
+	KUNIT_EXPECT_EQ(test, s->hop_index, (u32)3);
+	KUNIT_EXPECT_EQ(test, s->hop_deferred_count, (u32)1);
+	si4455_kunit_expect_spi(test, 0, 0);
+
+	/* Not longer than SI4455_HOP_LOCK_DWELLS, index 0 is skipped */
+	s->hop_next_time = ktime_get();
+	si4455_hop_proc(&s->hop_work);
+	KUNIT_EXPECT_EQ(test, s->hop_index, (u32)1);
+	KUNIT_EXPECT_EQ(test, s->hop_deferred_count, (u32)1);
+	KUNIT_EXPECT_FALSE(test, s->hop_locked);
+	si4455_kunit_expect_cmds(test, si4455_kunit_rx_start_cmds,
+				 ARRAY_SIZE(si4455_kunit_rx_start_cmds));
+}
+
+static void si4455_kunit_begin_rx(struct kunit *test)
+{
+	struct si4455_kunit *ctx = test->priv;
+	struct si4455_port *s = ctx->s;
+
+	mutex_lock(&s->mutex);
+	KUNIT_EXPECT_EQ(test, si4455_begin_rx(&s->port, 0, 0), 0);
+	mutex_unlock(&s->mutex);
+	si4455_kunit_expect_cmds(test, si4455_kunit_rx_start_cmds,
+				 ARRAY_SIZE(si4455_kunit_rx_start_cmds));
+	si4455_kunit_expect_spi(test, SI4455_KUNIT_RX_START_XFERS,
+				SI4455_KUNIT_INT_STATUS_BYTES +
+				SI4455_KUNIT_FIFO_INFO_BYTES +
+				SI4455_KUNIT_START_RX_BYTES);
+}
+
+static int si4455_kunit_spi_init(struct si4455_kunit *ctx)
+{
+	struct spi_controller *ctlr;
+	struct spi_device *spi;
+	int ret;
+
+	ctx->pdev = platform_device_register_simple(SI4455_KUNIT_NAME,
+						    PLATFORM_DEVID_AUTO,
+						    NULL, 0);
+	if (IS_ERR(ctx->pdev))
+		return PTR_ERR(ctx->pdev);
+
+	ctlr = spi_alloc_master(&ctx->pdev->dev, 0);
+	if (!ctlr)
+		return -ENOMEM;
+
+	ctlr->bus_num = -1;
+	ctlr->num_chipselect = 1;
+	ctlr->mode_bits = SPI_CPOL | SPI_CPHA;
+	ctlr->bits_per_word_mask = SPI_BPW_MASK(8);
+	ctlr->transfer_one_message = si4455_kunit_transfer_one_message;
+	spi_controller_set_devdata(ctlr, ctx);
+	ret = spi_register_controller(ctlr);
+	if (ret) {
+		spi_controller_put(ctlr);
+		return ret;
+	}
+	ctx->ctlr = ctlr;
+
+	/* Not bound to the driver, the tests own the port */
+	spi = spi_alloc_device(ctlr);
+	if (!spi)
+		return -ENOMEM;
+
+	strscpy(spi->modalias, SI4455_KUNIT_NAME, sizeof(spi->modalias));
+	spi->max_speed_hz = 1000000;
+	spi->chip_select = 0;
+	spi->mode = SPI_MODE_0;
+	spi->bits_per_word = 8;
+	ret = spi_add_device(spi);
+	if (ret) {
+		spi_dev_put(spi);
+		return ret;
+	}
+	ctx->spi = spi;
+
+	return 0;
+}
+
+static void si4455_kunit_spi_exit(struct si4455_kunit *ctx)
+{
+	if (ctx->spi)
+		spi_unregister_device(ctx->spi);
+	if (ctx->ctlr)
+		spi_unregister_controller(ctx->ctlr);
+	if (!IS_ERR_OR_NULL(ctx->pdev))
+		platform_device_unregister(ctx->pdev);
+}
+
+static int si4455_kunit_init(struct kunit *test)
+{
+	struct si4455_kunit *ctx;
+	struct si4455_port *s;
+	int ret;
+
+	ctx = kunit_kzalloc(test, sizeof(*ctx), GFP_KERNEL);
+	if (!ctx)
+		return -ENOMEM;
+
+	ctx->state.xmit.buf = kunit_kzalloc(test, UART_XMIT_SIZE, GFP_KERNEL);
+	s = kunit_kzalloc(test, sizeof(*s), GFP_KERNEL);
+	if (!ctx->state.xmit.buf || !s)
+		return -ENOMEM;
+
+	ctx->s = s;
+	test->priv = ctx;
+
+	ret = si4455_kunit_spi_init(ctx);
+	if (ret) {
+		si4455_kunit_spi_exit(ctx);
+		return ret;
+	}
+
+	/* The port as opened, connected and configured in variable packet mode */
+	tty_port_init(&ctx->state.port);
+	tty_port_set_initialized(&ctx->state.port, 1);
+	ctx->state.uart_port = &s->port;
+	dev_set_drvdata(&ctx->spi->dev, s);
+	mutex_init(&s->mutex);
+	mutex_init(&s->remotes_lock);
+	ewma_si4455_rssi_init(&s->stats_rssi_ewma);
+	spin_lock_init(&s->port.lock);
+	s->port.dev = &ctx->spi->dev;
+	s->port.state = &ctx->state;
+	s->port.type = PORT_SI4455;
+	s->port.fifosize = SI4455_FIFO_SIZE;
+	s->tx_wd_timeout = 60000;
+	s->fec_depth = 1;
+	si4455_link_init(s, &s->link, &s->port, SI4455_ADDR_BROADCAST);
+	INIT_WORK(&s->tx_work, si4455_tx_proc);
+	INIT_WORK(&s->tx_wd_work, si4455_tx_wd_proc);
+	INIT_WORK(&s->hop_work, si4455_hop_proc);
+	hrtimer_init(&s->hop_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	s->hop_timer.function = si4455_hop_event;
+	timer_setup(&s->tx_wd_timer, si4455_tx_wd_event, 0);
+	s->power_count = 1;
+	s->configured = true;
+	s->connected = true;
+
+	return 0;
+}
+
+static void si4455_kunit_exit(struct kunit *test)
+{
+	struct si4455_kunit *ctx = test->priv;
+	struct si4455_port *s = ctx->s;
+
+	del_timer_sync(&s->tx_wd_timer);
+	cancel_work_sync(&s->tx_wd_work);
+	cancel_work_sync(&s->tx_work);
+	hrtimer_cancel(&s->hop_timer);
+	cancel_work_sync(&s->hop_work);
+	hrtimer_cancel(&s->link.arq_timer);
+	hrtimer_cancel(&s->link.ack_timer);
+	tty_port_destroy(&ctx->state.port);
+	si4455_kunit_spi_exit(ctx);
+	mutex_destroy(&s->remotes_lock);
+	mutex_destroy(&s->mutex);
+}
+
+static struct kunit_case si4455_kunit_cases[] = {
+	KUNIT_CASE(si4455_kunit_configure),
+	KUNIT_CASE(si4455_kunit_configure_error),
+	KUNIT_CASE(si4455_kunit_start_tx_xmit_wrap),
+	KUNIT_CASE(si4455_kunit_start_tx_xmit_fixed),
+	KUNIT_CASE(si4455_kunit_handle_rx_pend),
+	KUNIT_CASE(si4455_kunit_handle_tx_pend),
+	KUNIT_CASE(si4455_kunit_begin_rx),
+	KUNIT_CASE(si4455_kunit_ist_packet_sent),
+	KUNIT_CASE(si4455_kunit_ist_packet_rx),
+	KUNIT_CASE(si4455_kunit_ist_crc_error),
+	KUNIT_CASE(si4455_kunit_ist_chip_error),
+	KUNIT_CASE(si4455_kunit_ist_sent_and_rx),
+	KUNIT_CASE(si4455_kunit_ist_idle),
+	KUNIT_CASE(si4455_kunit_hop_resync),
+	{ }
+};
+
+static struct kunit_suite si4455_kunit_suite = {
+	.name = "si4455",
+	.init = si4455_kunit_init,
+	.exit = si4455_kunit_exit,
+	.test_cases = si4455_kunit_cases,
+};
+kunit_test_suite(si4455_kunit_suite);
@@ -0,0 +1,1253 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Copyright (C) 2020 Jozsef Horvath <info@ministro.hu>
+ *
+ * Behavioral model of the Si4455 command set used by the si4455 driver,
+ * behind a software SPI controller with simulated SDN and NIRQ lines.
+ * The si4455 driver probes against the simulated radios without hardware.
+ * The radios share a simulated medium with per-link path loss and packet
+ * loss, overlapping transmissions on a channel collide.
+ */
+#include <linux/debugfs.h>
+#include <linux/device.h>
+#include <linux/gpio/driver.h>
+#include <linux/gpio/machine.h>
+#include <linux/hrtimer.h>
+#include <linux/interrupt.h>
+#include <linux/irq.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/platform_device.h>
+#include <linux/property.h>
+#include <linux/random.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/spi/spi.h>
+#include <linux/string.h>
+#include <linux/workqueue.h>
+
+#define SI4455_SIM_NAME						"si4455-sim"
+#define SI4455_SIM_RADIOS_MAX					8
+#define SI4455_SIM_FIFO_SIZE					64
+#define SI4455_SIM_REPLY_SIZE					16
+#define SI4455_SIM_PROP_GROUPS					256
+#define SI4455_SIM_PROP_SIZE					256
+#define SI4455_SIM_PACKET_OVERHEAD				10
+#define SI4455_SIM_POR_US					6000
+#define SI4455_SIM_PPM						1000000
+#define SI4455_SIM_GPIO_SDN					0
+#define SI4455_SIM_GPIO_NIRQ					1
+#define SI4455_SIM_GPIO_COUNT					2
+
+#define SI4455_SIM_CMD_PART_INFO				0x01
+#define SI4455_SIM_CMD_POWER_UP					0x02
+#define SI4455_SIM_CMD_SET_PROPERTY				0x11
+#define SI4455_SIM_CMD_GET_PROPERTY				0x12
+#define SI4455_SIM_CMD_FIFO_INFO				0x15
+#define SI4455_SIM_CMD_EZCONFIG_CHECK				0x19
+#define SI4455_SIM_CMD_GET_INT_STATUS				0x20
+#define SI4455_SIM_CMD_GET_MODEM_STATUS				0x22
+#define SI4455_SIM_CMD_START_TX					0x31
+#define SI4455_SIM_CMD_START_RX					0x32
+#define SI4455_SIM_CMD_CHANGE_STATE				0x34
+#define SI4455_SIM_CMD_READ_CMD_BUFF				0x44
+#define SI4455_SIM_CMD_WRITE_TX_FIFO				0x66
+#define SI4455_SIM_CMD_READ_RX_FIFO				0x77
+
+#define SI4455_SIM_STATE_NOCHANGE				0
+#define SI4455_SIM_STATE_SLEEP					1
+#define SI4455_SIM_STATE_READY					3
+#define SI4455_SIM_STATE_TX					7
+#define SI4455_SIM_STATE_RX					8
+
+#define SI4455_SIM_FIFO_INFO_TX_RESET				0x01
+#define SI4455_SIM_FIFO_INFO_RX_RESET				0x02
+
+#define SI4455_SIM_INT_PH					0x01
+#define SI4455_SIM_INT_MODEM					0x02
+#define SI4455_SIM_INT_CHIP					0x04
+#define SI4455_SIM_PH_PACKET_SENT				0x20
+#define SI4455_SIM_PH_PACKET_RX					0x10
+#define SI4455_SIM_PH_CRC_ERROR					0x08
+#define SI4455_SIM_MODEM_PREAMBLE_DETECT			0x02
+#define SI4455_SIM_MODEM_SYNC_DETECT				0x01
+#define SI4455_SIM_CHIP_FIFO_UO					0x20
+#define SI4455_SIM_CHIP_CMD_ERROR				0x08
+#define SI4455_SIM_CHIP_READY					0x04
+
+/* INT_CTL group */
+#define SI4455_SIM_PROP_INT_CTL					0x01
+#define SI4455_SIM_PROP_INT_CTL_ENABLE				0x00
+#define SI4455_SIM_PROP_INT_CTL_PH_ENABLE			0x01
+#define SI4455_SIM_PROP_INT_CTL_MODEM_ENABLE			0x02
+#define SI4455_SIM_PROP_INT_CTL_CHIP_ENABLE			0x03
+
+static unsigned int radios = 2;
+module_param(radios, uint, 0444);
+MODULE_PARM_DESC(radios, "Number of simulated radios (1-8, default 2)");
+
+static unsigned int package_size;
+module_param(package_size, uint, 0444);
+MODULE_PARM_DESC(package_size, "silabs,package-size of the radios (default 0, variable)");
+
+static unsigned int channel;
+module_param(channel, uint, 0444);
+MODULE_PARM_DESC(channel, "silabs,tx-channel and silabs,rx-channel of the radios (default 0)");
+
+static char *firmware = "si4455_sim.ez.bin";
+module_param(firmware, charp, 0444);
+MODULE_PARM_DESC(firmware, "firmware-name of the radios (default si4455_sim.ez.bin)");
+
+static unsigned int bitrate = 10000;
+module_param(bitrate, uint, 0644);
+MODULE_PARM_DESC(bitrate, "On-air bit rate, sets the airtime of the packets (bps, default 10000)");
+
+static unsigned int cts_delay_us = 50;
+module_param(cts_delay_us, uint, 0644);
+MODULE_PARM_DESC(cts_delay_us, "Command processing time until CTS (us, default 50)");
+
+static unsigned int ber_ppm;
+module_param(ber_ppm, uint, 0644);
+MODULE_PARM_DESC(ber_ppm, "Bit errors per million received bits (default 0)");
+
+static unsigned int rssi = 120;
+module_param(rssi, uint, 0644);
+MODULE_PARM_DESC(rssi, "RSSI of the received packets without path loss (default 120)");
+
+static unsigned int noise_rssi = 40;
+module_param(noise_rssi, uint, 0644);
+MODULE_PARM_DESC(noise_rssi, "RSSI of the idle channel (default 40)");
+
+static unsigned int sensitivity = 60;
+module_param(sensitivity, uint, 0644);
+MODULE_PARM_DESC(sensitivity, "Lowest RSSI of a received packet (default 60)");
+
+static unsigned int capture_rssi = 12;
+module_param(capture_rssi, uint, 0644);
+MODULE_PARM_DESC(capture_rssi, "RSSI margin over an overlapping packet to be received (default 12)");
+
+static unsigned int loss_ppm;
+module_param(loss_ppm, uint, 0644);
+MODULE_PARM_DESC(loss_ppm, "Packets lost per million on every link (default 0)");
+
+struct si4455_sim_air_stats {
+	u32 tx_packets;
+	u32 rx_packets;
+	u32 rx_collisions;
+	u32 rx_lost;
+	u32 rx_weak;
+	u32 rx_missed;
+};
+
+enum si4455_sim_air_result {
+	SI4455_SIM_AIR_DELIVER,
+	SI4455_SIM_AIR_COLLISION,
+	SI4455_SIM_AIR_LOST,
+	SI4455_SIM_AIR_WEAK,
+	SI4455_SIM_AIR_MISSED,
+};
+
+struct si4455_sim {
+	struct platform_device *pdev;
+	struct spi_controller *ctlr;
+	struct spi_device *spi;
+	struct gpio_chip gc;
+	struct gpiod_lookup_table *lookup;
+	struct property_entry props[6];
+	struct software_node node;
+	struct hrtimer tx_timer;
+	struct work_struct nirq_work;
+	spinlock_t lock;			/* chip state */
+	char label[32];
+	char spi_name[32];
+	int index;
+	int irq;
+	bool sdn;
+	bool powered;
+	bool ez_loading;
+	bool nirq;
+	ktime_t cts_time;
+	u8 state;
+	u8 channel;
+	u8 tx_next_state;
+	u8 rx_valid_state;
+	u8 rx_invalid_state;
+	u16 rx_length;
+	u8 ph_pend;
+	u8 modem_pend;
+	u8 chip_pend;
+	u8 latch_rssi;
+	bool rssi_hold;
+	u8 reply[SI4455_SIM_REPLY_SIZE];
+	u8 tx_fifo[SI4455_SIM_FIFO_SIZE];
+	u32 tx_count;
+	u8 rx_fifo[SI4455_SIM_FIFO_SIZE];
+	u32 rx_count;
+	u8 packet[SI4455_SIM_FIFO_SIZE];
+	u32 packet_length;
+	u8 props_data[SI4455_SIM_PROP_GROUPS][SI4455_SIM_PROP_SIZE];
+	/* The last transmission, guarded by si4455_sim_air_lock */
+	u8 air_channel;
+	ktime_t air_start;
+	ktime_t air_end;
+	struct si4455_sim_air_stats air_stats;
+};
+
+static struct si4455_sim *si4455_sims[SI4455_SIM_RADIOS_MAX];
+static struct dentry *si4455_sim_dbgfs_dir;
+
+/*
+ * Lock order: sim->lock, then si4455_sim_air_lock.
+ */
+static DEFINE_SPINLOCK(si4455_sim_air_lock);
+static u8 si4455_sim_path_loss[SI4455_SIM_RADIOS_MAX][SI4455_SIM_RADIOS_MAX];
+static u32 si4455_sim_loss_ppm[SI4455_SIM_RADIOS_MAX][SI4455_SIM_RADIOS_MAX];
+
+static u8 si4455_sim_prop(struct si4455_sim *sim, u8 group, u8 index)
+{
+	return sim->props_data[group][index];
+}
+
+/*
+ * NIRQ is asserted while an enabled interrupt is pending,
+ * the interrupt is raised on its falling edge.
+ * Must be called with sim->lock held.
+ */
+static void si4455_sim_nirq_update(struct si4455_sim *sim)
+{
+	u8 enable = si4455_sim_prop(sim, SI4455_SIM_PROP_INT_CTL,
+				    SI4455_SIM_PROP_INT_CTL_ENABLE);
+	bool nirq = false;
+
+	if (enable & SI4455_SIM_INT_PH)
+		nirq |= sim->ph_pend &
+			si4455_sim_prop(sim, SI4455_SIM_PROP_INT_CTL,
+					SI4455_SIM_PROP_INT_CTL_PH_ENABLE);
+	if (enable & SI4455_SIM_INT_MODEM)
+		nirq |= sim->modem_pend &
+			si4455_sim_prop(sim, SI4455_SIM_PROP_INT_CTL,
+					SI4455_SIM_PROP_INT_CTL_MODEM_ENABLE);
+	if (enable & SI4455_SIM_INT_CHIP)
+		nirq |= sim->chip_pend &
+			si4455_sim_prop(sim, SI4455_SIM_PROP_INT_CTL,
+					SI4455_SIM_PROP_INT_CTL_CHIP_ENABLE);
+
+	if (nirq && !sim->nirq)
+		schedule_work(&sim->nirq_work);
+	sim->nirq = nirq;
+}
+
+static void si4455_sim_nirq_proc(struct work_struct *ws)
+{
+	struct si4455_sim *sim = container_of(ws, struct si4455_sim, nirq_work);
+
+	handle_nested_irq(sim->irq);
+}
+
+/*
+ * Must be called with sim->lock held.
+ */
+static void si4455_sim_next_state(struct si4455_sim *sim, u8 state)
+{
+	if (state != SI4455_SIM_STATE_NOCHANGE)
+		sim->state = state;
+}
+
+/*
+ * RSSI of the sender at the receiver.
+ * Must be called with si4455_sim_air_lock held.
+ */
+static u8 si4455_sim_link_rssi(struct si4455_sim *from, struct si4455_sim *to)
+{
+	u8 loss = si4455_sim_path_loss[from->index][to->index];
+
+	return rssi > loss ? rssi - loss : 0;
+}
+
+/*
+ * Must be called with si4455_sim_air_lock held.
+ */
+static bool si4455_sim_air_overlap(struct si4455_sim *a, struct si4455_sim *b)
+{
+	return ktime_before(a->air_start, b->air_end) &&
+	       ktime_before(b->air_start, a->air_end);
+}
+
+/*
+ * The strongest transmission on the channel, or the noise floor.
+ * Outside RX the RSSI of the last received packet is held.
+ * Must be called with sim->lock held.
+ */
+static u8 si4455_sim_curr_rssi(struct si4455_sim *sim)
+{
+	ktime_t now = ktime_get();
+	u8 curr = noise_rssi;
+	u8 link;
+	u32 i;
+
+	if (sim->rssi_hold || sim->state != SI4455_SIM_STATE_RX)
+		return sim->latch_rssi;
+
+	spin_lock(&si4455_sim_air_lock);
+	for (i = 0; i < radios; i++) {
+		struct si4455_sim *other = si4455_sims[i];
+
+		if (!other || other == sim ||
+		    other->air_channel != sim->channel ||
+		    ktime_before(now, other->air_start) ||
+		    !ktime_before(now, other->air_end))
+			continue;
+
+		link = si4455_sim_link_rssi(other, sim);
+		if (link > curr)
+			curr = link;
+	}
+	spin_unlock(&si4455_sim_air_lock);
+
+	return curr;
+}
+
+/*
+ * Must be called with sim->lock held.
+ */
+static void si4455_sim_air_start(struct si4455_sim *sim, u64 airtime_us)
+{
+	spin_lock(&si4455_sim_air_lock);
+	sim->air_channel = sim->channel;
+	sim->air_start = ktime_get();
+	sim->air_end = ktime_add_us(sim->air_start, airtime_us);
+	sim->air_stats.tx_packets++;
+	spin_unlock(&si4455_sim_air_lock);
+}
+
+/*
+ * An aborted transmission leaves the air immediately.
+ * Must be called with sim->lock held.
+ */
+static void si4455_sim_air_abort(struct si4455_sim *sim)
+{
+	ktime_t now = ktime_get();
+
+	spin_lock(&si4455_sim_air_lock);
+	if (ktime_before(now, sim->air_end))
+		sim->air_end = now;
+	spin_unlock(&si4455_sim_air_lock);
+}
+
+/*
+ * Must be called with sim->lock held.
+ */
+static void si4455_sim_fifo_info(struct si4455_sim *sim, const u8 *in,
+				 u32 length)
+{
+	u8 fifo = length > 1 ? in[1] : 0;
+
+	if (fifo & SI4455_SIM_FIFO_INFO_TX_RESET)
+		sim->tx_count = 0;
+	if (fifo & SI4455_SIM_FIFO_INFO_RX_RESET)
+		sim->rx_count = 0;
+
+	sim->reply[0] = sim->rx_count;
+	sim->reply[1] = SI4455_SIM_FIFO_SIZE - sim->tx_count;
+}
+
+/*
+ * Bits left zero in the arguments clear the pending interrupts,
+ * without arguments every pending interrupt is cleared.
+ * Must be called with sim->lock held.
+ */
+static void si4455_sim_get_int_status(struct si4455_sim *sim, const u8 *in,
+				      u32 length)
+{
+	sim->reply[0] = (sim->ph_pend ? SI4455_SIM_INT_PH : 0) |
+			(sim->modem_pend ? SI4455_SIM_INT_MODEM : 0) |
+			(sim->chip_pend ? SI4455_SIM_INT_CHIP : 0);
+	sim->reply[1] = sim->reply[0];
+	sim->reply[2] = sim->ph_pend;
+	sim->reply[3] = sim->ph_pend;
+	sim->reply[4] = sim->modem_pend;
+	sim->reply[5] = sim->modem_pend;
+	sim->reply[6] = sim->chip_pend;
+	sim->reply[7] = sim->chip_pend;
+
+	sim->ph_pend &= length > 1 ? in[1] : 0;
+	sim->modem_pend &= length > 2 ? in[2] : 0;
+	sim->chip_pend &= length > 3 ? in[3] : 0;
+}
+
+/*
+ * Must be called with sim->lock held.
+ */
+static void si4455_sim_get_modem_status(struct si4455_sim *sim, const u8 *in,
+					u32 length)
+{
+	sim->reply[0] = sim->modem_pend;
+	sim->reply[1] = sim->modem_pend;
+	sim->reply[2] = si4455_sim_curr_rssi(sim);
+	sim->reply[3] = sim->latch_rssi;
+	sim->reply[4] = sim->reply[2];
+	sim->reply[5] = sim->reply[2];
+
+	sim->modem_pend &= length > 1 ? in[1] : 0;
+}
+
+/*
+ * Must be called with sim->lock held.
+ */
+static void si4455_sim_start_tx(struct si4455_sim *sim, const u8 *in,
+				u32 length)
+{
+	u32 tx_length;
+	u64 airtime_us;
+
+	if (length < 5 || !sim->tx_count) {
+		sim->chip_pend |= SI4455_SIM_CHIP_CMD_ERROR;
+		return;
+	}
+
+	tx_length = (in[3] << 8) | in[4];
+	if (!tx_length || tx_length > sim->tx_count)
+		tx_length = sim->tx_count;
+
+	memcpy(sim->packet, sim->tx_fifo, tx_length);
+	sim->packet_length = tx_length;
+	sim->tx_count -= tx_length;
+	memmove(sim->tx_fifo, &sim->tx_fifo[tx_length], sim->tx_count);
+
+	sim->channel = in[1];
+	sim->tx_next_state = in[2] >> 4;
+	sim->state = SI4455_SIM_STATE_TX;
+
+	airtime_us = div_u64((u64)(tx_length + SI4455_SIM_PACKET_OVERHEAD) *
+			     8 * USEC_PER_SEC, max(bitrate, 1U));
+	si4455_sim_air_start(sim, airtime_us);
+	hrtimer_start(&sim->tx_timer, us_to_ktime(airtime_us),
+		      HRTIMER_MODE_REL);
+}
+
+/*
+ * Must be called with sim->lock held.
+ */
+static void si4455_sim_start_rx(struct si4455_sim *sim, const u8 *in,
+				u32 length)
+{
+	if (length < 8) {
+		sim->chip_pend |= SI4455_SIM_CHIP_CMD_ERROR;
+		return;
+	}
+
+	if (sim->state == SI4455_SIM_STATE_TX &&
+	    hrtimer_try_to_cancel(&sim->tx_timer) > 0)
+		si4455_sim_air_abort(sim);
+
+	sim->channel = in[1];
+	sim->rx_length = (in[3] << 8) | in[4];
+	sim->rx_valid_state = in[6];
+	sim->rx_invalid_state = in[7];
+	sim->state = SI4455_SIM_STATE_RX;
+	sim->rssi_hold = false;
+}
+
+/*
+ * Must be called with sim->lock held.
+ */
+static void si4455_sim_command(struct si4455_sim *sim, const u8 *in,
+			       u32 length)
+{
+	u32 count;
+
+	memset(sim->reply, 0, sizeof(sim->reply));
+
+	switch (in[0]) {
+	case SI4455_SIM_CMD_PART_INFO:
+		sim->reply[0] = 0x22;			/* CHIPREV */
+		sim->reply[1] = 0x44;			/* PART */
+		sim->reply[2] = 0x55;
+		sim->reply[7] = 0x06;			/* ROMID */
+		break;
+	case SI4455_SIM_CMD_POWER_UP:
+		memset(sim->props_data, 0, sizeof(sim->props_data));
+		sim->props_data[SI4455_SIM_PROP_INT_CTL]
+			[SI4455_SIM_PROP_INT_CTL_ENABLE] = SI4455_SIM_INT_CHIP;
+		sim->props_data[SI4455_SIM_PROP_INT_CTL]
+			[SI4455_SIM_PROP_INT_CTL_CHIP_ENABLE] =
+			SI4455_SIM_CHIP_READY;
+		sim->ez_loading = true;
+		sim->tx_count = 0;
+		sim->rx_count = 0;
+		sim->state = SI4455_SIM_STATE_READY;
+		sim->chip_pend |= SI4455_SIM_CHIP_READY;
+		break;
+	case SI4455_SIM_CMD_SET_PROPERTY:
+		if (length < 4)
+			break;
+
+		count = min_t(u32, in[2], length - 4);
+		count = min_t(u32, count, SI4455_SIM_PROP_SIZE - in[3]);
+		memcpy(&sim->props_data[in[1]][in[3]], &in[4], count);
+		break;
+	case SI4455_SIM_CMD_GET_PROPERTY:
+		if (length < 4)
+			break;
+
+		count = min_t(u32, in[2], SI4455_SIM_REPLY_SIZE);
+		count = min_t(u32, count, SI4455_SIM_PROP_SIZE - in[3]);
+		memcpy(sim->reply, &sim->props_data[in[1]][in[3]], count);
+		break;
+	case SI4455_SIM_CMD_FIFO_INFO:
+		si4455_sim_fifo_info(sim, in, length);
+		break;
+	case SI4455_SIM_CMD_EZCONFIG_CHECK:
+		sim->ez_loading = false;
+		sim->tx_count = 0;
+		break;
+	case SI4455_SIM_CMD_GET_INT_STATUS:
+		si4455_sim_get_int_status(sim, in, length);
+		break;
+	case SI4455_SIM_CMD_GET_MODEM_STATUS:
+		si4455_sim_get_modem_status(sim, in, length);
+		break;
+	case SI4455_SIM_CMD_START_TX:
+		si4455_sim_start_tx(sim, in, length);
+		break;
+	case SI4455_SIM_CMD_START_RX:
+		si4455_sim_start_rx(sim, in, length);
+		break;
+	case SI4455_SIM_CMD_CHANGE_STATE:
+		if (length < 2)
+			break;
+
+		if (sim->state == SI4455_SIM_STATE_TX &&
+		    in[1] != SI4455_SIM_STATE_TX &&
+		    hrtimer_try_to_cancel(&sim->tx_timer) > 0)
+			si4455_sim_air_abort(sim);
+		si4455_sim_next_state(sim, in[1]);
+		break;
+	default:
+		/* patch, GPIO_PIN_CFG, NOP, ... */
+		break;
+	}
+}
+
+/*
+ * Must be called with sim->lock held.
+ */
+static void si4455_sim_spi(struct si4455_sim *sim, const u8 *in, u8 *out,
+			   u32 length)
+{
+	u32 count = length - 1;
+
+	switch (in[0]) {
+	case SI4455_SIM_CMD_READ_CMD_BUFF:
+		if (length < 2 || ktime_before(ktime_get(), sim->cts_time))
+			break;
+
+		out[1] = 0xff;
+		memcpy(&out[2], sim->reply,
+		       min_t(u32, length - 2, SI4455_SIM_REPLY_SIZE));
+		break;
+	case SI4455_SIM_CMD_READ_RX_FIFO:
+		if (count > sim->rx_count) {
+			sim->chip_pend |= SI4455_SIM_CHIP_FIFO_UO;
+			count = sim->rx_count;
+		}
+		memcpy(&out[1], sim->rx_fifo, count);
+		sim->rx_count -= count;
+		memmove(sim->rx_fifo, &sim->rx_fifo[count], sim->rx_count);
+		break;
+	case SI4455_SIM_CMD_WRITE_TX_FIFO:
+		/* The EZConfig array is loaded through the TX FIFO */
+		if (sim->ez_loading)
+			break;
+
+		if (sim->tx_count + count > SI4455_SIM_FIFO_SIZE) {
+			sim->chip_pend |= SI4455_SIM_CHIP_FIFO_UO;
+			count = SI4455_SIM_FIFO_SIZE - sim->tx_count;
+		}
+		memcpy(&sim->tx_fifo[sim->tx_count], &in[1], count);
+		sim->tx_count += count;
+		break;
+	default:
+		si4455_sim_command(sim, in, length);
+		sim->cts_time = ktime_add_us(ktime_get(), cts_delay_us);
+		break;
+	}
+}
+
+static int si4455_sim_transfer_one_message(struct spi_controller *ctlr,
+					   struct spi_message *msg)
+{
+	struct si4455_sim *sim = spi_controller_get_devdata(ctlr);
+	struct spi_transfer *xfer;
+	unsigned long flags;
+	u32 length = 0;
+	u32 pos = 0;
+	u8 *in;
+	u8 *out;
+	int ret = 0;
+
+	list_for_each_entry(xfer, &msg->transfers, transfer_list)
+		length += xfer->len;
+
+	in = kzalloc(length, GFP_KERNEL);
+	out = kzalloc(length, GFP_KERNEL);
+	if (!in || !out) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	list_for_each_entry(xfer, &msg->transfers, transfer_list) {
+		if (xfer->tx_buf)
+			memcpy(&in[pos], xfer->tx_buf, xfer->len);
+		pos += xfer->len;
+	}
+
+	spin_lock_irqsave(&sim->lock, flags);
+	if (sim->powered && length) {
+		si4455_sim_spi(sim, in, out, length);
+		si4455_sim_nirq_update(sim);
+	}
+	spin_unlock_irqrestore(&sim->lock, flags);
+
+	pos = 0;
+	list_for_each_entry(xfer, &msg->transfers, transfer_list) {
+		if (xfer->rx_buf)
+			memcpy(xfer->rx_buf, &out[pos], xfer->len);
+		pos += xfer->len;
+	}
+	msg->actual_length = length;
+out:
+	kfree(out);
+	kfree(in);
+	msg->status = ret;
+	spi_finalize_current_message(ctlr);
+
+	return ret;
+}
+
+/*
+ * Fate of a packet at a receiver: a transmitting radio misses it,
+ * below sensitivity it is not heard, it may be lost on the link,
+ * and it collides with an overlapping transmission on the channel
+ * unless it is stronger by capture_rssi.
+ * Must be called with si4455_sim_air_lock held.
+ */
+static enum si4455_sim_air_result
+si4455_sim_air_check(struct si4455_sim *sender, struct si4455_sim *receiver,
+		     u8 *link_rssi)
+{
+	u32 ppm;
+	u32 i;
+
+	if (si4455_sim_air_overlap(sender, receiver))
+		return SI4455_SIM_AIR_MISSED;
+
+	*link_rssi = si4455_sim_link_rssi(sender, receiver);
+	if (*link_rssi < sensitivity)
+		return SI4455_SIM_AIR_WEAK;
+
+	ppm = loss_ppm + si4455_sim_loss_ppm[sender->index][receiver->index];
+	if (ppm && prandom_u32_max(SI4455_SIM_PPM) < ppm)
+		return SI4455_SIM_AIR_LOST;
+
+	for (i = 0; i < radios; i++) {
+		struct si4455_sim *other = si4455_sims[i];
+		u8 other_rssi;
+
+		if (!other || other == sender || other == receiver ||
+		    other->air_channel != sender->air_channel ||
+		    !si4455_sim_air_overlap(sender, other))
+			continue;
+
+		other_rssi = si4455_sim_link_rssi(other, receiver);
+		if (other_rssi > noise_rssi &&
+		    other_rssi + capture_rssi > *link_rssi)
+			return SI4455_SIM_AIR_COLLISION;
+	}
+
+	return SI4455_SIM_AIR_DELIVER;
+}
+
+/*
+ * Delivers a packet to a radio listening on the channel,
+ * a collided packet is received with CRC error.
+ */
+static void si4455_sim_receive(struct si4455_sim *sim,
+			       struct si4455_sim *sender, u8 channel,
+			       const u8 *packet, u32 length)
+{
+	struct si4455_sim_air_stats *stats = &sim->air_stats;
+	enum si4455_sim_air_result result;
+	unsigned long flags;
+	u8 data[SI4455_SIM_FIFO_SIZE] = { 0 };
+	u8 link_rssi = 0;
+	bool crc_error;
+	u32 count;
+	u32 i;
+
+	spin_lock_irqsave(&sim->lock, flags);
+	if (!sim->powered || sim->state != SI4455_SIM_STATE_RX ||
+	    sim->channel != channel)
+		goto out;
+
+	spin_lock(&si4455_sim_air_lock);
+	result = si4455_sim_air_check(sender, sim, &link_rssi);
+	switch (result) {
+	case SI4455_SIM_AIR_DELIVER:
+		stats->rx_packets++;
+		break;
+	case SI4455_SIM_AIR_COLLISION:
+		stats->rx_collisions++;
+		break;
+	case SI4455_SIM_AIR_LOST:
+		stats->rx_lost++;
+		break;
+	case SI4455_SIM_AIR_WEAK:
+		stats->rx_weak++;
+		break;
+	case SI4455_SIM_AIR_MISSED:
+		stats->rx_missed++;
+		break;
+	}
+	spin_unlock(&si4455_sim_air_lock);
+
+	if (result != SI4455_SIM_AIR_DELIVER &&
+	    result != SI4455_SIM_AIR_COLLISION)
+		goto out;
+
+	crc_error = result == SI4455_SIM_AIR_COLLISION;
+
+	/*
+	 * In variable length mode(zero RX length) the first byte
+	 * is the length field, it is not stored in the RX FIFO.
+	 */
+	if (sim->rx_length) {
+		count = min_t(u32, sim->rx_length, SI4455_SIM_FIFO_SIZE);
+		memcpy(data, packet, min(count, length));
+	} else {
+		count = length ? min_t(u32, packet[0], length - 1) : 0;
+		memcpy(data, &packet[1], count);
+	}
+
+	for (i = 0; ber_ppm && i < count * 8; i++) {
+		if (prandom_u32_max(SI4455_SIM_PPM) < ber_ppm) {
+			data[i / 8] ^= BIT(i % 8);
+			crc_error = true;
+		}
+	}
+
+	if (sim->rx_count + count > SI4455_SIM_FIFO_SIZE) {
+		sim->chip_pend |= SI4455_SIM_CHIP_FIFO_UO;
+		count = SI4455_SIM_FIFO_SIZE - sim->rx_count;
+	}
+	memcpy(&sim->rx_fifo[sim->rx_count], data, count);
+	sim->rx_count += count;
+
+	sim->latch_rssi = link_rssi;
+	sim->rssi_hold = true;
+	sim->modem_pend |= SI4455_SIM_MODEM_PREAMBLE_DETECT |
+			   SI4455_SIM_MODEM_SYNC_DETECT;
+	if (crc_error) {
+		sim->ph_pend |= SI4455_SIM_PH_CRC_ERROR;
+		si4455_sim_next_state(sim, sim->rx_invalid_state);
+	} else {
+		sim->ph_pend |= SI4455_SIM_PH_PACKET_RX;
+		si4455_sim_next_state(sim, sim->rx_valid_state);
+	}
+	si4455_sim_nirq_update(sim);
+out:
+	spin_unlock_irqrestore(&sim->lock, flags);
+}
+
+/*
+ * Every other radio hears the packet at the end of its airtime.
+ */
+static void si4455_sim_air(struct si4455_sim *sender, u8 channel,
+			   const u8 *packet, u32 length)
+{
+	u32 i;
+
+	for (i = 0; i < radios; i++) {
+		if (si4455_sims[i] && si4455_sims[i] != sender)
+			si4455_sim_receive(si4455_sims[i], sender, channel,
+					   packet, length);
+	}
+}
+
+static enum hrtimer_restart si4455_sim_tx_event(struct hrtimer *t)
+{
+	struct si4455_sim *sim = container_of(t, struct si4455_sim, tx_timer);
+	u8 packet[SI4455_SIM_FIFO_SIZE];
+	unsigned long flags;
+	u32 length;
+	u8 channel;
+
+	spin_lock_irqsave(&sim->lock, flags);
+	if (sim->state != SI4455_SIM_STATE_TX) {
+		spin_unlock_irqrestore(&sim->lock, flags);
+		return HRTIMER_NORESTART;
+	}
+
+	length = sim->packet_length;
+	channel = sim->channel;
+	memcpy(packet, sim->packet, length);
+	sim->state = SI4455_SIM_STATE_READY;
+	si4455_sim_next_state(sim, sim->tx_next_state);
+	sim->ph_pend |= SI4455_SIM_PH_PACKET_SENT;
+	si4455_sim_nirq_update(sim);
+	spin_unlock_irqrestore(&sim->lock, flags);
+
+	si4455_sim_air(sim, channel, packet, length);
+
+	return HRTIMER_NORESTART;
+}
+
+/*
+ * SDN high holds the chip in shutdown, its state is lost.
+ */
+static void si4455_sim_sdn(struct si4455_sim *sim, bool sdn)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&sim->lock, flags);
+	if (sdn && sim->powered) {
+		if (hrtimer_try_to_cancel(&sim->tx_timer) > 0)
+			si4455_sim_air_abort(sim);
+		sim->powered = false;
+		sim->state = SI4455_SIM_STATE_NOCHANGE;
+		sim->ph_pend = 0;
+		sim->modem_pend = 0;
+		sim->chip_pend = 0;
+		memset(sim->props_data, 0, sizeof(sim->props_data));
+		si4455_sim_nirq_update(sim);
+	} else if (!sdn && !sim->powered) {
+		sim->powered = true;
+		sim->ez_loading = false;
+		sim->tx_count = 0;
+		sim->rx_count = 0;
+		sim->state = SI4455_SIM_STATE_READY;
+		sim->cts_time = ktime_add_us(ktime_get(), SI4455_SIM_POR_US);
+	}
+	sim->sdn = sdn;
+	spin_unlock_irqrestore(&sim->lock, flags);
+}
+
+static int si4455_sim_gpio_get(struct gpio_chip *gc, unsigned int offset)
+{
+	struct si4455_sim *sim = gpiochip_get_data(gc);
+
+	/* NIRQ is active low */
+	return offset == SI4455_SIM_GPIO_SDN ? sim->sdn : !sim->nirq;
+}
+
+static void si4455_sim_gpio_set(struct gpio_chip *gc, unsigned int offset,
+				int value)
+{
+	struct si4455_sim *sim = gpiochip_get_data(gc);
+
+	if (offset == SI4455_SIM_GPIO_SDN)
+		si4455_sim_sdn(sim, value);
+}
+
+static int si4455_sim_gpio_get_direction(struct gpio_chip *gc,
+					 unsigned int offset)
+{
+	return offset == SI4455_SIM_GPIO_SDN ? GPIO_LINE_DIRECTION_OUT
+		: GPIO_LINE_DIRECTION_IN;
+}
+
+static int si4455_sim_gpio_direction_input(struct gpio_chip *gc,
+					   unsigned int offset)
+{
+	return offset == SI4455_SIM_GPIO_NIRQ ? 0 : -EPERM;
+}
+
+static int si4455_sim_gpio_direction_output(struct gpio_chip *gc,
+					    unsigned int offset, int value)
+{
+	if (offset != SI4455_SIM_GPIO_SDN)
+		return -EPERM;
+
+	si4455_sim_gpio_set(gc, offset, value);
+
+	return 0;
+}
+
+static int si4455_sim_gpio_to_irq(struct gpio_chip *gc, unsigned int offset)
+{
+	struct si4455_sim *sim = gpiochip_get_data(gc);
+
+	return offset == SI4455_SIM_GPIO_NIRQ ? sim->irq : -ENXIO;
+}
+
+static int si4455_sim_add_radio(struct si4455_sim *sim)
+{
+	struct spi_device *spi;
+	int ret;
+
+	spi = spi_alloc_device(sim->ctlr);
+	if (!spi)
+		return -ENOMEM;
+
+	strscpy(spi->modalias, "Si4455", sizeof(spi->modalias));
+	spi->max_speed_hz = 1000000;
+	spi->chip_select = 0;
+	spi->mode = SPI_MODE_0;
+	spi->bits_per_word = 8;
+	spi->irq = sim->irq;
+
+	sim->props[0] = PROPERTY_ENTRY_U32("silabs,package-size",
+					   package_size);
+	sim->props[1] = PROPERTY_ENTRY_U32("silabs,tx-channel", channel);
+	sim->props[2] = PROPERTY_ENTRY_U32("silabs,rx-channel", channel);
+	sim->props[3] = PROPERTY_ENTRY_U32("silabs,tx-timeout-ms", 1000);
+	sim->props[4] = PROPERTY_ENTRY_STRING("firmware-name", firmware);
+	sim->node.properties = sim->props;
+
+	ret = device_add_software_node(&spi->dev, &sim->node);
+	if (ret) {
+		spi_dev_put(spi);
+		return ret;
+	}
+
+	ret = spi_add_device(spi);
+	if (ret) {
+		device_remove_software_node(&spi->dev);
+		spi_dev_put(spi);
+		return ret;
+	}
+	sim->spi = spi;
+
+	return 0;
+}
+
+static void si4455_sim_del_radio(struct si4455_sim *sim)
+{
+	if (!sim->spi)
+		return;
+
+	get_device(&sim->spi->dev);
+	spi_unregister_device(sim->spi);
+	device_remove_software_node(&sim->spi->dev);
+	put_device(&sim->spi->dev);
+	sim->spi = NULL;
+}
+
+static void si4455_sim_destroy(struct si4455_sim *sim)
+{
+	si4455_sim_del_radio(sim);
+	if (sim->lookup)
+		gpiod_remove_lookup_table(sim->lookup);
+	if (sim->ctlr)
+		spi_unregister_controller(sim->ctlr);
+	hrtimer_cancel(&sim->tx_timer);
+	cancel_work_sync(&sim->nirq_work);
+	if (sim->gc.parent)
+		gpiochip_remove(&sim->gc);
+	if (sim->irq > 0)
+		irq_free_desc(sim->irq);
+	if (!IS_ERR_OR_NULL(sim->pdev))
+		platform_device_unregister(sim->pdev);
+	kfree(sim->lookup);
+	kfree(sim);
+}
+
+/*
+ * shutdown-gpios of the radio, SDN is active high on the chip
+ */
+static int si4455_sim_add_lookup(struct si4455_sim *sim)
+{
+	struct gpiod_lookup sdn = GPIO_LOOKUP(sim->label, SI4455_SIM_GPIO_SDN,
+					      "shutdown", GPIO_ACTIVE_LOW);
+
+	snprintf(sim->spi_name, sizeof(sim->spi_name), "spi%u.0",
+		 sim->ctlr->bus_num);
+	sim->lookup = kzalloc(struct_size(sim->lookup, table, 2), GFP_KERNEL);
+	if (!sim->lookup)
+		return -ENOMEM;
+
+	sim->lookup->dev_id = sim->spi_name;
+	sim->lookup->table[0] = sdn;
+	gpiod_add_lookup_table(sim->lookup);
+
+	return 0;
+}
+
+static struct si4455_sim *si4455_sim_create(int index)
+{
+	struct spi_controller *ctlr;
+	struct si4455_sim *sim;
+	int ret;
+
+	sim = kzalloc(sizeof(*sim), GFP_KERNEL);
+	if (!sim)
+		return ERR_PTR(-ENOMEM);
+
+	spin_lock_init(&sim->lock);
+	INIT_WORK(&sim->nirq_work, si4455_sim_nirq_proc);
+	hrtimer_init(&sim->tx_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	sim->tx_timer.function = si4455_sim_tx_event;
+	sim->sdn = true;
+	sim->index = index;
+	snprintf(sim->label, sizeof(sim->label), "%s.%d", SI4455_SIM_NAME,
+		 index);
+
+	sim->pdev = platform_device_register_simple(SI4455_SIM_NAME, index,
+						    NULL, 0);
+	if (IS_ERR(sim->pdev)) {
+		ret = PTR_ERR(sim->pdev);
+		goto out;
+	}
+
+	/* NIRQ */
+	sim->irq = irq_alloc_desc(NUMA_NO_NODE);
+	if (sim->irq < 0) {
+		ret = sim->irq;
+		goto out;
+	}
+	irq_set_chip_and_handler(sim->irq, &dummy_irq_chip, handle_simple_irq);
+	irq_set_nested_thread(sim->irq, true);
+	irq_modify_status(sim->irq, IRQ_NOREQUEST | IRQ_NOPROBE, 0);
+
+	/* SDN and NIRQ lines */
+	sim->gc.label = sim->label;
+	sim->gc.parent = &sim->pdev->dev;
+	sim->gc.owner = THIS_MODULE;
+	sim->gc.base = -1;
+	sim->gc.ngpio = SI4455_SIM_GPIO_COUNT;
+	sim->gc.get = si4455_sim_gpio_get;
+	sim->gc.set = si4455_sim_gpio_set;
+	sim->gc.get_direction = si4455_sim_gpio_get_direction;
+	sim->gc.direction_input = si4455_sim_gpio_direction_input;
+	sim->gc.direction_output = si4455_sim_gpio_direction_output;
+	sim->gc.to_irq = si4455_sim_gpio_to_irq;
+	ret = gpiochip_add_data(&sim->gc, sim);
+	if (ret) {
+		sim->gc.parent = NULL;
+		goto out;
+	}
+
+	ctlr = spi_alloc_master(&sim->pdev->dev, 0);
+	if (!ctlr) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	ctlr->bus_num = -1;
+	ctlr->num_chipselect = 1;
+	ctlr->mode_bits = SPI_CPOL | SPI_CPHA;
+	ctlr->bits_per_word_mask = SPI_BPW_MASK(8);
+	ctlr->transfer_one_message = si4455_sim_transfer_one_message;
+	spi_controller_set_devdata(ctlr, sim);
+	ret = spi_register_controller(ctlr);
+	if (ret) {
+		spi_controller_put(ctlr);
+		goto out;
+	}
+	sim->ctlr = ctlr;
+
+	ret = si4455_sim_add_lookup(sim);
+	if (ret)
+		goto out;
+
+	return sim;
+out:
+	si4455_sim_destroy(sim);
+
+	return ERR_PTR(ret);
+}
+
+static int si4455_sim_links_show(struct seq_file *m, void *v)
+{
+	unsigned long flags;
+	u32 i;
+	u32 j;
+
+	seq_puts(m, "from to path_loss loss_ppm rssi\n");
+	spin_lock_irqsave(&si4455_sim_air_lock, flags);
+	for (i = 0; i < radios; i++) {
+		for (j = 0; j < radios; j++) {
+			if (i == j)
+				continue;
+
+			seq_printf(m, "%u %u %u %u %u\n", i, j,
+				   si4455_sim_path_loss[i][j],
+				   si4455_sim_loss_ppm[i][j],
+				   si4455_sim_link_rssi(si4455_sims[i],
+							si4455_sims[j]));
+		}
+	}
+	spin_unlock_irqrestore(&si4455_sim_air_lock, flags);
+
+	return 0;
+}
+
+static int si4455_sim_links_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, si4455_sim_links_show, inode->i_private);
+}
+
+/*
+ * Sets a directed link: "<from> <to> <path_loss> <loss_ppm>"
+ */
+static ssize_t si4455_sim_links_write(struct file *file,
+				      const char __user *ubuf, size_t count,
+				      loff_t *ppos)
+{
+	unsigned long flags;
+	u32 val[4];
+	char *tokens;
+	char *cur;
+	char *tok;
+	int n = 0;
+	int ret = 0;
+
+	tokens = memdup_user_nul(ubuf, count);
+	if (IS_ERR(tokens))
+		return PTR_ERR(tokens);
+
+	cur = tokens;
+	while ((tok = strsep(&cur, " ,\t\n")) != NULL) {
+		if (*tok == '\0')
+			continue;
+
+		if (n == ARRAY_SIZE(val)) {
+			ret = -E2BIG;
+			break;
+		}
+
+		ret = kstrtou32(tok, 10, &val[n]);
+		if (ret)
+			break;
+
+		n++;
+	}
+	kfree(tokens);
+	if (ret)
+		return ret;
+
+	if (n != ARRAY_SIZE(val) || val[0] >= radios || val[1] >= radios ||
+	    val[0] == val[1] || val[2] > U8_MAX || val[3] > SI4455_SIM_PPM)
+		return -EINVAL;
+
+	spin_lock_irqsave(&si4455_sim_air_lock, flags);
+	si4455_sim_path_loss[val[0]][val[1]] = val[2];
+	si4455_sim_loss_ppm[val[0]][val[1]] = val[3];
+	spin_unlock_irqrestore(&si4455_sim_air_lock, flags);
+
+	return count;
+}
+
+static const struct file_operations si4455_sim_links_fops = {
+	.owner		= THIS_MODULE,
+	.open		= si4455_sim_links_open,
+	.read		= seq_read,
+	.write		= si4455_sim_links_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int si4455_sim_medium_show(struct seq_file *m, void *v)
+{
+	struct si4455_sim_air_stats *stats;
+	unsigned long flags;
+	u32 i;
+
+	seq_puts(m, "radio tx_packets rx_packets rx_collisions rx_lost rx_weak rx_missed\n");
+	spin_lock_irqsave(&si4455_sim_air_lock, flags);
+	for (i = 0; i < radios; i++) {
+		stats = &si4455_sims[i]->air_stats;
+		seq_printf(m, "%u %u %u %u %u %u %u\n", i, stats->tx_packets,
+			   stats->rx_packets, stats->rx_collisions,
+			   stats->rx_lost, stats->rx_weak, stats->rx_missed);
+	}
+	spin_unlock_irqrestore(&si4455_sim_air_lock, flags);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(si4455_sim_medium);
+
+static void si4455_sim_remove_all(void)
+{
+	int i;
+
+	debugfs_remove_recursive(si4455_sim_dbgfs_dir);
+	si4455_sim_dbgfs_dir = NULL;
+
+	/*
+	 * Unbind every radio and stop the packets on air
+	 * before a chip model goes away.
+	 */
+	for (i = 0; i < SI4455_SIM_RADIOS_MAX; i++) {
+		if (!si4455_sims[i])
+			continue;
+
+		si4455_sim_del_radio(si4455_sims[i]);
+		si4455_sim_sdn(si4455_sims[i], true);
+	}
+
+	for (i = 0; i < SI4455_SIM_RADIOS_MAX; i++) {
+		if (si4455_sims[i])
+			hrtimer_cancel(&si4455_sims[i]->tx_timer);
+	}
+
+	for (i = 0; i < SI4455_SIM_RADIOS_MAX; i++) {
+		if (si4455_sims[i])
+			si4455_sim_destroy(si4455_sims[i]);
+		si4455_sims[i] = NULL;
+	}
+}
+
+static int __init si4455_sim_init(void)
+{
+	struct si4455_sim *sim;
+	int ret;
+	int i;
+
+	if (radios == 0 || radios > SI4455_SIM_RADIOS_MAX)
+		return -EINVAL;
+
+	for (i = 0; i < radios; i++) {
+		sim = si4455_sim_create(i);
+		if (IS_ERR(sim)) {
+			ret = PTR_ERR(sim);
+			goto out;
+		}
+		si4455_sims[i] = sim;
+	}
+
+	si4455_sim_dbgfs_dir = debugfs_create_dir(SI4455_SIM_NAME, NULL);
+	debugfs_create_file("links", 0644, si4455_sim_dbgfs_dir, NULL,
+			    &si4455_sim_links_fops);
+	debugfs_create_file("medium", 0444, si4455_sim_dbgfs_dir, NULL,
+			    &si4455_sim_medium_fops);
+
+	/*
+	 * Every chip model exists before the first radio transmits
+	 */
+	for (i = 0; i < radios; i++) {
+		ret = si4455_sim_add_radio(si4455_sims[i]);
+		if (ret) {
+			pr_err("%s: radio %d add error (%i)\n",
+			       SI4455_SIM_NAME, i, ret);
+			goto out;
+		}
+	}
+
+	return 0;
+out:
+	si4455_sim_remove_all();
+
+	return ret;
+}
+module_init(si4455_sim_init);
+
+static void __exit si4455_sim_exit(void)
+{
+	si4455_sim_remove_all();
+}
+module_exit(si4455_sim_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Jozsef Horvath <info@ministro.hu>");
+MODULE_DESCRIPTION("Si4455 radio simulator");
@@ -0,0 +1,208 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Copyright (C) 2020 Jozsef Horvath <info@ministro.hu>
+ *
+ */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM si4455
+
+#if !defined(_SI4455_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _SI4455_TRACE_H
+
+#include <linux/device.h>
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(si4455_cmd,
+	TP_PROTO(struct device *dev, u8 opcode, u32 length, u32 duration_ns,
+		 int ret),
+	TP_ARGS(dev, opcode, length, duration_ns, ret),
+	TP_STRUCT__entry(
+		__string(dev, dev_name(dev))
+		__field(u8, opcode)
+		__field(u32, length)
+		__field(u32, duration_ns)
+		__field(int, ret)
+	),
+	TP_fast_assign(
+		__assign_str(dev, dev_name(dev));
+		__entry->opcode = opcode;
+		__entry->length = length;
+		__entry->duration_ns = duration_ns;
+		__entry->ret = ret;
+	),
+	TP_printk("%s: opcode=0x%02x length=%u duration_ns=%u ret=%d",
+		  __get_str(dev), __entry->opcode, __entry->length,
+		  __entry->duration_ns, __entry->ret)
+);
+
+TRACE_EVENT(si4455_cts,
+	TP_PROTO(struct device *dev, u32 length, u32 polls, u32 wait_us,
+		 int ret),
+	TP_ARGS(dev, length, polls, wait_us, ret),
+	TP_STRUCT__entry(
+		__string(dev, dev_name(dev))
+		__field(u32, length)
+		__field(u32, polls)
+		__field(u32, wait_us)
+		__field(int, ret)
+	),
+	TP_fast_assign(
+		__assign_str(dev, dev_name(dev));
+		__entry->length = length;
+		__entry->polls = polls;
+		__entry->wait_us = wait_us;
+		__entry->ret = ret;
+	),
+	TP_printk("%s: length=%u polls=%u wait_us=%u ret=%d",
+		  __get_str(dev), __entry->length, __entry->polls,
+		  __entry->wait_us, __entry->ret)
+);
+
+TRACE_EVENT(si4455_irq,
+	TP_PROTO(struct device *dev, u8 int_pend, u8 ph_pend, u8 modem_pend,
+		 u8 chip_pend, u8 ph_status, u8 modem_status, u8 chip_status),
+	TP_ARGS(dev, int_pend, ph_pend, modem_pend, chip_pend, ph_status,
+		modem_status, chip_status),
+	TP_STRUCT__entry(
+		__string(dev, dev_name(dev))
+		__field(u8, int_pend)
+		__field(u8, ph_pend)
+		__field(u8, modem_pend)
+		__field(u8, chip_pend)
+		__field(u8, ph_status)
+		__field(u8, modem_status)
+		__field(u8, chip_status)
+	),
+	TP_fast_assign(
+		__assign_str(dev, dev_name(dev));
+		__entry->int_pend = int_pend;
+		__entry->ph_pend = ph_pend;
+		__entry->modem_pend = modem_pend;
+		__entry->chip_pend = chip_pend;
+		__entry->ph_status = ph_status;
+		__entry->modem_status = modem_status;
+		__entry->chip_status = chip_status;
+	),
+	TP_printk("%s: int_pend=0x%02x ph_pend=0x%02x modem_pend=0x%02x chip_pend=0x%02x ph_status=0x%02x modem_status=0x%02x chip_status=0x%02x",
+		  __get_str(dev), __entry->int_pend, __entry->ph_pend,
+		  __entry->modem_pend, __entry->chip_pend, __entry->ph_status,
+		  __entry->modem_status, __entry->chip_status)
+);
+
+DECLARE_EVENT_CLASS(si4455_start,
+	TP_PROTO(struct device *dev, u32 channel, u32 length),
+	TP_ARGS(dev, channel, length),
+	TP_STRUCT__entry(
+		__string(dev, dev_name(dev))
+		__field(u32, channel)
+		__field(u32, length)
+	),
+	TP_fast_assign(
+		__assign_str(dev, dev_name(dev));
+		__entry->channel = channel;
+		__entry->length = length;
+	),
+	TP_printk("%s: channel=%u length=%u",
+		  __get_str(dev), __entry->channel, __entry->length)
+);
+
+DEFINE_EVENT(si4455_start, si4455_tx_start,
+	TP_PROTO(struct device *dev, u32 channel, u32 length),
+	TP_ARGS(dev, channel, length)
+);
+
+DEFINE_EVENT(si4455_start, si4455_rx_start,
+	TP_PROTO(struct device *dev, u32 channel, u32 length),
+	TP_ARGS(dev, channel, length)
+);
+
+TRACE_EVENT(si4455_tx_done,
+	TP_PROTO(struct device *dev, u32 length, u32 airtime_us),
+	TP_ARGS(dev, length, airtime_us),
+	TP_STRUCT__entry(
+		__string(dev, dev_name(dev))
+		__field(u32, length)
+		__field(u32, airtime_us)
+	),
+	TP_fast_assign(
+		__assign_str(dev, dev_name(dev));
+		__entry->length = length;
+		__entry->airtime_us = airtime_us;
+	),
+	TP_printk("%s: length=%u airtime_us=%u",
+		  __get_str(dev), __entry->length, __entry->airtime_us)
+);
+
+TRACE_EVENT(si4455_rx_drain,
+	TP_PROTO(struct device *dev, u32 channel, u32 length, u8 rssi,
+		 bool crc_error, int ret),
+	TP_ARGS(dev, channel, length, rssi, crc_error, ret),
+	TP_STRUCT__entry(
+		__string(dev, dev_name(dev))
+		__field(u32, channel)
+		__field(u32, length)
+		__field(u8, rssi)
+		__field(bool, crc_error)
+		__field(int, ret)
+	),
+	TP_fast_assign(
+		__assign_str(dev, dev_name(dev));
+		__entry->channel = channel;
+		__entry->length = length;
+		__entry->rssi = rssi;
+		__entry->crc_error = crc_error;
+		__entry->ret = ret;
+	),
+	TP_printk("%s: channel=%u length=%u rssi=%u crc_error=%d ret=%d",
+		  __get_str(dev), __entry->channel, __entry->length,
+		  __entry->rssi, __entry->crc_error, __entry->ret)
+);
+
+TRACE_EVENT(si4455_state,
+	TP_PROTO(struct device *dev, u8 state),
+	TP_ARGS(dev, state),
+	TP_STRUCT__entry(
+		__string(dev, dev_name(dev))
+		__field(u8, state)
+	),
+	TP_fast_assign(
+		__assign_str(dev, dev_name(dev));
+		__entry->state = state;
+	),
+	TP_printk("%s: state=%s", __get_str(dev),
+		  __print_symbolic(__entry->state,
+				   { 0, "NOCHANGE" },
+				   { 1, "SLEEP" },
+				   { 2, "SPI_ACTIVE" },
+				   { 3, "READY" },
+				   { 4, "READY2" },
+				   { 5, "TX_TUNE" },
+				   { 6, "RX_TUNE" },
+				   { 7, "TX" },
+				   { 8, "RX" }))
+);
+
+TRACE_EVENT(si4455_recovery,
+	TP_PROTO(struct device *dev, const char *reason, int ret),
+	TP_ARGS(dev, reason, ret),
+	TP_STRUCT__entry(
+		__string(dev, dev_name(dev))
+		__string(reason, reason)
+		__field(int, ret)
+	),
+	TP_fast_assign(
+		__assign_str(dev, dev_name(dev));
+		__assign_str(reason, reason);
+		__entry->ret = ret;
+	),
+	TP_printk("%s: reason=%s ret=%d",
+		  __get_str(dev), __get_str(reason), __entry->ret)
+);
+
+#endif /* _SI4455_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE si4455_trace
+#include <trace/define_trace.h>